@@ -24,10 +24,12 @@
 #define PDB_H
 
 #include <pdb_fusb.h>
+#include <pdb_phy.h>
 #include <pdb_dpm.h>
 #include <pdb_pe.h>
 #include <pdb_prl.h>
 #include <pdb_int_n.h>
+#include <pdb_vbus.h>
 #include <pdb_msg.h>
 
 
@@ -97,6 +99,10 @@ struct pdb_config {
     /* User-initialized fields */
     /* Configuration information for the FUSB302B* chip */
     struct pdb_fusb_config fusb;
+    /* PHY operations, or NULL to use the FUSB302B */
+    const struct pdb_phy_ops *phy;
+    /* Pointer to PHY-specific data, for PHYs other than the FUSB302B */
+    void *phy_data;
     /* DPM callbacks */
     struct pdb_dpm_callbacks dpm;
     /* Pointer to port-specific DPM data */
@@ -108,6 +114,10 @@ struct pdb_config {
     /* Line used to detect VBUS */
     ioline_t vbus_line;
 
+    /* Shared INT_N thread serving this port, or NULL to give the port its
+     * own INT_N thread */
+    struct pdb_int_n_group *int_n_group;
+
     /* Automatically initialized fields */
     /* Policy Engine thread and related variables */
     struct pdb_pe pe;
@@ -115,6 +125,14 @@ struct pdb_config {
     struct pdb_prl prl;
     /* INT_N pin thread and related variables */
     struct pdb_int_n int_n;
+    /* VBUS measurement thread */
+    struct pdb_vbus vbus;
+
+    /* Pool of the messages passed between the threads of this port */
+    memory_pool_t msg_pool;
+    /* The messages in the pool */
+    union pd_msg _msgs[PDB_MSG_POOL_SIZE]
+        __attribute__((aligned(sizeof(stkalign_t))));
 };
 
 
@@ -122,8 +140,42 @@ struct pdb_config {
  * Initialize the PD Buddy firmware library, starting all its threads
  *
  * The I2C driver must already be initialized before calling this function.
+ * It may be called once for each USB port, each with its own struct
+ * pdb_config.  Ports sharing an I2C bus need their PHYs at different
+ * addresses, like the FUSB302B01, FUSB302B10 and FUSB302B11.
  */
 void pdb_init(struct pdb_config *);
 
+/*
+ * Get the VBUS voltage measured by the PHY, in millivolts
+ *
+ * The last measurement is used if it isn't older than PDB_VBUS_MAX_AGE_MS,
+ * like the one the VBUS measurement thread makes after each PS_RDY.
+ * Otherwise, VBUS is measured again, which takes a few milliseconds.
+ *
+ * Returns 0 if the PHY can't measure VBUS.
+ */
+uint16_t pdb_get_vbus(struct pdb_config *);
+
+/*
+ * Give a message back to the pool of its port
+ *
+ * The DPM must free the messages it keeps with this rather than with
+ * chPoolFree, so that a message left in the PHY for want of a buffer is read
+ * right away.
+ */
+void pdb_msg_free(struct pdb_config *, union pd_msg *);
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * Start the INT_N thread shared by the ports of a group
+ *
+ * Must be called after pdb_init was called for every port of the group.  In
+ * event mode, the INT_N lines are serviced from their PAL callbacks, which
+ * requires PAL_USE_CALLBACKS.
+ */
+void pdb_int_n_group_run(struct pdb_int_n_group *group);
+#endif
+
 
 #endif /* PDB_H */
@@ -23,6 +23,12 @@
 /* Number of messages in the message pool */
 #define PDB_MSG_POOL_SIZE 4
 
+/* The working area sizes of the threads doing I2C transfers leave room for
+ * their deepest call down to pdb_i2c_transfer, as measured with
+ * -fstack-usage, plus about 100 bytes for the I2C driver and the context
+ * switch.  The measurements were made on an x86-64 host with -Os, whose
+ * frames are bigger than on a Cortex-M. */
+
 /* Size of the Policy Engine thread's working area */
 #define PDB_PE_WA_SIZE 256
 
@@ -32,11 +38,134 @@
 /* Size of the protocol layer TX thread's working area */
 #define PDB_PRLTX_WA_SIZE 256
 
-/* Size of the protocol layer hard reset thread's working area */
-#define PDB_HARDRST_WA_SIZE 256
+/* Size of the protocol layer hard reset thread's working area.  Setting
+ * the FUSB302B up again after it stopped answering takes 408 bytes. */
+#define PDB_HARDRST_WA_SIZE 512
+
+/* Size of the INT_N thread's working area.  Reading the FUSB302B status
+ * takes 312 bytes. */
+#define PDB_INT_N_WA_SIZE 384
+
+/* Size of the VBUS measurement thread's working area.  The thread is only
+ * started if the PHY can measure VBUS.  The MDAC search of the FUSB302B
+ * takes 312 bytes. */
+#define PDB_VBUS_WA_SIZE 384
+
+/* Wake the INT_N thread on the falling edge of INT_N (PAL line events)
+ * instead of polling the line.  Requires PAL_USE_CALLBACKS and an INT_N line
+ * able to generate events.  Set to FALSE to fall back to polling. */
+#define PDB_INT_N_USE_EVENTS TRUE
+
+/* Period at which the INT_N line is polled, in milliseconds.  Also used as
+ * the back-off delay when INT_N stays stuck low in event mode. */
+#define PDB_INT_N_POLL_MS 5
+
+/* Period at which the INT_N line is polled while an AMS is in progress, in
+ * microseconds */
+#define PDB_INT_N_POLL_FAST_US 250
+
+/* Period at which the INT_N line is polled while the Policy Engine sits in
+ * the Sink Ready state with an explicit contract, in milliseconds */
+#define PDB_INT_N_POLL_IDLE_MS 50
+
+/* Queue the FUSB302B transfers to a bus thread instead of doing them in the
+ * calling thread, and read the FUSB302B status straight from the INT_N edge
+ * interrupt.  Requires PDB_INT_N_USE_EVENTS and PAL_USE_CALLBACKS, and only
+ * works with the FUSB302B PHY. */
+#define PDB_FUSB_USE_ASYNC FALSE
+
+/* Size of the FUSB302B bus thread's working area.  A transfer takes 160
+ * bytes. */
+#define PDB_FUSB_WA_SIZE 256
+
+/* Number of asynchronous FUSB302B transfers that can be queued at once */
+#define PDB_FUSB_XFER_QUEUE_SIZE 4
+
+/* Find the CC line the source is attached to with the FUSB302B's sink
+ * toggling instead of measuring BC_LVL on both lines */
+#define PDB_FUSB_USE_TOGGLE TRUE
+
+/* How long the policy engine waits for the I_TOGDONE of the sink toggling
+ * before falling back to BC_LVL measurements, in milliseconds */
+#define PDB_FUSB_TOGGLE_TIMEOUT_MS 50
+
+/* While detached, power the FUSB302B down to its wake circuit and let its
+ * sink toggling wake us up on attach, instead of waiting for VBUS with the
+ * DPM */
+#define PDB_FUSB_USE_LOW_POWER_DETACH TRUE
+
+/* Period at which VBUS is checked while waiting for an attach in low power
+ * mode, in case the toggling missed it, in milliseconds */
+#define PDB_DETACHED_VBUS_CHECK_MS 500
+
+/* Time given to the MDAC comparator to settle before reading it, in
+ * microseconds */
+#define PDB_FUSB_MDAC_SETTLE_US 250
+
+/* Record every I2C transaction with the FUSB302B in a ring buffer, and
+ * account the bus time to the negotiation phase of the Policy Engine.  Costs
+ * two timestamps and a few stores per transaction, so it can stay on in
+ * production builds. */
+#define PDB_FUSB_USE_TRACE FALSE
+
+/* Number of transactions kept in the trace ring buffer.  Must be a power of
+ * two. */
+#define PDB_FUSB_TRACE_LEN 32
+
+/* Number of data bytes kept for each traced transaction */
+#define PDB_FUSB_TRACE_DATA_LEN 4
+
+/* Time budget of an I2C transfer with the PHY: a fixed part, plus a part for
+ * each byte transferred, in microseconds.  A transfer taking longer fails and
+ * the I2C driver is restarted. */
+#define PDB_I2C_TIMEOUT_US 1000
+#define PDB_I2C_TIMEOUT_BYTE_US 50
+
+/* Number of status reads in a row that may fail before the PHY is reset and
+ * the protocol layers go through a hard reset */
+#define PDB_PHY_MAX_STATUS_FAILURES 3
+
+/* How long to wait for a TCPCI port controller to finish initializing, in
+ * milliseconds */
+#define PDB_TCPCI_INIT_TIMEOUT_MS 100
+
+/* How long a VBUS measurement can be used before measuring again, in
+ * milliseconds */
+#define PDB_VBUS_MAX_AGE_MS 100
+
+/* How long the STATUS0 register read with the rest of the FUSB302B status
+ * can be used instead of reading it again, in microseconds */
+#define PDB_FUSB_STATUS_MAX_AGE_US 1000
+
+/* Maximum number of status reads done in a row while INT_N stays low before
+ * the INT_N thread considers the line stuck and backs off */
+#define PDB_INT_N_MAX_DRAIN 8
+
+/* Maximum number of ports whose INT_N lines can be served by one shared
+ * INT_N thread (struct pdb_int_n_group) */
+#define PDB_INT_N_GROUP_MAX_PORTS 4
+
+/* Size of the shared INT_N thread's working area.  Reading the status of a
+ * FUSB302B takes 456 bytes, most of it for the statuses and events of all
+ * the ports. */
+#define PDB_INT_N_GROUP_WA_SIZE 512
+
+/* Collect statistics (interrupt counts and latencies) for debugging.  When
+ * FALSE, the statistics code is compiled out entirely. */
+#define PDB_USE_STATS FALSE
+
+/* Frequency of the realtime counter used to timestamp events for the
+ * statistics and the FUSB302B trace, in Hz */
+#define PDB_STATS_RTC_FREQ STM32_HCLK
+
+/* Build the simulated PHY of pdb_sim.h, which runs the protocol layers of a
+ * port without any chip, for the pd_sim_* debug shell commands */
+#define PDB_USE_SIM_PHY FALSE
 
-/* Size of the INT_N thread's working area */
-#define PDB_INT_N_WA_SIZE 128
+/* Number of messages the RX FIFO of the simulated PHY can hold.  Must be
+ * larger than PDB_MSG_POOL_SIZE for the RX stress test to run out of
+ * buffers. */
+#define PDB_SIM_RX_LEN 8
 
 
 #endif /* PDB_CONF_H */
@@ -161,6 +161,17 @@ struct pdb_dpm_callbacks {
      * Optional.  If no special handling is needed, this may be omitted.
      */
     pdb_dpm_func not_supported_received;
+
+    /*
+     * Shed the load, because the FUSB302B reported an over-temperature.
+     *
+     * Called from the INT_N thread as soon as the interrupt is read, before
+     * the Policy Engine escalates to a hard reset.  Must be quick and must
+     * not wait for the other PD threads.
+     *
+     * Optional.  If the load can't be shed, this may be omitted.
+     */
+    pdb_dpm_func shed_load;
 };
 
 
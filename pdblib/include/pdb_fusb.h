@@ -20,12 +20,261 @@
 
 #include <hal.h>
 
+#include "pdb_conf.h"
+#include "pdb_i2c.h"
+#include "pdb_stats.h"
+
 /* I2C addresses of the FUSB302B chips */
 #define FUSB302B_ADDR 0x22
 #define FUSB302B01_ADDR 0x23
 #define FUSB302B10_ADDR 0x24
 #define FUSB302B11_ADDR 0x25
 
+/* Configuration registers of the FUSB302B kept in a shadow copy: SWITCHES0
+ * to CONTROL4 */
+#define PDB_FUSB_SHADOW_FIRST 0x02
+#define PDB_FUSB_SHADOW_LEN 15
+
+
+/*
+ * FUSB302B interrupt mask profiles
+ *
+ * Each profile only unmasks the interrupts needed in some states of the
+ * Policy Engine, so that the other ones don't assert INT_N for nothing.
+ */
+enum fusb_mask_profile {
+    /* Every interrupt unmasked */
+    fusb_mask_all = 0,
+    /* PD communication: messages, transmissions and resets */
+    fusb_mask_pd = 1,
+    /* Hard reset in progress */
+    fusb_mask_hard_reset = 2,
+    /* Source not talking PD, only Type-C Current is used */
+    fusb_mask_typec = 3,
+    /* Detached, only the end of the sink toggling is used */
+    fusb_mask_detached = 4,
+    fusb_mask_num_profiles
+};
+
+/*
+ * FUSB302B register scripts
+ */
+enum fusb_script_id {
+    /* Software reset and configuration */
+    fusb_script_setup = 0,
+    /* Measure CC1 or CC2 */
+    fusb_script_meas_cc1 = 1,
+    fusb_script_meas_cc2 = 2,
+    /* Use CC1 or CC2 for BMC signaling */
+    fusb_script_sel_cc1 = 3,
+    fusb_script_sel_cc2 = 4,
+    /* Reset the PD logic */
+    fusb_script_pd_reset = 5,
+    /* Flush the FIFOs and reset the PD logic */
+    fusb_script_reset = 6,
+    /* Send a hard reset */
+    fusb_script_hard_reset = 7,
+    /* Start and stop the sink toggling */
+    fusb_script_toggle = 8,
+    fusb_script_toggle_stop = 9,
+    /* Power down and wait for an attach, then power up again */
+    fusb_script_detach = 10,
+    fusb_script_attach = 11,
+    /* Flush the TX FIFO */
+    fusb_script_tx_flush = 12,
+    fusb_num_scripts
+};
+
+/*
+ * Negotiation phases of the Policy Engine, to which the FUSB302B trace
+ * accounts the bus time
+ */
+enum fusb_trace_phase {
+    /* Nothing attached */
+    fusb_phase_detached = 0,
+    /* Waiting for the Source_Capabilities */
+    fusb_phase_wait_cap = 1,
+    /* Evaluating the capabilities and requesting one */
+    fusb_phase_negotiate = 2,
+    /* Waiting for the source to switch to the new power level */
+    fusb_phase_transition = 3,
+    /* Explicit contract in place */
+    fusb_phase_ready = 4,
+    /* Soft or hard reset in progress */
+    fusb_phase_reset = 5,
+    fusb_num_phases
+};
+
+struct pdb_fusb_config;
+struct fusb_xfer;
+
+/*
+ * Function called by the bus thread when an asynchronous transfer is done
+ */
+typedef void (*fusb_xfer_cb_t)(struct pdb_fusb_config *cfg,
+        struct fusb_xfer *xfer);
+
+/*
+ * Asynchronous transfer with the FUSB302B
+ *
+ * Writes txbytes from txbuf, which start with the register address, then
+ * reads rxbytes into rxbuf.  The buffers must stay valid until the transfer
+ * is done.
+ */
+struct fusb_xfer {
+    const uint8_t *txbuf;
+    size_t txbytes;
+    uint8_t *rxbuf;
+    size_t rxbytes;
+    /* Called from the bus thread when the transfer is done, or NULL */
+    fusb_xfer_cb_t callback;
+    /* Thread signaled with events when the transfer is done, or NULL */
+    thread_t *thread;
+    eventmask_t events;
+    /* Result of the transfer, MSG_OK on success */
+    msg_t result;
+
+#if PDB_USE_STATS
+    /* When the transfer was queued */
+    rtcnt_t _queued;
+#endif
+
+    /* Register address of a read */
+    uint8_t _reg;
+    /* Whether the transfer is queued or in progress */
+    volatile bool _busy;
+};
+
+#if PDB_USE_STATS
+/*
+ * Accounting of the I2C traffic with the FUSB302B
+ */
+struct pdb_fusb_stats {
+    /* Number of messages written to the TX FIFO */
+    uint32_t tx_msgs;
+    /* Number of bytes sent on the bus for them, address bytes included */
+    uint32_t tx_bytes;
+    /* Number of bytes saved by sending each message in one transaction */
+    uint32_t tx_bytes_saved;
+    /* Time taken to write a message to the TX FIFO */
+    struct pdb_hist tx_time;
+
+    /* Number of messages read from the RX FIFO */
+    uint32_t rx_msgs;
+    /* Number of read transactions on the RX FIFO, empty FIFO included */
+    uint32_t rx_transactions;
+    /* Number of bytes on the bus for them, address bytes included */
+    uint32_t rx_bytes;
+    /* Same as above, only for the Source_Capabilities messages */
+    uint32_t rx_src_caps;
+    uint32_t rx_src_cap_transactions;
+    uint32_t rx_src_cap_bytes;
+    /* Time taken to read a message from the RX FIFO */
+    struct pdb_hist rx_time;
+
+    /* Number of asynchronous transfers done */
+    uint32_t async_xfers;
+    /* Time from an asynchronous transfer being queued to it being done */
+    struct pdb_hist async_time;
+
+    /* Number of writes of each shadowed register skipped or done */
+    uint32_t shadow_hits[PDB_FUSB_SHADOW_LEN];
+    uint32_t shadow_writes[PDB_FUSB_SHADOW_LEN];
+    /* Number of STATUS0 reads avoided or done */
+    uint32_t status0_hits;
+    uint32_t status0_reads;
+
+    /* Number of CC orientations kept because the source was still on the
+     * line in use, found by toggling, and found by measuring BC_LVL */
+    uint32_t orient_kept;
+    uint32_t orient_toggle;
+    uint32_t orient_bc_lvl;
+    /* Time taken to find the CC orientation, from the attach or from the
+     * start of the search */
+    struct pdb_hist orient_time;
+
+    /* Number of times the FUSB302B was powered down while detached, and
+     * woken up by an attach */
+    uint32_t lp_detaches;
+    uint32_t lp_attaches;
+
+    /* Number of VBUS measurements, and the time they took */
+    uint32_t vbus_measurements;
+    struct pdb_hist vbus_time;
+
+    /* Number of runs of each register script, and the time they took */
+    uint32_t script_runs[fusb_num_scripts];
+    struct pdb_hist script_time[fusb_num_scripts];
+
+    /* When fusb_update_cc started the toggling */
+    rtcnt_t _orient_start;
+
+    /* RX counters and time when the current message started being read */
+    uint32_t _rx_transactions;
+    uint32_t _rx_bytes;
+    rtcnt_t _rx_start;
+};
+#endif
+
+#if PDB_FUSB_USE_TRACE
+/* Flags of a traced transaction */
+#define PDB_FUSB_TRACE_READ 0x01
+#define PDB_FUSB_TRACE_ERROR 0x02
+
+/*
+ * I2C transaction with the FUSB302B, as recorded in the trace
+ */
+struct pdb_fusb_trace_entry {
+    /* Sequence number of the transaction, starting at 1.  0 while the entry
+     * is being written. */
+    uint32_t seq;
+    /* Realtime counter at the start and at the end of the transaction */
+    rtcnt_t start;
+    rtcnt_t end;
+    /* Thread the transaction was done for */
+    thread_t *thread;
+    /* Register address */
+    uint8_t addr;
+    /* PDB_FUSB_TRACE_* flags */
+    uint8_t flags;
+    /* Number of data bytes read or written, register address excluded */
+    uint8_t len;
+    /* enum fusb_trace_phase the transaction was done in */
+    uint8_t phase;
+    /* First data bytes read or written */
+    uint8_t data[PDB_FUSB_TRACE_DATA_LEN];
+};
+
+/*
+ * Bus time accounting of each negotiation phase
+ */
+struct pdb_fusb_trace_totals {
+    /* Number of transactions, and their data bytes */
+    uint32_t transactions[fusb_num_phases];
+    uint32_t bytes[fusb_num_phases];
+    /* Realtime counter ticks spent in transactions, and in the phase */
+    uint64_t busy[fusb_num_phases];
+    uint64_t elapsed[fusb_num_phases];
+};
+
+/*
+ * Trace of the I2C transactions with the FUSB302B
+ *
+ * The entries are only written with the I2C bus acquired, so there is one
+ * writer at a time.  Readers don't lock anything: they check the sequence
+ * number of an entry before and after copying it.
+ */
+struct pdb_fusb_trace {
+    struct pdb_fusb_trace_entry _ring[PDB_FUSB_TRACE_LEN];
+    /* Sequence number of the last transaction recorded */
+    volatile uint32_t _seq;
+
+    struct pdb_fusb_trace_totals _totals;
+    /* Current phase, and when its elapsed time was last accounted */
+    uint8_t _phase;
+    rtcnt_t _phase_mark;
+};
+#endif
 
 /*
  * Configuration for the FUSB302B chip
@@ -37,6 +286,53 @@ struct pdb_fusb_config {
     i2caddr_t addr;
     /* The INT_N line */
     ioline_t int_n;
+
+    /* I2C errors and recoveries */
+    struct pdb_i2c_stats i2c_stats;
+
+#if PDB_USE_STATS
+    /* I2C traffic accounting */
+    struct pdb_fusb_stats stats;
+#endif
+
+#if PDB_FUSB_USE_TRACE
+    /* I2C transaction trace */
+    struct pdb_fusb_trace trace;
+#endif
+
+    /* The interrupt mask profile currently in use */
+    enum fusb_mask_profile _mask_profile;
+
+    /* Last values written to the configuration registers */
+    uint8_t _shadow[PDB_FUSB_SHADOW_LEN];
+    /* Bitmask of the shadowed registers known to match the chip */
+    uint16_t _shadow_valid;
+    /* Last VBUS measurement in millivolts, and when it was made */
+    uint16_t _vbus;
+    systime_t _vbus_time;
+    bool _vbus_valid;
+    /* Whether a VBUS measurement is in progress */
+    bool _vbus_measuring;
+
+    /* CC line used for BMC signaling, 1 or 2, or 0 if none is */
+    uint8_t _cc;
+    /* Whether fusb_update_cc started the toggling with the chip powered */
+    bool _toggling;
+
+    /* STATUS0 from the last status read, and when it was read */
+    uint8_t _status0;
+    systime_t _status0_time;
+    bool _status0_valid;
+
+#if PDB_FUSB_USE_ASYNC
+    /* Bus thread */
+    thread_t *_thread;
+    /* Mailbox of the transfers for the bus thread */
+    mailbox_t _xfer_mailbox;
+    msg_t _xfer_mailbox_queue[PDB_FUSB_XFER_QUEUE_SIZE];
+    /* Working area of the bus thread */
+    THD_WORKING_AREA(_wa, PDB_FUSB_WA_SIZE);
+#endif
 };
 
 /*
@@ -51,5 +347,32 @@ enum fusb_typec_current {
     fusb_sink_tx_ok = 3
 };
 
+#if PDB_FUSB_USE_TRACE
+/*
+ * Copy the traced transaction with the given sequence number into *entry
+ *
+ * Returns false if the transaction isn't in the ring buffer anymore, or was
+ * overwritten while being copied.
+ */
+bool pdb_fusb_trace_get(const struct pdb_fusb_config *cfg, uint32_t seq,
+        struct pdb_fusb_trace_entry *entry);
+
+/*
+ * Return the sequence number of the last traced transaction, 0 if none
+ */
+uint32_t pdb_fusb_trace_last(const struct pdb_fusb_config *cfg);
+
+/*
+ * Copy the bus time accounting of each phase into *totals, up to now
+ */
+void pdb_fusb_trace_totals(struct pdb_fusb_config *cfg,
+        struct pdb_fusb_trace_totals *totals);
+
+/*
+ * Clear the trace and its accounting
+ */
+void pdb_fusb_trace_reset(struct pdb_fusb_config *cfg);
+#endif
+
 
 #endif /* PDB_FUSB_H */
@@ -0,0 +1,46 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_I2C_H
+#define PDB_I2C_H
+
+#include <stdint.h>
+
+#include "pdb_conf.h"
+#include "pdb_stats.h"
+
+
+/*
+ * I2C error accounting of a PHY
+ */
+struct pdb_i2c_stats {
+    /* Number of transfers that didn't finish within their time budget */
+    uint32_t timeouts;
+    /* Number of transfers the chip didn't acknowledge */
+    uint32_t nacks;
+    /* Number of transfers that failed with another bus error */
+    uint32_t errors;
+    /* Number of times the I2C driver was restarted after a timeout */
+    uint32_t recoveries;
+#if PDB_USE_STATS
+    /* Time taken to restart the I2C driver */
+    struct pdb_hist recovery_time;
+#endif
+};
+
+
+#endif /* PDB_I2C_H */
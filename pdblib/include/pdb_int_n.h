@@ -23,10 +23,70 @@
 #ifndef PDB_INT_N_H
 #define PDB_INT_N_H
 
+#include <stdint.h>
+
 #include <ch.h>
 
 #include "pdb_conf.h"
+#include "pdb_fusb.h"
+#include "pdb_stats.h"
+
+
+/* Forward declarations */
+struct pdb_config;
+
+/*
+ * Rates at which the INT_N line is polled when it isn't serviced on its edge
+ */
+enum pdb_int_n_rate {
+    /* PDB_INT_N_POLL_MS */
+    PDB_INT_N_RATE_NORMAL = 0,
+    /* PDB_INT_N_POLL_FAST_US, while an AMS is in progress */
+    PDB_INT_N_RATE_FAST = 1,
+    /* PDB_INT_N_POLL_IDLE_MS, while idle with an explicit contract */
+    PDB_INT_N_RATE_IDLE = 2,
+    PDB_INT_N_NUM_RATES
+};
 
+/*
+ * FUSB302B interrupt sources forwarded to the other threads
+ */
+enum pdb_int_n_src {
+    PDB_INT_N_SRC_GCRCSENT = 0,
+    PDB_INT_N_SRC_TXSENT = 1,
+    PDB_INT_N_SRC_RETRYFAIL = 2,
+    PDB_INT_N_SRC_HARDRST = 3,
+    PDB_INT_N_SRC_HARDSENT = 4,
+    PDB_INT_N_SRC_OCP_TEMP = 5,
+    PDB_INT_N_SRC_TOGDONE = 6,
+    PDB_INT_N_NUM_SRC
+};
+
+#if PDB_USE_STATS
+/*
+ * Interrupt accounting of the INT_N thread
+ */
+struct pdb_int_n_stats {
+    /* Number of times the FUSB302B status was read */
+    uint32_t status_reads;
+    /* Number of status reads that found no interrupt to forward */
+    uint32_t spurious_reads;
+    /* Number of masked interrupt flags found set.  Each of them would have
+     * asserted INT_N and caused a status read without the mask profiles. */
+    uint32_t masked_irqs;
+    /* Number of interrupts forwarded for each source */
+    uint32_t count[PDB_INT_N_NUM_SRC];
+    /* Time from INT_N seen asserted to the event being signaled */
+    struct pdb_hist signal_latency[PDB_INT_N_NUM_SRC];
+    /* Time from the event being signaled to the receiving thread waking up */
+    struct pdb_hist wakeup_latency[PDB_INT_N_NUM_SRC];
+
+    /* When INT_N was last seen asserted */
+    rtcnt_t _asserted;
+    /* When the pending event of each source was signaled, 0 if none */
+    rtcnt_t _signaled[PDB_INT_N_NUM_SRC];
+};
+#endif
 
 /*
  * Structure for the INT_N thread
@@ -34,6 +94,72 @@
 struct pdb_int_n {
     /* INT_N thread */
     thread_t *thread;
+
+    /* Number of times the INT_N line was polled at each rate */
+    uint32_t polls[PDB_INT_N_NUM_RATES];
+    /* Number of polls that found INT_N asserted at each rate */
+    uint32_t asserted_polls[PDB_INT_N_NUM_RATES];
+    /* Number of times the DPM was asked to shed the load */
+    uint32_t load_sheds;
+    /* Number of times the PHY was reset after failing to report its status */
+    uint32_t phy_resets;
+
+#if PDB_USE_STATS
+    /* Interrupt counts and latencies */
+    struct pdb_int_n_stats stats;
+#endif
+
+    /* The rate at which INT_N is currently polled */
+    enum pdb_int_n_rate _rate;
+    /* Number of status reads in a row that failed */
+    uint8_t _status_failures;
+    /* Number of status reads in a row that found INT_N still low, for the
+     * shared INT_N thread */
+    uint8_t _drain;
+
+#if PDB_FUSB_USE_ASYNC
+    /* Status read queued on the falling edge of INT_N */
+    struct fusb_xfer _status_xfer;
+    /* Buffer for the status read */
+    uint8_t _status[7];
+    /* Whether the falling edge of INT_N may queue the status read */
+    bool _armed;
+#endif
+
+    /* Working area of the INT_N thread */
+    THD_WORKING_AREA(_wa, PDB_INT_N_WA_SIZE);
+};
+
+/*
+ * Structure for an INT_N thread shared by several ports
+ *
+ * The ports' PHYs are on the same I2C bus, and their statuses are read one
+ * after the other in a single ownership of the bus.  The threads concerned
+ * by the interrupts are then signaled in priority order, all ports together,
+ * so that the most urgent work of every port runs first.
+ *
+ * Contains a working area for a statically allocated thread, and therefore
+ * must be statically allocated!
+ */
+struct pdb_int_n_group {
+    /* User-initialized fields */
+    /* The ports served, each with int_n_group pointing to this group */
+    struct pdb_config **ports;
+    /* Number of ports, at most PDB_INT_N_GROUP_MAX_PORTS */
+    uint8_t num_ports;
+    /* The I2C bus shared by the PHYs, or NULL to read each status in its own
+     * bus ownership */
+    I2CDriver *i2cp;
+
+    /* Automatically initialized fields */
+    /* Shared INT_N thread */
+    thread_t *thread;
+
+    /* The port whose status is read first in the next round */
+    uint8_t _first;
+
+    /* Working area of the shared INT_N thread */
+    THD_WORKING_AREA(_wa, PDB_INT_N_GROUP_WA_SIZE);
 };
 
 
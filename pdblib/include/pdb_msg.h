@@ -22,6 +22,14 @@
 
 #include <ch.h>
 
+#include "pdb_conf.h"
+
+
+/* Bytes available in front of a message.  Must be 2 modulo 4 so that the
+ * data objects stay aligned. */
+#define PDB_MSG_HEADROOM 6
+/* Bytes available after the longest message */
+#define PDB_MSG_TAILROOM 4
 
 /*
  * PD message union
@@ -29,17 +37,20 @@
  * This can be safely read from or written to in any form without any
  * transformations because everything in the system is little-endian.
  *
- * Two bytes of padding are required at the start to prevent problems due to
- * alignment.  Specifically, without the padding, &obj[0] != &bytes[2], making
- * the statement in the previous paragraph invalid.
+ * Padding is required at the start to prevent problems due to alignment.
+ * Specifically, without it, &obj[0] != &bytes[2], making the statement in the
+ * previous paragraph invalid.  The padding is also headroom: together with
+ * the tailroom after the longest message, it lets the PHY build its transmit
+ * frame around the message in place, without copying it.
  */
 union pd_msg {
     struct {
-        uint8_t _pad1[2];
+        uint8_t _head[PDB_MSG_HEADROOM];
         uint8_t bytes[30];
+        uint8_t _tail[PDB_MSG_TAILROOM];
     } __attribute__((packed));
     struct {
-        uint8_t _pad2[2];
+        uint8_t _pad2[PDB_MSG_HEADROOM];
         uint16_t hdr;
         union {
             uint32_t obj[7];
@@ -52,9 +63,21 @@ union pd_msg {
 };
 
 /*
- * The pool of messages used by the library
+ * Queue of messages passed from one thread to another
+ *
+ * There must be only one thread pushing messages and one thread popping
+ * them, which lets both do it with memory barriers instead of locking the
+ * kernel.  One slot always stays empty to tell a full ring from an empty
+ * one.
  */
-extern memory_pool_t pdb_msg_pool;
+struct pdb_msg_ring {
+    /* The messages */
+    union pd_msg *_slots[PDB_MSG_POOL_SIZE + 1];
+    /* Next slot to fill, only written by the producer */
+    volatile uint8_t _head;
+    /* Next slot to empty, only written by the consumer */
+    volatile uint8_t _tail;
+};
 
 
 #endif /* PDB_MSG_H */
@@ -29,6 +29,8 @@
 #include <ch.h>
 
 #include "pdb_conf.h"
+#include "pdb_msg.h"
+#include "pdb_stats.h"
 
 /*
  * Events for the Policy Engine thread, sent by user code
@@ -39,6 +41,25 @@
 #define PDB_EVT_PE_NEW_POWER EVENT_MASK(8)
 
 
+#if PDB_USE_STATS
+/*
+ * Policy Engine statistics
+ */
+struct pdb_pe_stats {
+    /* Number of negotiations, from Source_Capabilities to PS_RDY */
+    uint32_t negotiations;
+    /* Context switches of the whole system during the last negotiation, and
+     * the most and total of all of them.  Only counted if ChibiOS has
+     * CH_DBG_STATISTICS enabled. */
+    uint32_t ctxsw_last;
+    uint32_t ctxsw_max;
+    uint32_t ctxsw_total;
+
+    /* Context switch count when the current negotiation started */
+    uint32_t _ctxsw_start;
+};
+#endif
+
 /*
  * Structure for Policy Engine thread and variables
  */
@@ -46,8 +67,10 @@ struct pdb_pe {
     /* Policy Engine thread */
     thread_t *thread;
 
-    /* PE mailbox for received PD messages */
-    mailbox_t mailbox;
+    /* Received PD messages, passed by the protocol RX thread */
+    struct pdb_msg_ring rx_queue;
+    /* Most messages ever found waiting in rx_queue */
+    uint8_t rx_queue_max;
     /* PD message header template */
     uint16_t hdr_template;
 
@@ -69,8 +92,22 @@ struct pdb_pe {
     uint8_t _last_pps;
     /* Virtual timer for SinkPPSPeriodicTimer */
     virtual_timer_t _sink_pps_periodic_timer;
-    /* Queue for the PE mailbox */
-    msg_t _mailbox_queue[PDB_MSG_POOL_SIZE];
+    /* When to check again that the source still knows about our contract
+     * while in the Sink Ready state */
+    systime_t _reconnect_time;
+    /* Message sent from the Sink Ready state without waiting for it, its
+     * TX token, and the state to go to if it fails */
+    union pd_msg *_tx_async;
+    uint8_t _tx_async_token;
+    uint8_t _tx_async_fail;
+
+#if PDB_USE_STATS
+    /* Negotiation statistics */
+    struct pdb_pe_stats stats;
+#endif
+
+    /* Working area of the Policy Engine thread */
+    THD_WORKING_AREA(_wa, PDB_PE_WA_SIZE);
 };
 
 
@@ -0,0 +1,265 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_PHY_H
+#define PDB_PHY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ch.h>
+
+#include <pdb_fusb.h>
+#include <pdb_msg.h>
+
+
+/* Returned by update_cc when the PHY started toggling to find the CC line */
+#define PDB_PHY_TOGGLING ((msg_t) 1)
+/* Returned by attach when the toggling found no source after all */
+#define PDB_PHY_DETACHED ((msg_t) 2)
+
+/* Forward declarations */
+struct pdb_config;
+union fusb_status;
+
+/* PHY operation typedefs */
+typedef msg_t (*pdb_phy_func)(struct pdb_config *);
+typedef bool (*pdb_phy_bool_func)(struct pdb_config *);
+typedef uint16_t (*pdb_phy_vbus_func)(struct pdb_config *);
+typedef msg_t (*pdb_phy_send_func)(struct pdb_config *, union pd_msg *);
+typedef uint8_t (*pdb_phy_read_func)(struct pdb_config *, union pd_msg *);
+typedef msg_t (*pdb_phy_status_func)(struct pdb_config *, union fusb_status *);
+typedef enum fusb_typec_current (*pdb_phy_tcc_func)(struct pdb_config *);
+typedef msg_t (*pdb_phy_mask_func)(struct pdb_config *,
+        enum fusb_mask_profile);
+typedef uint8_t (*pdb_phy_count_func)(struct pdb_config *,
+        const union fusb_status *);
+typedef void (*pdb_phy_phase_func)(struct pdb_config *,
+        enum fusb_trace_phase);
+
+/*
+ * PD Buddy firmware library PHY operations
+ *
+ * The protocol layers only reach the PD PHY through these functions, so that
+ * something other than an FUSB302B can be used under them.  All functions are
+ * passed a struct pdb_config * as their first parameter; the PHY keeps its
+ * own data in it, like pdb_config.fusb for the FUSB302B.
+ *
+ * The status and interrupt flags are reported in the FUSB302B layout, so a
+ * PHY with different registers must translate its own interrupts into the
+ * union fusb_status of src/fusb302b.h.  Unless the PHY has an int_n_asserted
+ * function, the INT_N thread watches the pdb_config.fusb.int_n line, so it
+ * must be set to the interrupt line of the PHY.
+ *
+ * Functions returning a msg_t return MSG_OK on success, or the error of the
+ * I2C transfer that failed, like MSG_TIMEOUT.  Every transfer is bounded in
+ * time, so a PHY that stopped answering can't block the caller.
+ *
+ * Optional functions may be set to NULL if the PHY lacks the associated
+ * functionality.
+ */
+struct pdb_phy_ops {
+    /*
+     * Reset and configure the PHY, and find the CC line used for BMC
+     * signaling.
+     */
+    pdb_phy_func setup;
+
+    /*
+     * Send a PD message.
+     *
+     * The headroom and tailroom of the message may be overwritten.
+     */
+    pdb_phy_send_func send_message;
+
+    /*
+     * Read a received PD message.
+     *
+     * Returns 0 on success, or nonzero if no message could be read.
+     */
+    pdb_phy_read_func read_message;
+
+    /*
+     * Read the header of a received PD message, leaving the rest of it in
+     * the PHY.  The header lands in the message like with read_message.
+     *
+     * Returns 0 on success, or nonzero if no message could be read.
+     *
+     * Optional.  Lets the protocol layer drop a retransmitted message without
+     * reading it into a message buffer.
+     */
+    pdb_phy_read_func read_header;
+
+    /*
+     * Read the rest of the message whose header was read into msg by
+     * read_header.
+     *
+     * Returns 0 on success, or nonzero if it couldn't be read.
+     *
+     * Optional.  If and only if read_header is NULL, this may be omitted.
+     */
+    pdb_phy_read_func read_rest;
+
+    /*
+     * Return whether another received message is waiting to be read.
+     *
+     * Optional.  If the PHY reports each received message with its own
+     * interrupt, this may be omitted and one message is read per interrupt.
+     */
+    pdb_phy_bool_func rx_pending;
+
+    /*
+     * Read the GoodCRC answering the last message sent.
+     *
+     * Optional.  If the PHY puts the GoodCRC in its receive buffer like any
+     * other message, this may be omitted and read_message is used.
+     */
+    pdb_phy_read_func read_goodcrc;
+
+    /*
+     * Send hard reset signaling.
+     */
+    pdb_phy_func send_hardrst;
+
+    /*
+     * Read the status and interrupt flags, clearing the interrupts.
+     *
+     * The status is only meaningful if MSG_OK is returned.
+     */
+    pdb_phy_status_func get_status;
+
+    /*
+     * Same as get_status, but with the I2C bus already acquired by the
+     * caller.  This lets a shared INT_N thread read the status of several
+     * PHYs in one bus ownership.
+     *
+     * Optional.  If omitted, get_status is used on its own.
+     */
+    pdb_phy_status_func get_status_locked;
+
+    /*
+     * Return whether the PHY has an interrupt to report, like a low INT_N
+     * line would tell.
+     *
+     * Optional.  If omitted, the pdb_config.fusb.int_n line is read.  A PHY
+     * with this function has no line for the INT_N thread to wait on, so it
+     * must wake the thread with pdb_int_n_wake whenever an interrupt comes.
+     * Not supported with PDB_FUSB_USE_ASYNC.
+     */
+    pdb_phy_bool_func int_n_asserted;
+
+    /*
+     * Find the CC line the source is attached to and use it for BMC
+     * signaling.
+     *
+     * May return PDB_PHY_TOGGLING if the PHY started toggling to find it
+     * instead.  The end of the toggling is then reported with the I_TOGDONE
+     * interrupt, after which attach selects the line.
+     */
+    pdb_phy_func update_cc;
+
+    /*
+     * Return the Type-C Current advertised by the source, or fusb_tcc_none
+     * if it couldn't be read.
+     */
+    pdb_phy_tcc_func get_typec_current;
+
+    /*
+     * Flush the FIFOs and reset the PD logic.
+     */
+    pdb_phy_func reset;
+
+    /*
+     * Drop the message being sent, leaving the received messages alone.
+     *
+     * Optional.  If the PHY can't take back a message once it was handed
+     * over, this may be omitted.
+     */
+    pdb_phy_func flush_tx;
+
+    /*
+     * Only let the interrupts of the given profile through.
+     *
+     * Optional.  If the PHY can't mask its interrupts, this may be omitted.
+     */
+    pdb_phy_mask_func set_mask_profile;
+
+    /*
+     * Count the interrupt flags set in the status that are masked by the
+     * current mask profile, for the statistics.
+     *
+     * Optional.
+     */
+    pdb_phy_count_func count_masked_irqs;
+
+    /*
+     * Measure VBUS, in millivolts.  Returns 0 if the measurement failed.
+     *
+     * Optional.  If the PHY can't measure VBUS, this may be omitted.
+     */
+    pdb_phy_vbus_func measure_vbus;
+
+    /*
+     * Return VBUS in millivolts, using a recent measurement if there is one.
+     *
+     * Optional.  If and only if measure_vbus is NULL, this may be omitted.
+     */
+    pdb_phy_vbus_func get_vbus;
+
+    /*
+     * Go to a low power mode where only an attach is detected.
+     *
+     * The PHY must report the attach with the I_TOGDONE interrupt.
+     *
+     * Optional.  If omitted, the DPM's wait_vbus is used while detached.
+     */
+    pdb_phy_func enter_detached;
+
+    /*
+     * Leave the low power mode after an attach was reported, and get ready
+     * to receive PD messages.
+     *
+     * Also called at the end of a toggling started by update_cc.
+     *
+     * Returns PDB_PHY_DETACHED if nothing was attached after all, in which
+     * case the PHY is left as it was, and enter_detached may be called to
+     * toggle again.  Any other error means the PHY may be half powered up,
+     * and needs a setup.
+     *
+     * Optional.  If omitted, enter_detached must be NULL and update_cc must
+     * never return PDB_PHY_TOGGLING.
+     */
+    pdb_phy_func attach;
+
+    /*
+     * Account the following bus traffic to the given negotiation phase, for
+     * the PHY's trace.
+     *
+     * Optional.
+     */
+    pdb_phy_phase_func set_phase;
+};
+
+/*
+ * PHY operations of the FUSB302B
+ *
+ * Used when pdb_config.phy is left NULL.
+ */
+extern const struct pdb_phy_ops pdb_fusb302b_phy;
+
+
+#endif /* PDB_PHY_H */
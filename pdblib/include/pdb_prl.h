@@ -24,12 +24,19 @@
 #define PDB_PRL_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <ch.h>
 
 #include "pdb_conf.h"
+#include "pdb_msg.h"
+#include "pdb_stats.h"
 
 
+/* Number of TX tokens whose result is remembered.  Must divide 256 and be
+ * more than PDB_MSG_POOL_SIZE, the most messages that can be in flight. */
+#define PDB_PRL_TX_TOKENS 32
+
 /*
  * Structure for the protocol layer threads and variables
  */
@@ -41,20 +48,66 @@ struct pdb_prl {
     /* Hard reset thread */
     thread_t *hardrst_thread;
 
-    /* TX mailbox for PD messages to be transmitted */
-    mailbox_t tx_mailbox;
+    /* PD messages to be transmitted, passed by the Policy Engine */
+    struct pdb_msg_ring tx_queue;
+
+#if PDB_USE_STATS
+    /* Time from a message being submitted to the TX thread being done with
+     * it */
+    struct pdb_hist tx_latency;
+    /* Number of messages the TX thread was done with, and the realtime
+     * counter ticks it spent on them, for the messages per second */
+    uint32_t tx_msgs;
+    uint64_t tx_busy;
+#endif
+
+    /* Number of messages read right after the previous one, without waiting
+     * for another interrupt */
+    uint32_t rx_read_ahead;
+    /* Number of retransmitted messages dropped */
+    uint32_t rx_duplicates;
+    /* Number of times a message was left in the PHY until a buffer was
+     * freed, because the pool was empty */
+    uint32_t rx_starved;
 
     /* The ID of the last message received */
     int8_t _rx_messageid;
     /* The message being worked with by the RX thread */
     union pd_msg *_rx_message;
+    /* Whether the policy engine must be woken up for the messages passed to
+     * it */
+    bool _rx_wake;
+    /* Whether messages were read ahead of their I_GCRCSENT interrupt */
+    bool _rx_ahead;
+    /* Whether the RX thread waits for a buffer to be freed to read the
+     * message left in the PHY */
+    volatile bool _rx_starved;
+    /* Whether a message was left in the PHY because no buffer was free */
+    bool _rx_left;
 
     /* The ID of the next message we will transmit */
     int8_t _tx_messageidcounter;
     /* The message being worked with by the TX thread */
     union pd_msg *_tx_message;
-    /* Queue for the TX mailbox */
-    msg_t _tx_mailbox_queue[PDB_MSG_POOL_SIZE];
+    /* Token of the next message submitted, only written by the Policy
+     * Engine */
+    uint8_t _tx_submitted;
+    /* Token of the next message the TX thread will be done with, only
+     * written by the TX thread */
+    volatile uint8_t _tx_completed;
+    /* Bit (token % PDB_PRL_TX_TOKENS) is set if that message failed */
+    volatile uint32_t _tx_failed;
+#if PDB_USE_STATS
+    /* When each message in flight was submitted, by token */
+    rtcnt_t _tx_submit_time[PDB_PRL_TX_TOKENS];
+    /* When the TX thread started working on the current message */
+    rtcnt_t _tx_start;
+#endif
+
+    /* Working areas of the RX, TX and hard reset threads */
+    THD_WORKING_AREA(_rx_wa, PDB_PRLRX_WA_SIZE);
+    THD_WORKING_AREA(_tx_wa, PDB_PRLTX_WA_SIZE);
+    THD_WORKING_AREA(_hardrst_wa, PDB_HARDRST_WA_SIZE);
 };
 
 
@@ -0,0 +1,277 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_SIM_H
+#define PDB_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ch.h>
+
+#include "pdb_conf.h"
+#include "pdb_msg.h"
+#include "pdb_phy.h"
+#include "pdb_int_n.h"
+#include "pdb_tcpci.h"
+
+
+#if PDB_USE_SIM_PHY
+/*
+ * State of a simulated PHY
+ *
+ * Used as the pdb_config.phy_data of a port whose phy is pdb_sim_phy.  The
+ * simulated PHY has no bus and no interrupt line: the messages received are
+ * put in its RX FIFO with pdb_sim_inject.  If the port has an INT_N thread,
+ * the interrupts are latched for it to read and it is woken up with
+ * pdb_int_n_wake; otherwise they are signaled straight to the protocol
+ * threads.  Every message sent is answered with a GoodCRC.
+ *
+ * Like the FUSB302B, a PHY reset flushes the RX FIFO, so the messages
+ * received are lost if the protocol layer resets the PHY at the wrong time.
+ */
+struct pdb_sim_config {
+    /* Number of messages sent, and of messages read by the RX thread */
+    uint32_t tx_msgs;
+    uint32_t rx_msgs;
+
+    /* Messages received and not read yet */
+    union pd_msg _rx[PDB_SIM_RX_LEN];
+    /* Number of messages put in the RX FIFO, and read from it */
+    uint32_t _rx_in;
+    uint32_t _rx_out;
+    /* Whether the header of the oldest message was read by read_header */
+    bool _rx_header_read;
+    /* MessageID of the last message sent, for its GoodCRC */
+    uint8_t _tx_messageid;
+    /* Interrupts latched for the INT_N thread, as in the FUSB302B's
+     * INTERRUPTA and INTERRUPTB registers */
+    uint8_t _interrupta;
+    uint8_t _interruptb;
+
+    /* Simulated source, answering the messages sent when _source is set */
+    /* Object position of the PDO the sink DPM requests, from 1 */
+    uint8_t request_pdo;
+    /* Number of contracts made, and the PDO of the last one */
+    uint32_t contracts;
+    uint8_t contract_pdo;
+    /* Number of hard resets sent by the sink */
+    uint32_t hard_resets;
+    bool _source;
+    /* MessageID of the next message the source sends */
+    uint8_t _src_messageid;
+};
+
+/*
+ * PHY operations of the simulated PHY
+ */
+extern const struct pdb_phy_ops pdb_sim_phy;
+
+/*
+ * Start the protocol threads of a simulated port, with the calling thread in
+ * place of the policy engine
+ *
+ * The port must have pdb_sim_phy as its phy, and a struct pdb_sim_config as
+ * its phy_data.  pdb_init must not be called for it.
+ *
+ * The messages received are then found in pdb_config.pe.rx_queue, with
+ * PDB_EVT_PE_MSG_RX signaled to the calling thread, and must be freed with
+ * pdb_msg_free.  The messages submitted with pdb_prltx_submit are answered
+ * with PDB_EVT_PE_TX_DONE.  The threads are created on the first call only;
+ * later calls hand the port over to the new calling thread and free the
+ * messages it was still holding.  No INT_N or hard reset thread is started.
+ */
+void pdb_sim_start(struct pdb_config *cfg);
+
+/*
+ * Put a copy of a message in the RX FIFO of a simulated port, as if it was
+ * received from the source
+ *
+ * The RX thread isn't told about it: call pdb_sim_gcrcsent for that, once
+ * per message or once for several, like the FUSB302B does when its INT_N
+ * thread is slow.
+ *
+ * Returns false if the FIFO is full.
+ */
+bool pdb_sim_inject(struct pdb_config *cfg, const union pd_msg *msg);
+
+/*
+ * Signal the I_GCRCSENT interrupt of a simulated port to its RX thread
+ */
+void pdb_sim_gcrcsent(struct pdb_config *cfg);
+
+/*
+ * Result of pdb_sim_rx_stress
+ */
+struct pdb_sim_rx_result {
+    /* Number of distinct messages injected, and of those received */
+    uint32_t sent;
+    uint32_t received;
+    /* Number of messages received in the wrong order, or twice */
+    uint32_t out_of_order;
+    /* Number of retransmissions dropped by the RX thread */
+    uint32_t duplicates;
+    /* Number of times the RX thread waited for a buffer */
+    uint32_t starved;
+    /* Time taken, in milliseconds */
+    uint32_t ms;
+};
+
+/*
+ * Stress the RX path of a simulated port
+ *
+ * Each burst fills the RX FIFO with more messages than the message pool
+ * holds, ending with a retransmission of the last one, and reports them all
+ * with a single I_GCRCSENT.  The messages are then taken from the RX queue
+ * one by one, each held for a millisecond before being freed, like a busy
+ * policy engine would.  Every distinct message must come through once and
+ * in order.
+ *
+ * Calls pdb_sim_start, so the calling thread stands for the policy engine.
+ *
+ * Returns true if no message was lost, reordered or repeated.
+ */
+bool pdb_sim_rx_stress(struct pdb_config *cfg, uint16_t bursts,
+        struct pdb_sim_rx_result *res);
+
+/*
+ * Result of pdb_sim_tx_bench
+ */
+struct pdb_sim_tx_result {
+    /* Number of messages sent in each run, and of those that failed */
+    uint32_t sent;
+    uint32_t failed;
+    /* Most messages in flight in the second run */
+    uint8_t depth;
+    /* Time taken by the run sending one message at a time, like
+     * pe_tx_send, and by the run keeping depth messages in flight, in
+     * microseconds */
+    uint32_t serial_us;
+    uint32_t pipelined_us;
+};
+
+/*
+ * Measure the message throughput of the TX path of a simulated port
+ *
+ * The messages go through pdb_prltx_submit like the policy engine's, and
+ * the simulated PHY answers each one with a GoodCRC right away, so the time
+ * is what the protocol TX thread and the wakeups of the sender cost.  count
+ * messages are sent one at a time, then again with as many in flight as the
+ * message pool allows.
+ *
+ * Calls pdb_sim_start, so the calling thread stands for the policy engine.
+ *
+ * Returns true if every message was sent.
+ */
+bool pdb_sim_tx_bench(struct pdb_config *cfg, uint32_t count,
+        struct pdb_sim_tx_result *res);
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * Result of pdb_sim_group_negotiate
+ */
+struct pdb_sim_group_result {
+    /* Number of ports, and of those that got the contract they requested */
+    uint8_t ports;
+    uint8_t negotiated;
+    /* Number of hard resets sent by all the ports */
+    uint32_t hard_resets;
+    /* Time taken, in milliseconds */
+    uint32_t ms;
+};
+
+/*
+ * Negotiate a contract on every simulated port of an INT_N group at once
+ *
+ * Each port must have pdb_sim_phy as its phy, a struct pdb_sim_config as its
+ * phy_data and the group as its int_n_group.  On the first call, the ports
+ * are given a DPM that requests PDO 1 or 2 in turn, and are started with
+ * pdb_init along with the group's INT_N thread.
+ *
+ * Every port then gets Source_Capabilities from its simulated source at the
+ * same time, and has to go through Request, Accept and PS_RDY on its own,
+ * with all the interrupts read by the shared INT_N thread.
+ *
+ * Returns true if every port got the PDO it requested without a hard reset.
+ */
+bool pdb_sim_group_negotiate(struct pdb_int_n_group *group,
+        struct pdb_sim_group_result *res);
+#endif
+
+/*
+ * Register model of a TCPCI port controller
+ *
+ * Stands for the chip of a pdb_tcpci_config whose i2cp is the i2c of the
+ * model: while pdb_sim_tcpci_test runs, the I2C transfers on that driver
+ * are answered from the registers below instead of going to the bus.
+ *
+ * ALERT and FAULT_STATUS are cleared by writing ones, and clearing
+ * RX_STATUS empties the RX_BUFFER.  Writing TRANSMIT ends the transmission
+ * at once with TX_SUCCESS, or TX_FAILED if tx_fail is set; hard reset
+ * signaling ends with both, like on a real TCPC.
+ */
+struct pdb_sim_tcpc {
+    /* I2C driver to give the TCPCI PHY.  It's never started. */
+    I2CDriver i2c;
+    /* The registers, by address */
+    uint8_t regs[256];
+    /* Whether SOP transmissions fail */
+    bool tx_fail;
+    /* Number of I2C transfers, and of those that read the RX_BUFFER */
+    uint32_t transfers;
+    uint32_t rx_buffer_reads;
+    /* Number of SOP messages and of hard resets transmitted */
+    uint32_t tx_msgs;
+    uint32_t hard_resets;
+};
+
+/*
+ * Result of pdb_sim_tcpci_test
+ */
+struct pdb_sim_tcpci_result {
+    /* Number of checks made, and of those that failed */
+    uint8_t checks;
+    uint8_t failed;
+    /* What the first check that failed was about, or NULL */
+    const char *first_failed;
+};
+
+/*
+ * Drive the TCPCI PHY against a TCPC register model
+ *
+ * cfg must have pdb_tcpci_phy as its phy, and a struct pdb_tcpci_config as
+ * its phy_data whose i2cp is the i2c of tcpc.  The PHY operations are called
+ * from the calling thread; no thread of the port is started.  The checks
+ * are that:
+ * - get_status_locked turns each alert into the right FUSB302B interrupt,
+ *   and reports a received message only once;
+ * - read_message reads a message with at most one data object in one burst,
+ *   and reads the RX_BUFFER again for a longer one;
+ * - read_message rejects a frame whose byte count is too short for its
+ *   header or its data objects, or that isn't SOP, and frees the RX_BUFFER
+ *   anyway;
+ * - the end of hard reset signaling is reported as I_HARDSENT alone, and
+ *   the next transmission as I_TXSENT again.
+ *
+ * Returns true if every check passed.
+ */
+bool pdb_sim_tcpci_test(struct pdb_config *cfg, struct pdb_sim_tcpc *tcpc,
+        struct pdb_sim_tcpci_result *res);
+#endif
+
+
+#endif /* PDB_SIM_H */
@@ -0,0 +1,73 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_STATS_H
+#define PDB_STATS_H
+
+#include <stdint.h>
+
+#include <ch.h>
+
+#include "pdb_conf.h"
+
+
+/* Number of bins in a latency histogram */
+#define PDB_HIST_BINS 16
+
+/*
+ * Latency histogram with log2 bins
+ *
+ * Bin 0 counts latencies under 1 us, bin n counts latencies in
+ * [2^(n-1), 2^n) us and the last bin counts everything longer.
+ */
+struct pdb_hist {
+    uint32_t bins[PDB_HIST_BINS];
+    /* Longest latency recorded, in microseconds */
+    uint32_t max;
+};
+
+/*
+ * Get a timestamp from the realtime counter
+ */
+static inline rtcnt_t pdb_stats_now(void)
+{
+    return chSysGetRealtimeCounterX();
+}
+
+/*
+ * Add the time elapsed since start to a histogram
+ */
+static inline void pdb_hist_add(struct pdb_hist *hist, rtcnt_t start)
+{
+    rtcnt_t elapsed = chSysGetRealtimeCounterX() - start;
+    uint32_t us = elapsed == 0 ? 0 : RTC2US(PDB_STATS_RTC_FREQ, elapsed);
+    uint8_t bin = 0;
+
+    if (us > 0) {
+        bin = 32 - __builtin_clz(us);
+        if (bin >= PDB_HIST_BINS) {
+            bin = PDB_HIST_BINS - 1;
+        }
+    }
+    hist->bins[bin]++;
+    if (us > hist->max) {
+        hist->max = us;
+    }
+}
+
+
+#endif /* PDB_STATS_H */
@@ -0,0 +1,97 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_TCPCI_H
+#define PDB_TCPCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hal.h>
+
+#include "pdb_conf.h"
+#include "pdb_i2c.h"
+#include "pdb_stats.h"
+#include "pdb_phy.h"
+
+
+#if PDB_USE_STATS
+/*
+ * I2C traffic accounting of the TCPC
+ */
+struct pdb_tcpci_stats {
+    /* Number of messages sent, the I2C transactions this took, and the time
+     * taken to hand them to the TCPC */
+    uint32_t tx_msgs;
+    uint32_t tx_transactions;
+    struct pdb_hist tx_time;
+
+    /* Number of messages received, the I2C transactions and bytes this took,
+     * and the time taken to read them */
+    uint32_t rx_msgs;
+    uint32_t rx_transactions;
+    uint32_t rx_bytes;
+    struct pdb_hist rx_time;
+
+    /* Number of ALERT reads, the I2C transactions this took, and the time
+     * taken to read and clear the alerts */
+    uint32_t alert_reads;
+    uint32_t alert_transactions;
+    struct pdb_hist alert_time;
+};
+#endif
+
+/*
+ * Configuration for a TCPCI port controller
+ *
+ * Used as the pdb_config.phy_data of a port whose phy is pdb_tcpci_phy.  The
+ * ALERT# line of the TCPC goes in pdb_config.fusb.int_n, where the INT_N
+ * thread watches it.
+ */
+struct pdb_tcpci_config {
+    /* The I2C driver for the bus that the chip is connected to */
+    I2CDriver *i2cp;
+    /* The I2C address of the chip */
+    i2caddr_t addr;
+
+    /* I2C errors and recoveries */
+    struct pdb_i2c_stats i2c_stats;
+
+#if PDB_USE_STATS
+    /* I2C traffic accounting */
+    struct pdb_tcpci_stats stats;
+#endif
+
+    /* ALERT_MASK currently written to the TCPC */
+    uint16_t _alert_mask;
+    /* CC line used for BMC signaling, 1 or 2 */
+    uint8_t _cc;
+    /* MessageID of the last message sent, for its GoodCRC */
+    uint8_t _tx_messageid;
+    /* Whether a received message was reported and not read yet */
+    bool _rx_pending;
+    /* Whether the last transmission was hard reset signaling */
+    bool _hardrst_pending;
+};
+
+/*
+ * PHY operations of a TCPCI port controller
+ */
+extern const struct pdb_phy_ops pdb_tcpci_phy;
+
+
+#endif /* PDB_TCPCI_H */
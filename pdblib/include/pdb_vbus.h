@@ -0,0 +1,42 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_VBUS_H
+#define PDB_VBUS_H
+
+#include <ch.h>
+
+#include "pdb_conf.h"
+
+
+/*
+ * Structure for the VBUS measurement thread
+ *
+ * Measuring VBUS takes a few milliseconds of I2C traffic and waiting for the
+ * PHY, so it's done by a thread of its own, below the others in priority,
+ * rather than by one that has interrupts or messages to handle meanwhile.
+ */
+struct pdb_vbus {
+    /* VBUS measurement thread, or NULL if the PHY can't measure VBUS */
+    thread_t *thread;
+
+    /* Working area of the VBUS measurement thread */
+    THD_WORKING_AREA(_wa, PDB_VBUS_WA_SIZE);
+};
+
+
+#endif /* PDB_VBUS_H */
@@ -22,25 +22,552 @@
 
 #include "fusb302b.h"
 
+#include <string.h>
+
 #include <ch.h>
 #include <hal.h>
 
 #include <pd.h>
+#include <pdb_phy.h>
+#include "priorities.h"
+#include "i2c.h"
+
+
+/* The transmit frame is built in place around the message */
+#if PDB_MSG_HEADROOM < 1 + FUSB_TX_SOP_LEN || PDB_MSG_TAILROOM < FUSB_TX_EOP_LEN
+#error "union pd_msg lacks room for the FUSB302B transmit frame"
+#endif
+
+/* Interrupt masks of the PD communication profile.  BC_LVL, COMP, activity
+ * and the other MASK1 sources are never used, neither are toggling and the
+ * automatic soft reset. */
+#define FUSB_PD_MASK1 0xFF
+#define FUSB_PD_MASKA (FUSB_MASKA_M_TOGDONE | FUSB_MASKA_M_SOFTFAIL \
+        | FUSB_MASKA_M_SOFTRST)
+#define FUSB_PD_MASKB 0x00
+
+/* Interrupt masks of each profile, as {MASK1, MASKA, MASKB} */
+static const uint8_t fusb_mask_profiles[fusb_mask_num_profiles][3] = {
+    [fusb_mask_all] = {0x00, 0x00, 0x00},
+    [fusb_mask_pd] = {FUSB_PD_MASK1, FUSB_PD_MASKA, FUSB_PD_MASKB},
+    /* Nothing is transmitted until the hard reset is over, but messages can
+     * arrive right after it. */
+    [fusb_mask_hard_reset] = {
+        0xFF,
+        FUSB_MASKA_M_TOGDONE | FUSB_MASKA_M_SOFTFAIL | FUSB_MASKA_M_RETRYFAIL
+            | FUSB_MASKA_M_TXSENT | FUSB_MASKA_M_SOFTRST,
+        0x00
+    },
+    /* Only a hard reset or an over-temperature can get us out of there */
+    [fusb_mask_typec] = {
+        0xFF,
+        FUSB_MASKA_M_TOGDONE | FUSB_MASKA_M_SOFTFAIL | FUSB_MASKA_M_RETRYFAIL
+            | FUSB_MASKA_M_HARDSENT | FUSB_MASKA_M_TXSENT
+            | FUSB_MASKA_M_SOFTRST,
+        FUSB_MASKB_M_GCRCSENT
+    },
+    /* Nothing but the end of the toggling can happen while detached */
+    [fusb_mask_detached] = {
+        0xFF,
+        (uint8_t) ~FUSB_MASKA_M_TOGDONE,
+        FUSB_MASKB_M_GCRCSENT
+    }
+};
+
+/* Self-clearing bits of the shadowed registers.  Writing them always goes to
+ * the chip, and they're never kept in the shadow. */
+static const uint8_t fusb_shadow_self_clearing[PDB_FUSB_SHADOW_LEN] = {
+    [FUSB_CONTROL0 - PDB_FUSB_SHADOW_FIRST] = FUSB_CONTROL0_TX_FLUSH,
+    [FUSB_CONTROL1 - PDB_FUSB_SHADOW_FIRST] = FUSB_CONTROL1_RX_FLUSH,
+    [FUSB_CONTROL3 - PDB_FUSB_SHADOW_FIRST] = FUSB_CONTROL3_SEND_HARD_RESET,
+    [FUSB_RESET - PDB_FUSB_SHADOW_FIRST] = 0xFF
+};
+
+/*
+ * Register script operations
+ */
+enum fusb_script_op {
+    /* Write value to the register addr */
+    FUSB_SCRIPT_WRITE,
+    /* Wait value microseconds */
+    FUSB_SCRIPT_DELAY,
+    /* Read the shadowed registers back after a software reset */
+    FUSB_SCRIPT_RESYNC,
+    /* End of the script */
+    FUSB_SCRIPT_END
+};
+
+/*
+ * Step of a register script
+ */
+struct fusb_script_step {
+    uint8_t op;
+    uint8_t addr;
+    uint16_t value;
+};
+
+#define FUSB_WRITE(addr, value) {FUSB_SCRIPT_WRITE, (addr), (value)}
+#define FUSB_DELAY_US(us) {FUSB_SCRIPT_DELAY, 0, (us)}
+#define FUSB_RESYNC() {FUSB_SCRIPT_RESYNC, 0, 0}
+#define FUSB_END() {FUSB_SCRIPT_END, 0, 0}
+
+/*
+ * Register scripts
+ *
+ * Writes to consecutive registers are done in a single auto-increment burst,
+ * so the steps are ordered by address wherever the order doesn't matter.
+ * The I2C bus is released during the delays.
+ */
+static const struct fusb_script_step fusb_setup_script[] = {
+    /* Fully reset the FUSB302B */
+    FUSB_WRITE(FUSB_RESET, FUSB_RESET_SW_RES),
+    FUSB_RESYNC(),
+    /* Flush the RX buffer */
+    FUSB_WRITE(FUSB_CONTROL0, 0x04),
+    FUSB_WRITE(FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH),
+    /* Enable automatic retransmission */
+    FUSB_WRITE(FUSB_CONTROL3, 0x07),
+    /* Set interrupt masks and turn on all power */
+    FUSB_WRITE(FUSB_MASK1, FUSB_PD_MASK1),
+    FUSB_WRITE(FUSB_POWER, 0x0F),
+    FUSB_WRITE(FUSB_MASKA, FUSB_PD_MASKA),
+    FUSB_WRITE(FUSB_MASKB, FUSB_PD_MASKB),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_meas_cc1_script[] = {
+    FUSB_WRITE(FUSB_SWITCHES0, 0x07),
+    FUSB_DELAY_US(250),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_meas_cc2_script[] = {
+    FUSB_WRITE(FUSB_SWITCHES0, 0x0B),
+    FUSB_DELAY_US(250),
+    FUSB_END()
+};
+
+/* Select the CC line for BMC signaling; also enable AUTO_CRC */
+static const struct fusb_script_step fusb_sel_cc1_script[] = {
+    FUSB_WRITE(FUSB_SWITCHES0, 0x07),
+    FUSB_WRITE(FUSB_SWITCHES1, 0x25),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_sel_cc2_script[] = {
+    FUSB_WRITE(FUSB_SWITCHES0, 0x0B),
+    FUSB_WRITE(FUSB_SWITCHES1, 0x26),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_pd_reset_script[] = {
+    FUSB_WRITE(FUSB_RESET, FUSB_RESET_PD_RESET),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_reset_script[] = {
+    /* Flush the TX and RX buffers */
+    FUSB_WRITE(FUSB_CONTROL0, 0x44),
+    FUSB_WRITE(FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH),
+    /* Reset the PD logic */
+    FUSB_WRITE(FUSB_RESET, FUSB_RESET_PD_RESET),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_tx_flush_script[] = {
+    FUSB_WRITE(FUSB_CONTROL0, 0x44),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_hard_reset_script[] = {
+    FUSB_WRITE(FUSB_CONTROL3, 0x07 | FUSB_CONTROL3_SEND_HARD_RESET),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_toggle_script[] = {
+    /* Pull-downs on both lines, nothing measured */
+    FUSB_WRITE(FUSB_SWITCHES0, FUSB_SWITCHES0_PDWN_2 | FUSB_SWITCHES0_PDWN_1),
+    /* Restart the sink toggling */
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK),
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK | FUSB_CONTROL2_TOGGLE),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_toggle_stop_script[] = {
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_detach_script[] = {
+    /* Pull-downs on both lines, nothing measured */
+    FUSB_WRITE(FUSB_SWITCHES0, FUSB_SWITCHES0_PDWN_2 | FUSB_SWITCHES0_PDWN_1),
+    /* Stop the toggling to restart it, and power down everything but the
+     * bandgap and wake circuit, which are enough for the toggling */
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK),
+    FUSB_WRITE(FUSB_POWER, FUSB_POWER_PWR0),
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK | FUSB_CONTROL2_TOGGLE),
+    FUSB_END()
+};
+
+static const struct fusb_script_step fusb_attach_script[] = {
+    /* Stop the toggling, keeping the CC line it found, and turn on all
+     * power */
+    FUSB_WRITE(FUSB_CONTROL2, FUSB_CONTROL2_MODE_SNK),
+    FUSB_WRITE(FUSB_POWER, 0x0F),
+    FUSB_END()
+};
+
+static const struct fusb_script_step *const fusb_scripts[fusb_num_scripts] = {
+    [fusb_script_setup] = fusb_setup_script,
+    [fusb_script_meas_cc1] = fusb_meas_cc1_script,
+    [fusb_script_meas_cc2] = fusb_meas_cc2_script,
+    [fusb_script_sel_cc1] = fusb_sel_cc1_script,
+    [fusb_script_sel_cc2] = fusb_sel_cc2_script,
+    [fusb_script_pd_reset] = fusb_pd_reset_script,
+    [fusb_script_reset] = fusb_reset_script,
+    [fusb_script_hard_reset] = fusb_hard_reset_script,
+    [fusb_script_toggle] = fusb_toggle_script,
+    [fusb_script_toggle_stop] = fusb_toggle_stop_script,
+    [fusb_script_detach] = fusb_detach_script,
+    [fusb_script_attach] = fusb_attach_script,
+    [fusb_script_tx_flush] = fusb_tx_flush_script
+};
+
+#if PDB_USE_STATS
+/*
+ * Record a message written to the TX FIFO in one transaction of len bytes
+ */
+static void fusb_stat_tx(struct pdb_fusb_config *cfg, uint8_t len,
+        rtcnt_t start)
+{
+    struct pdb_fusb_stats *stats = &cfg->stats;
+
+    pdb_hist_add(&stats->tx_time, start);
+    stats->tx_msgs++;
+    /* The frame plus the I2C address byte */
+    stats->tx_bytes += len + 1;
+    /* Writing the SOP and EOP tokens separately took two more transactions,
+     * each with its own I2C and register address bytes */
+    stats->tx_bytes_saved += 4;
+}
+
+/*
+ * Start accounting the reading of a message
+ */
+static void fusb_stat_rx_begin(struct pdb_fusb_config *cfg)
+{
+    cfg->stats._rx_transactions = cfg->stats.rx_transactions;
+    cfg->stats._rx_bytes = cfg->stats.rx_bytes;
+    cfg->stats._rx_start = pdb_stats_now();
+}
+
+/*
+ * Record a read transaction of len bytes from the RX FIFO
+ */
+static void fusb_stat_rx_read(struct pdb_fusb_config *cfg, uint8_t len)
+{
+    struct pdb_fusb_stats *stats = &cfg->stats;
+
+    stats->rx_transactions++;
+    /* Two I2C address bytes and the register address */
+    stats->rx_bytes += len + 3;
+}
+
+/*
+ * Record a message read from the RX FIFO
+ */
+static void fusb_stat_rx(struct pdb_fusb_config *cfg,
+        const union pd_msg *msg)
+{
+    struct pdb_fusb_stats *stats = &cfg->stats;
+
+    pdb_hist_add(&stats->rx_time, stats->_rx_start);
+    stats->rx_msgs++;
+    if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_SOURCE_CAPABILITIES
+            && PD_NUMOBJ_GET(msg) > 0) {
+        stats->rx_src_caps++;
+        stats->rx_src_cap_transactions += stats->rx_transactions
+            - stats->_rx_transactions;
+        stats->rx_src_cap_bytes += stats->rx_bytes - stats->_rx_bytes;
+    }
+}
+
+#define FUSB_STAT_NOW() pdb_stats_now()
+#define FUSB_STAT_TX(cfg, len, start) fusb_stat_tx(cfg, len, start)
+#define FUSB_STAT_RX_BEGIN(cfg) fusb_stat_rx_begin(cfg)
+#define FUSB_STAT_RX_READ(cfg, len) fusb_stat_rx_read(cfg, len)
+#define FUSB_STAT_RX(cfg, msg) fusb_stat_rx(cfg, msg)
+#define FUSB_STAT_SHADOW(cfg, addr, hit) fusb_stat_shadow(cfg, addr, hit)
+#define FUSB_STAT_ORIENT(cfg, toggle) do { \
+        if (toggle) { \
+            (cfg)->stats.orient_toggle++; \
+        } else { \
+            (cfg)->stats.orient_bc_lvl++; \
+        } \
+    } while (0)
+#define FUSB_STAT_ORIENT_TIME(cfg, start) \
+    pdb_hist_add(&(cfg)->stats.orient_time, start)
+#define FUSB_STAT_ORIENT_KEPT(cfg, start) do { \
+        (cfg)->stats.orient_kept++; \
+        pdb_hist_add(&(cfg)->stats.orient_time, start); \
+    } while (0)
+#define FUSB_STAT_ORIENT_START(cfg, start) \
+    ((cfg)->stats._orient_start = (start))
+#define FUSB_STAT_ORIENT_TOGGLED(cfg) \
+    pdb_hist_add(&(cfg)->stats.orient_time, (cfg)->stats._orient_start)
+#define FUSB_STAT_LP_DETACH(cfg) ((cfg)->stats.lp_detaches++)
+#define FUSB_STAT_LP_ATTACH(cfg, start) do { \
+        (cfg)->stats.lp_attaches++; \
+        pdb_hist_add(&(cfg)->stats.orient_time, start); \
+    } while (0)
+#define FUSB_STAT_VBUS(cfg, start) do { \
+        (cfg)->stats.vbus_measurements++; \
+        pdb_hist_add(&(cfg)->stats.vbus_time, start); \
+    } while (0)
+#define FUSB_STAT_SCRIPT(cfg, id, start) do { \
+        (cfg)->stats.script_runs[id]++; \
+        pdb_hist_add(&(cfg)->stats.script_time[id], start); \
+    } while (0)
+#define FUSB_STAT_STATUS0(cfg, hit) do { \
+        if (hit) { \
+            (cfg)->stats.status0_hits++; \
+        } else { \
+            (cfg)->stats.status0_reads++; \
+        } \
+    } while (0)
+#define FUSB_STAT_XFER_QUEUED(xfer) ((xfer)->_queued = pdb_stats_now())
+#define FUSB_STAT_XFER(cfg, xfer) do { \
+        (cfg)->stats.async_xfers++; \
+        pdb_hist_add(&(cfg)->stats.async_time, (xfer)->_queued); \
+    } while (0)
+#else
+#define FUSB_STAT_NOW() 0
+#define FUSB_STAT_TX(cfg, len, start) do {(void) (start);} while (0)
+#define FUSB_STAT_RX_BEGIN(cfg) do {} while (0)
+#define FUSB_STAT_RX_READ(cfg, len) do {} while (0)
+#define FUSB_STAT_RX(cfg, msg) do {} while (0)
+#define FUSB_STAT_SHADOW(cfg, addr, hit) do {} while (0)
+#define FUSB_STAT_ORIENT(cfg, toggle) do {} while (0)
+#define FUSB_STAT_ORIENT_TIME(cfg, start) do {(void) (start);} while (0)
+#define FUSB_STAT_ORIENT_KEPT(cfg, start) do {(void) (start);} while (0)
+#define FUSB_STAT_ORIENT_START(cfg, start) do {(void) (start);} while (0)
+#define FUSB_STAT_ORIENT_TOGGLED(cfg) do {} while (0)
+#define FUSB_STAT_LP_DETACH(cfg) do {} while (0)
+#define FUSB_STAT_LP_ATTACH(cfg, start) do {(void) (start);} while (0)
+#define FUSB_STAT_VBUS(cfg, start) do {(void) (start);} while (0)
+#define FUSB_STAT_SCRIPT(cfg, id, start) do {(void) (start);} while (0)
+#define FUSB_STAT_STATUS0(cfg, hit) do {} while (0)
+#define FUSB_STAT_XFER_QUEUED(xfer) do {} while (0)
+#define FUSB_STAT_XFER(cfg, xfer) do {} while (0)
+#endif
+
+#if PDB_FUSB_USE_TRACE
+#if PDB_FUSB_TRACE_LEN & (PDB_FUSB_TRACE_LEN - 1)
+#error "PDB_FUSB_TRACE_LEN must be a power of two"
+#endif
+
+/*
+ * Account the time since the last mark to the current phase
+ *
+ * Must be called with the system locked.
+ */
+static void fusb_trace_mark(struct pdb_fusb_trace *trace, rtcnt_t now)
+{
+    trace->_totals.elapsed[trace->_phase] += (rtcnt_t) (now
+            - trace->_phase_mark);
+    trace->_phase_mark = now;
+}
+
+/*
+ * Record a transaction in the trace
+ *
+ * The I2C bus must already be acquired, which makes us the only writer.
+ */
+static void fusb_trace_record(struct pdb_fusb_config *cfg, thread_t *thread,
+        const uint8_t *txbuf, size_t txbytes, const uint8_t *rxbuf,
+        size_t rxbytes, msg_t ret, rtcnt_t start)
+{
+    struct pdb_fusb_trace *trace = &cfg->trace;
+    rtcnt_t end = chSysGetRealtimeCounterX();
+    uint32_t seq = trace->_seq + 1;
+    struct pdb_fusb_trace_entry *entry =
+        &trace->_ring[seq & (PDB_FUSB_TRACE_LEN - 1)];
+    uint8_t phase = trace->_phase;
+    uint8_t len;
+
+    /* Tell the readers the entry is being overwritten */
+    entry->seq = 0;
+    __sync_synchronize();
+
+    entry->start = start;
+    entry->end = end;
+    entry->thread = thread;
+    entry->addr = txbuf[0];
+    entry->phase = phase;
+    if (rxbytes > 0) {
+        len = rxbytes;
+        entry->flags = PDB_FUSB_TRACE_READ;
+        /* Nothing worth keeping was read if the transaction failed */
+        if (ret == MSG_OK) {
+            memcpy(entry->data, rxbuf, len < PDB_FUSB_TRACE_DATA_LEN
+                    ? len : PDB_FUSB_TRACE_DATA_LEN);
+        }
+    } else {
+        len = txbytes - 1;
+        entry->flags = 0;
+        memcpy(entry->data, txbuf + 1, len < PDB_FUSB_TRACE_DATA_LEN
+                ? len : PDB_FUSB_TRACE_DATA_LEN);
+    }
+    entry->len = len;
+    if (ret != MSG_OK) {
+        entry->flags |= PDB_FUSB_TRACE_ERROR;
+    }
+
+    /* Publish the entry */
+    __sync_synchronize();
+    entry->seq = seq;
+    trace->_seq = seq;
+
+    chSysLock();
+    trace->_totals.transactions[phase]++;
+    trace->_totals.bytes[phase] += len;
+    trace->_totals.busy[phase] += (rtcnt_t) (end - start);
+    fusb_trace_mark(trace, end);
+    chSysUnlock();
+}
+
+#define FUSB_TRACE_NOW() chSysGetRealtimeCounterX()
+#define FUSB_TRACE(cfg, thread, txbuf, txbytes, rxbuf, rxbytes, ret, start) \
+    fusb_trace_record(cfg, thread, txbuf, txbytes, rxbuf, rxbytes, ret, start)
+#else
+#define FUSB_TRACE_NOW() 0
+#define FUSB_TRACE(cfg, thread, txbuf, txbytes, rxbuf, rxbytes, ret, start) \
+    do {(void) (thread); (void) (start);} while (0)
+#endif
+
+/*
+ * Check whether writing byte to the register addr can be skipped because the
+ * shadow says the chip already holds that value
+ */
+static bool fusb_shadow_hit(struct pdb_fusb_config *cfg, uint8_t addr,
+        uint8_t byte)
+{
+    uint8_t i = addr - PDB_FUSB_SHADOW_FIRST;
+
+    if (addr < PDB_FUSB_SHADOW_FIRST || i >= PDB_FUSB_SHADOW_LEN) {
+        return false;
+    }
+
+    return !(byte & fusb_shadow_self_clearing[i])
+        && (cfg->_shadow_valid & (1 << i))
+        && cfg->_shadow[i] == byte;
+}
+
+#if PDB_USE_STATS
+/*
+ * Count a write to the register addr as skipped or done
+ */
+static void fusb_stat_shadow(struct pdb_fusb_config *cfg, uint8_t addr,
+        bool hit)
+{
+    uint8_t i = addr - PDB_FUSB_SHADOW_FIRST;
+
+    if (addr < PDB_FUSB_SHADOW_FIRST || i >= PDB_FUSB_SHADOW_LEN) {
+        return;
+    }
+    if (hit) {
+        cfg->stats.shadow_hits[i]++;
+    } else {
+        cfg->stats.shadow_writes[i]++;
+    }
+}
+#endif
+
+/*
+ * Update the shadow after byte was written to the register addr
+ */
+static void fusb_shadow_update(struct pdb_fusb_config *cfg, uint8_t addr,
+        uint8_t byte)
+{
+    uint8_t i = addr - PDB_FUSB_SHADOW_FIRST;
+
+    if (addr < PDB_FUSB_SHADOW_FIRST || i >= PDB_FUSB_SHADOW_LEN) {
+        return;
+    }
+    /* A software reset puts every register back to its default */
+    if (addr == FUSB_RESET) {
+        if (byte & FUSB_RESET_SW_RES) {
+            cfg->_shadow_valid = 0;
+        }
+        return;
+    }
+    cfg->_shadow[i] = byte & ~fusb_shadow_self_clearing[i];
+    cfg->_shadow_valid |= 1 << i;
+
+    /* BC_LVL now measures another CC line */
+    if (addr == FUSB_SWITCHES0) {
+        cfg->_status0_valid = false;
+    }
+}
 
+/*
+ * Forget the shadow of size registers from addr after a failed write, since
+ * we don't know what the chip holds anymore
+ */
+static void fusb_shadow_invalidate(struct pdb_fusb_config *cfg, uint8_t addr,
+        uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++, addr++) {
+        if (addr >= PDB_FUSB_SHADOW_FIRST
+                && addr - PDB_FUSB_SHADOW_FIRST < PDB_FUSB_SHADOW_LEN) {
+            cfg->_shadow_valid &= ~(1 << (addr - PDB_FUSB_SHADOW_FIRST));
+        }
+    }
+    cfg->_status0_valid = false;
+}
+
+/*
+ * Do an I2C transfer with the FUSB302B within its time budget, on behalf of
+ * thread
+ *
+ * Returns MSG_OK on success, or the error of pdb_i2c_transfer.
+ */
+static msg_t fusb_transfer_for(struct pdb_fusb_config *cfg, thread_t *thread,
+        const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes)
+{
+    msg_t ret;
+    rtcnt_t start = FUSB_TRACE_NOW();
+
+    ret = pdb_i2c_transfer(cfg->i2cp, cfg->addr, txbuf, txbytes, rxbuf,
+            rxbytes, &cfg->i2c_stats);
+    FUSB_TRACE(cfg, thread, txbuf, txbytes, rxbuf, rxbytes, ret, start);
+
+    return ret;
+}
+
+/*
+ * Do an I2C transfer with the FUSB302B on behalf of the calling thread
+ */
+static msg_t fusb_transfer(struct pdb_fusb_config *cfg, const uint8_t *txbuf,
+        size_t txbytes, uint8_t *rxbuf, size_t rxbytes)
+{
+    return fusb_transfer_for(cfg, chThdGetSelfX(), txbuf, txbytes, rxbuf,
+            rxbytes);
+}
 
 /*
  * Read a single byte from the FUSB302B
  *
  * cfg: The FUSB302B to communicate with
  * addr: The memory address from which to read
+ * byte: Where the value read from addr is stored
  *
- * Returns the value read from addr.
+ * Returns MSG_OK on success.
  */
-static uint8_t fusb_read_byte(struct pdb_fusb_config *cfg, uint8_t addr)
+static msg_t fusb_read_byte(struct pdb_fusb_config *cfg, uint8_t addr,
+        uint8_t *byte)
 {
-    uint8_t buf;
-    i2cMasterTransmit(cfg->i2cp, cfg->addr, &addr, 1, &buf, 1);
-    return buf;
+    return fusb_transfer(cfg, &addr, 1, byte, 1);
 }
 
 /*
@@ -50,11 +577,13 @@ static uint8_t fusb_read_byte(struct pdb_fusb_config *cfg, uint8_t addr)
  * addr: The memory address from which to read
  * size: The number of bytes to read
  * buf: The buffer into which data will be read
+ *
+ * Returns MSG_OK on success.
  */
-static void fusb_read_buf(struct pdb_fusb_config *cfg, uint8_t addr,
+static msg_t fusb_read_buf(struct pdb_fusb_config *cfg, uint8_t addr,
         uint8_t size, uint8_t *buf)
 {
-    i2cMasterTransmit(cfg->i2cp, cfg->addr, &addr, 1, buf, size);
+    return fusb_transfer(cfg, &addr, 1, buf, size);
 }
 
 /*
@@ -63,12 +592,28 @@ static void fusb_read_buf(struct pdb_fusb_config *cfg, uint8_t addr,
  * cfg: The FUSB302B to communicate with
  * addr: The memory address to which we will write
  * byte: The value to write
+ *
+ * Returns MSG_OK on success.
  */
-static void fusb_write_byte(struct pdb_fusb_config *cfg, uint8_t addr,
+static msg_t fusb_write_byte(struct pdb_fusb_config *cfg, uint8_t addr,
         uint8_t byte)
 {
+    bool hit = fusb_shadow_hit(cfg, addr, byte);
+    msg_t ret;
+
+    FUSB_STAT_SHADOW(cfg, addr, hit);
+    if (hit) {
+        return MSG_OK;
+    }
+
     uint8_t buf[2] = {addr, byte};
-    i2cMasterTransmit(cfg->i2cp, cfg->addr, buf, 2, NULL, 0);
+    ret = fusb_transfer(cfg, buf, 2, NULL, 0);
+    if (ret == MSG_OK) {
+        fusb_shadow_update(cfg, addr, byte);
+    } else {
+        fusb_shadow_invalidate(cfg, addr, 1);
+    }
+    return ret;
 }
 
 /*
@@ -78,201 +623,899 @@ static void fusb_write_byte(struct pdb_fusb_config *cfg, uint8_t addr,
  * addr: The memory address to which we will write
  * size: The number of bytes to write
  * buf: The buffer to write
+ *
+ * Returns MSG_OK on success.
  */
-static void fusb_write_buf(struct pdb_fusb_config *cfg, uint8_t addr,
+static msg_t fusb_write_buf(struct pdb_fusb_config *cfg, uint8_t addr,
         uint8_t size, const uint8_t *buf)
 {
-    uint8_t txbuf[size + 1];
+    uint8_t txbuf[FUSB_WRITE_BUF_MAX + 1];
+    bool hit = true;
+    msg_t ret;
+
+    chDbgAssert(size <= FUSB_WRITE_BUF_MAX, "FUSB302B write too long");
+
+    /* Skip the write if every register already holds its value */
+    for (uint8_t i = 0; i < size; i++) {
+        hit = fusb_shadow_hit(cfg, addr + i, buf[i]) && hit;
+    }
+    for (uint8_t i = 0; i < size; i++) {
+        FUSB_STAT_SHADOW(cfg, addr + i, hit);
+    }
+    if (hit) {
+        return MSG_OK;
+    }
 
     /* Prepare the transmit buffer */
     txbuf[0] = addr;
-    for (int i = 0; i < size; i++) {
-        txbuf[i + 1] = buf[i];
+    memcpy(&txbuf[1], buf, size);
+
+    ret = fusb_transfer(cfg, txbuf, size + 1, NULL, 0);
+    if (ret != MSG_OK) {
+        /* Some of the registers may have been written anyway */
+        fusb_shadow_invalidate(cfg, addr, size);
+        return ret;
     }
+    for (uint8_t i = 0; i < size; i++) {
+        fusb_shadow_update(cfg, addr + i, buf[i]);
+    }
+    return MSG_OK;
+}
+
+/*
+ * Read the shadowed registers back from the FUSB302B
+ *
+ * Used after a software reset, so that the registers left at their default
+ * value don't have to be written again.
+ */
+static msg_t fusb_shadow_resync(struct pdb_fusb_config *cfg)
+{
+    msg_t ret;
 
-    i2cMasterTransmit(cfg->i2cp, cfg->addr, txbuf, size + 1, NULL, 0);
+    ret = fusb_read_buf(cfg, PDB_FUSB_SHADOW_FIRST, PDB_FUSB_SHADOW_LEN,
+            cfg->_shadow);
+    if (ret != MSG_OK) {
+        cfg->_shadow_valid = 0;
+        return ret;
+    }
+    /* Everything but the write-only RESET register */
+    cfg->_shadow_valid = ((1 << PDB_FUSB_SHADOW_LEN) - 1)
+        & ~(1 << (FUSB_RESET - PDB_FUSB_SHADOW_FIRST));
+    return MSG_OK;
 }
 
-void fusb_send_message(struct pdb_fusb_config *cfg, const union pd_msg *msg)
+/*
+ * Remember the STATUS0 register of a status read
+ */
+static void fusb_cache_status0(struct pdb_fusb_config *cfg, uint8_t status0)
 {
-    /* Token sequences for the FUSB302B */
-    static uint8_t sop_seq[5] = {
-        FUSB_FIFO_TX_SOP1,
-        FUSB_FIFO_TX_SOP1,
-        FUSB_FIFO_TX_SOP1,
-        FUSB_FIFO_TX_SOP2,
-        FUSB_FIFO_TX_PACKSYM
-    };
-    static uint8_t eop_seq[4] = {
-        FUSB_FIFO_TX_JAM_CRC,
-        FUSB_FIFO_TX_EOP,
-        FUSB_FIFO_TX_TXOFF,
-        FUSB_FIFO_TX_TXON
-    };
+    chSysLock();
+    cfg->_status0 = status0;
+    cfg->_status0_time = chVTGetSystemTimeX();
+    cfg->_status0_valid = true;
+    chSysUnlock();
+}
 
-    /* Take the I2C2 mutex now so there can't be a race condition on sop_seq */
-    i2cAcquireBus(cfg->i2cp);
+/*
+ * Write the interrupt masks of a profile to the FUSB302B
+ *
+ * The I2C bus must already be acquired.  Only the registers that change are
+ * written.
+ */
+static msg_t fusb_write_masks(struct pdb_fusb_config *cfg,
+        enum fusb_mask_profile profile)
+{
+    const uint8_t *masks = fusb_mask_profiles[profile];
+    msg_t ret;
+
+    ret = fusb_write_byte(cfg, FUSB_MASK1, masks[0]);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+    /* MASKA and MASKB are contiguous, so write them together */
+    ret = fusb_write_buf(cfg, FUSB_MASKA, 2, &masks[1]);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+
+    cfg->_mask_profile = profile;
+    return MSG_OK;
+}
+
+/*
+ * Write a run of consecutive registers
+ */
+static msg_t fusb_write_run(struct pdb_fusb_config *cfg, uint8_t addr,
+        uint8_t size, const uint8_t *buf)
+{
+    if (size == 1) {
+        return fusb_write_byte(cfg, addr, buf[0]);
+    } else {
+        return fusb_write_buf(cfg, addr, size, buf);
+    }
+}
+
+/*
+ * Run a register script
+ *
+ * The I2C bus must already be acquired.  It's released during the delays, so
+ * that other devices on the bus don't wait for us.  Writes to consecutive
+ * registers are coalesced into one burst, except after a write to RESET.
+ *
+ * Returns MSG_OK on success, or the error of the first failed transfer, at
+ * which point the script is abandoned.
+ */
+static msg_t fusb_run_script(struct pdb_fusb_config *cfg,
+        enum fusb_script_id id)
+{
+    const struct fusb_script_step *step = fusb_scripts[id];
+    uint8_t run[FUSB_WRITE_BUF_MAX];
+    uint8_t run_addr = 0;
+    uint8_t run_len = 0;
+    msg_t ret = MSG_OK;
+    rtcnt_t start = FUSB_STAT_NOW();
+
+    for (;; step++) {
+        /* If this write extends the current run, add it there */
+        if (step->op == FUSB_SCRIPT_WRITE && run_len > 0
+                && run_len < FUSB_WRITE_BUF_MAX
+                && step->addr == run_addr + run_len
+                && run_addr + run_len - 1 != FUSB_RESET) {
+            run[run_len++] = step->value;
+            continue;
+        }
+
+        /* Otherwise, write the current run first */
+        if (run_len > 0) {
+            ret = fusb_write_run(cfg, run_addr, run_len, run);
+            run_len = 0;
+            if (ret != MSG_OK) {
+                return ret;
+            }
+        }
+
+        switch (step->op) {
+            case FUSB_SCRIPT_WRITE:
+                run_addr = step->addr;
+                run[run_len++] = step->value;
+                break;
+            case FUSB_SCRIPT_DELAY:
+                i2cReleaseBus(cfg->i2cp);
+                chThdSleepMicroseconds(step->value);
+                i2cAcquireBus(cfg->i2cp);
+                break;
+            case FUSB_SCRIPT_RESYNC:
+                ret = fusb_shadow_resync(cfg);
+                if (ret != MSG_OK) {
+                    return ret;
+                }
+                break;
+            default:
+                FUSB_STAT_SCRIPT(cfg, id, start);
+                return MSG_OK;
+        }
+    }
+}
+
+/*
+ * Use the given CC line, 1 or 2, for BMC signaling
+ *
+ * The I2C bus must already be acquired.
+ */
+static msg_t fusb_use_cc(struct pdb_fusb_config *cfg, uint8_t cc)
+{
+    msg_t ret;
+
+    if (cc == 1) {
+        ret = fusb_run_script(cfg, fusb_script_sel_cc1);
+    } else {
+        ret = fusb_run_script(cfg, fusb_script_sel_cc2);
+    }
+    cfg->_cc = ret == MSG_OK ? cc : 0;
+
+    return ret;
+}
+
+/*
+ * Find the CC line the source is attached to by measuring BC_LVL on both
+ * lines, and use it for BMC signaling
+ *
+ * The I2C bus must already be acquired.  It's released while the comparator
+ * settles.
+ *
+ * Returns MSG_OK on success.
+ */
+static msg_t fusb_measure_cc(struct pdb_fusb_config *cfg)
+{
+    uint8_t cc1, cc2;
+    msg_t ret;
+    rtcnt_t start = FUSB_STAT_NOW();
+
+    /* Measure CC1 */
+    ret = fusb_run_script(cfg, fusb_script_meas_cc1);
+    if (ret == MSG_OK) {
+        ret = fusb_read_byte(cfg, FUSB_STATUS0, &cc1);
+    }
+
+    /* Measure CC2 */
+    if (ret == MSG_OK) {
+        ret = fusb_run_script(cfg, fusb_script_meas_cc2);
+    }
+    if (ret == MSG_OK) {
+        ret = fusb_read_byte(cfg, FUSB_STATUS0, &cc2);
+    }
+    if (ret != MSG_OK) {
+        cfg->_cc = 0;
+        return ret;
+    }
+
+    /* Use the line with the highest BC_LVL */
+    cc1 &= FUSB_STATUS0_BC_LVL;
+    cc2 &= FUSB_STATUS0_BC_LVL;
+    ret = fusb_use_cc(cfg, cc1 > cc2 ? 1 : 2);
+    FUSB_STAT_ORIENT(cfg, false);
+    FUSB_STAT_ORIENT_TIME(cfg, start);
+
+    return ret;
+}
+
+msg_t fusb_send_message(struct pdb_fusb_config *cfg, union pd_msg *msg)
+{
+    /* The frame starts in the headroom of the message with the FIFO address
+     * and the SOP tokens */
+    uint8_t *frame = msg->bytes - (1 + FUSB_TX_SOP_LEN);
+    uint8_t *eop;
 
     /* Get the length of the message: a two-octet header plus NUMOBJ four-octet
      * data objects */
     uint8_t msg_len = 2 + 4 * PD_NUMOBJ_GET(msg);
+    uint8_t frame_len = 1 + FUSB_TX_SOP_LEN + msg_len + FUSB_TX_EOP_LEN;
+    msg_t ret;
+
+    frame[0] = FUSB_FIFOS;
+
+    /* Start of packet, followed by the number of bytes to transmit */
+    frame[1] = FUSB_FIFO_TX_SOP1;
+    frame[2] = FUSB_FIFO_TX_SOP1;
+    frame[3] = FUSB_FIFO_TX_SOP1;
+    frame[4] = FUSB_FIFO_TX_SOP2;
+    frame[5] = FUSB_FIFO_TX_PACKSYM | msg_len;
 
-    /* Set the number of bytes to be transmitted in the packet */
-    sop_seq[4] = FUSB_FIFO_TX_PACKSYM | msg_len;
+    /* End of packet right after the message, then start the transmission */
+    eop = &msg->bytes[msg_len];
+    eop[0] = FUSB_FIFO_TX_JAM_CRC;
+    eop[1] = FUSB_FIFO_TX_EOP;
+    eop[2] = FUSB_FIFO_TX_TXOFF;
+    eop[3] = FUSB_FIFO_TX_TXON;
 
-    /* Write all three parts of the message to the TX FIFO */
-    fusb_write_buf(cfg, FUSB_FIFOS, 5, sop_seq);
-    fusb_write_buf(cfg, FUSB_FIFOS, msg_len, msg->bytes);
-    fusb_write_buf(cfg, FUSB_FIFOS, 4, eop_seq);
+    i2cAcquireBus(cfg->i2cp);
+
+    /* Write the frame to the TX FIFO in a single transaction */
+    rtcnt_t start = FUSB_STAT_NOW();
+    ret = fusb_transfer(cfg, frame, frame_len, NULL, 0);
+    if (ret == MSG_OK) {
+        FUSB_STAT_TX(cfg, frame_len, start);
+    }
 
     i2cReleaseBus(cfg->i2cp);
+
+    return ret;
 }
 
-uint8_t fusb_read_message(struct pdb_fusb_config *cfg, union pd_msg *msg)
+uint8_t fusb_read_header(struct pdb_fusb_config *cfg, union pd_msg *msg)
 {
-    uint8_t garbage[4];
-    uint8_t numobj;
+    /* The token lands in the headroom, just in front of the header */
+    uint8_t *frame = msg->bytes - 1;
+
+    FUSB_STAT_RX_BEGIN(cfg);
 
     i2cAcquireBus(cfg->i2cp);
 
+    /* Read the token, the header and four more bytes in one burst.  These
+     * are the CRC of a control message, or the first data object of a data
+     * message. */
+    if (fusb_read_buf(cfg, FUSB_FIFOS, 1 + 2 + 4, frame) != MSG_OK) {
+        i2cReleaseBus(cfg->i2cp);
+        return 1;
+    }
+    FUSB_STAT_RX_READ(cfg, 1 + 2 + 4);
+
     /* If this isn't an SOP message, return error.
      * Because of our configuration, we should be able to assume this means the
-     * buffer is empty, and not try to read past a non-SOP message. */
-    if ((fusb_read_byte(cfg, FUSB_FIFOS) & FUSB_FIFO_RX_TOKEN_BITS)
-            != FUSB_FIFO_RX_SOP) {
+     * buffer was empty.  Flush it anyway in case we read past something we
+     * didn't expect. */
+    if ((frame[0] & FUSB_FIFO_RX_TOKEN_BITS) != FUSB_FIFO_RX_SOP) {
+        fusb_write_byte(cfg, FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH);
         i2cReleaseBus(cfg->i2cp);
         return 1;
     }
-    /* Read the message header into msg */
-    fusb_read_buf(cfg, FUSB_FIFOS, 2, msg->bytes);
+
+    i2cReleaseBus(cfg->i2cp);
+
+    return 0;
+}
+
+uint8_t fusb_read_rest(struct pdb_fusb_config *cfg, union pd_msg *msg)
+{
     /* Get the number of data objects */
-    numobj = PD_NUMOBJ_GET(msg);
-    /* If there is at least one data object, read the data objects */
+    uint8_t numobj = PD_NUMOBJ_GET(msg);
+
+    /* If there is at least one data object, read the rest of them and the
+     * CRC32.  The CRC lands after the message and is ignored, since the PHY
+     * already checked it. */
     if (numobj > 0) {
-        fusb_read_buf(cfg, FUSB_FIFOS, numobj * 4, msg->bytes + 2);
+        i2cAcquireBus(cfg->i2cp);
+
+        if (fusb_read_buf(cfg, FUSB_FIFOS, numobj * 4, msg->bytes + 2 + 4)
+                != MSG_OK) {
+            /* Don't leave the rest of the message in the FIFO */
+            fusb_write_byte(cfg, FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH);
+            i2cReleaseBus(cfg->i2cp);
+            return 1;
+        }
+        FUSB_STAT_RX_READ(cfg, numobj * 4);
+
+        i2cReleaseBus(cfg->i2cp);
     }
-    /* Throw the CRC32 in the garbage, since the PHY already checked it. */
-    fusb_read_buf(cfg, FUSB_FIFOS, 4, garbage);
 
-    i2cReleaseBus(cfg->i2cp);
+    FUSB_STAT_RX(cfg, msg);
     return 0;
 }
 
-void fusb_send_hardrst(struct pdb_fusb_config *cfg)
+uint8_t fusb_read_message(struct pdb_fusb_config *cfg, union pd_msg *msg)
 {
+    if (fusb_read_header(cfg, msg) != 0) {
+        return 1;
+    }
+
+    return fusb_read_rest(cfg, msg);
+}
+
+bool fusb_rx_pending(struct pdb_fusb_config *cfg)
+{
+    uint8_t status1;
+    msg_t ret;
+
     i2cAcquireBus(cfg->i2cp);
 
-    /* Send a hard reset */
-    fusb_write_byte(cfg, FUSB_CONTROL3, 0x07 | FUSB_CONTROL3_SEND_HARD_RESET);
+    ret = fusb_read_byte(cfg, FUSB_STATUS1, &status1);
 
     i2cReleaseBus(cfg->i2cp);
+
+    return ret == MSG_OK && !(status1 & FUSB_STATUS1_RX_EMPTY);
 }
 
-void fusb_update_cc(struct pdb_fusb_config *cfg){
+msg_t fusb_send_hardrst(struct pdb_fusb_config *cfg)
+{
+    msg_t ret;
+
     i2cAcquireBus(cfg->i2cp);
 
-    /* Measure CC1 */
-    fusb_write_byte(cfg, FUSB_SWITCHES0, 0x07);
-    chThdSleepMicroseconds(250);
-    uint8_t cc1 = fusb_read_byte(cfg, FUSB_STATUS0) & FUSB_STATUS0_BC_LVL;
+    /* Send a hard reset */
+    ret = fusb_run_script(cfg, fusb_script_hard_reset);
 
-    /* Measure CC2 */
-    fusb_write_byte(cfg, FUSB_SWITCHES0, 0x0B);
-    chThdSleepMicroseconds(250);
-    uint8_t cc2 = fusb_read_byte(cfg, FUSB_STATUS0) & FUSB_STATUS0_BC_LVL;
-
-    /* Select the correct CC line for BMC signaling; also enable AUTO_CRC */
-    if (cc1 > cc2) {
-        fusb_write_byte(cfg, FUSB_SWITCHES1, 0x25);
-        fusb_write_byte(cfg, FUSB_SWITCHES0, 0x07);
-    } else {
-        fusb_write_byte(cfg, FUSB_SWITCHES1, 0x26);
-        fusb_write_byte(cfg, FUSB_SWITCHES0, 0x0B);
-    }
-    
     i2cReleaseBus(cfg->i2cp);
+
+    return ret;
 }
 
-void fusb_setup(struct pdb_fusb_config *cfg)
+msg_t fusb_update_cc(struct pdb_fusb_config *cfg)
 {
+    uint8_t status0;
+    msg_t ret;
+    rtcnt_t start = FUSB_STAT_NOW();
+
     i2cAcquireBus(cfg->i2cp);
 
-    /* Fully reset the FUSB302B */
-    fusb_write_byte(cfg, FUSB_RESET, FUSB_RESET_SW_RES);
+    /* If the source is still on the line we use, there's nothing to find */
+    if (cfg->_cc != 0) {
+        ret = fusb_read_byte(cfg, FUSB_STATUS0, &status0);
+        if (ret != MSG_OK || (status0 & FUSB_STATUS0_BC_LVL) != 0) {
+            if (ret == MSG_OK) {
+                FUSB_STAT_ORIENT_KEPT(cfg, start);
+            }
+            i2cReleaseBus(cfg->i2cp);
+            return ret;
+        }
+    }
 
-    /* Turn on all power */
-    fusb_write_byte(cfg, FUSB_POWER, 0x0F);
+#if PDB_FUSB_USE_TOGGLE
+    /* Otherwise, let the sink toggling find it and report it with
+     * I_TOGDONE, which is all that can happen until a line is selected */
+    cfg->_cc = 0;
+    ret = fusb_write_masks(cfg, fusb_mask_detached);
+    if (ret == MSG_OK) {
+        ret = fusb_run_script(cfg, fusb_script_toggle);
+    }
+    if (ret == MSG_OK) {
+        cfg->_toggling = true;
+        FUSB_STAT_ORIENT_START(cfg, start);
+        ret = PDB_PHY_TOGGLING;
+    }
+#else
+    ret = fusb_measure_cc(cfg);
+#endif
 
-    /* Set interrupt masks */
-    fusb_write_byte(cfg, FUSB_MASK1, 0x00);
-    fusb_write_byte(cfg, FUSB_MASKA, 0x00);
-    fusb_write_byte(cfg, FUSB_MASKB, 0x00);
-    fusb_write_byte(cfg, FUSB_CONTROL0, 0x04);
+    i2cReleaseBus(cfg->i2cp);
 
-    /* Enable automatic retransmission */
-    fusb_write_byte(cfg, FUSB_CONTROL3, 0x07);
+    return ret;
+}
 
-    /* Flush the RX buffer */
-    fusb_write_byte(cfg, FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH);
+msg_t fusb_setup(struct pdb_fusb_config *cfg)
+{
+    msg_t ret;
 
-    /* Measure CC1 */
-    fusb_write_byte(cfg, FUSB_SWITCHES0, 0x07);
-    chThdSleepMicroseconds(250);
-    uint8_t cc1 = fusb_read_byte(cfg, FUSB_STATUS0) & FUSB_STATUS0_BC_LVL;
+    i2cAcquireBus(cfg->i2cp);
 
-    /* Measure CC2 */
-    fusb_write_byte(cfg, FUSB_SWITCHES0, 0x0B);
-    chThdSleepMicroseconds(250);
-    uint8_t cc2 = fusb_read_byte(cfg, FUSB_STATUS0) & FUSB_STATUS0_BC_LVL;
-
-    /* Select the correct CC line for BMC signaling; also enable AUTO_CRC */
-    if (cc1 > cc2) {
-        fusb_write_byte(cfg, FUSB_SWITCHES1, 0x25);
-        fusb_write_byte(cfg, FUSB_SWITCHES0, 0x07);
-    } else {
-        fusb_write_byte(cfg, FUSB_SWITCHES1, 0x26);
-        fusb_write_byte(cfg, FUSB_SWITCHES0, 0x0B);
+    /* Reset and configure the FUSB302B */
+    cfg->_status0_valid = false;
+    ret = fusb_run_script(cfg, fusb_script_setup);
+    cfg->_mask_profile = fusb_mask_pd;
+
+    /* Select the CC line for BMC signaling.  Nothing could report the end
+     * of the toggling here, so measure BC_LVL. */
+    cfg->_cc = 0;
+    cfg->_toggling = false;
+    if (ret == MSG_OK) {
+        ret = fusb_measure_cc(cfg);
     }
 
     /* Reset the PD logic */
-    fusb_write_byte(cfg, FUSB_RESET, FUSB_RESET_PD_RESET);
+    if (ret == MSG_OK) {
+        ret = fusb_run_script(cfg, fusb_script_pd_reset);
+    }
+
+    i2cReleaseBus(cfg->i2cp);
+
+    return ret;
+}
+
+#if PDB_FUSB_USE_LOW_POWER_DETACH
+msg_t fusb_enter_detached(struct pdb_fusb_config *cfg)
+{
+    msg_t ret;
+
+    i2cAcquireBus(cfg->i2cp);
+
+    /* Only let the end of the toggling through, then power down and start
+     * toggling */
+    ret = fusb_write_masks(cfg, fusb_mask_detached);
+    if (ret == MSG_OK) {
+        ret = fusb_run_script(cfg, fusb_script_detach);
+    }
+    cfg->_status0_valid = false;
+    cfg->_cc = 0;
+    cfg->_toggling = false;
+    FUSB_STAT_LP_DETACH(cfg);
 
     i2cReleaseBus(cfg->i2cp);
+
+    return ret;
 }
+#endif
 
-void fusb_get_status(struct pdb_fusb_config *cfg, union fusb_status *status)
+#if PDB_FUSB_USE_TOGGLE || PDB_FUSB_USE_LOW_POWER_DETACH
+msg_t fusb_attach(struct pdb_fusb_config *cfg)
 {
+    uint8_t togss;
+    msg_t ret;
+    rtcnt_t start = FUSB_STAT_NOW();
+
     i2cAcquireBus(cfg->i2cp);
 
+    ret = fusb_read_byte(cfg, FUSB_STATUS1A, &togss);
+    if (ret != MSG_OK) {
+        i2cReleaseBus(cfg->i2cp);
+        return ret;
+    }
+    togss &= FUSB_STATUS1A_TOGSS;
+    if (togss != FUSB_STATUS1A_TOGSS_SNK1
+            && togss != FUSB_STATUS1A_TOGSS_SNK2) {
+        i2cReleaseBus(cfg->i2cp);
+        return PDB_PHY_DETACHED;
+    }
+
+    /* Power up, and use the CC line the toggling found for BMC signaling
+     * without measuring anything */
+    ret = fusb_run_script(cfg, fusb_script_attach);
+    if (ret == MSG_OK) {
+        ret = fusb_use_cc(cfg, togss == FUSB_STATUS1A_TOGSS_SNK1 ? 1 : 2);
+    }
+
+    /* Get ready to receive the Source_Capabilities */
+    if (ret == MSG_OK) {
+        ret = fusb_write_masks(cfg, fusb_mask_pd);
+    }
+    if (ret == MSG_OK) {
+        ret = fusb_run_script(cfg, fusb_script_reset);
+    }
+    if (ret == MSG_OK) {
+        FUSB_STAT_ORIENT(cfg, true);
+        if (cfg->_toggling) {
+            /* The toggling was started by fusb_update_cc with a source
+             * attached */
+            FUSB_STAT_ORIENT_TOGGLED(cfg);
+        } else {
+            FUSB_STAT_LP_ATTACH(cfg, start);
+        }
+    }
+    cfg->_toggling = false;
+
+    i2cReleaseBus(cfg->i2cp);
+
+    return ret;
+}
+#endif
+
+msg_t fusb_get_status_locked(struct pdb_fusb_config *cfg,
+        union fusb_status *status)
+{
+    msg_t ret;
+
     /* Read the interrupt and status flags into status */
-    fusb_read_buf(cfg, FUSB_STATUS0A, 7, status->bytes);
+    ret = fusb_read_buf(cfg, FUSB_STATUS0A, 7, status->bytes);
+
+    if (ret == MSG_OK) {
+        fusb_cache_status0(cfg, status->status0);
+    }
+
+    return ret;
+}
+
+msg_t fusb_get_status(struct pdb_fusb_config *cfg, union fusb_status *status)
+{
+    msg_t ret;
+
+    i2cAcquireBus(cfg->i2cp);
+
+    ret = fusb_get_status_locked(cfg, status);
 
     i2cReleaseBus(cfg->i2cp);
+
+    return ret;
+}
+
+uint16_t fusb_measure_vbus(struct pdb_fusb_config *cfg)
+{
+    uint8_t mdac = 0;
+    uint8_t test;
+    uint8_t measure;
+    uint8_t status0;
+    uint16_t vbus;
+    msg_t ret = MSG_OK;
+    rtcnt_t start = FUSB_STAT_NOW();
+
+    /* The bus is released while the comparator settles, so two measurements
+     * can't run at once.  Give the last result to the second one. */
+    chSysLock();
+    if (cfg->_vbus_measuring) {
+        vbus = cfg->_vbus;
+        chSysUnlock();
+        return vbus;
+    }
+    cfg->_vbus_measuring = true;
+    chSysUnlock();
+
+    i2cAcquireBus(cfg->i2cp);
+
+    /* Remember the measurement configuration to put it back afterwards */
+    if (cfg->_shadow_valid & (1 << (FUSB_MEASURE - PDB_FUSB_SHADOW_FIRST))) {
+        measure = cfg->_shadow[FUSB_MEASURE - PDB_FUSB_SHADOW_FIRST];
+    } else if (fusb_read_byte(cfg, FUSB_MEASURE, &measure) != MSG_OK) {
+        i2cReleaseBus(cfg->i2cp);
+        cfg->_vbus_measuring = false;
+        return 0;
+    }
+
+    /* Find the highest MDAC value VBUS is above, one bit at a time.  COMP is
+     * set when VBUS is above (MDAC + 1) * 420 mV. */
+    for (int8_t bit = 5; bit >= 0 && ret == MSG_OK; bit--) {
+        test = mdac | (1 << bit);
+        ret = fusb_write_byte(cfg, FUSB_MEASURE, FUSB_MEASURE_MEAS_VBUS | test);
+        if (ret != MSG_OK) {
+            break;
+        }
+
+        /* Let the comparator settle without keeping the bus */
+        i2cReleaseBus(cfg->i2cp);
+        chThdSleepMicroseconds(PDB_FUSB_MDAC_SETTLE_US);
+        i2cAcquireBus(cfg->i2cp);
+
+        ret = fusb_read_byte(cfg, FUSB_STATUS0, &status0);
+        if (ret == MSG_OK && (status0 & FUSB_STATUS0_COMP)) {
+            mdac = test;
+        }
+    }
+
+    /* Put the measurement configuration back even if the search failed */
+    if (fusb_write_byte(cfg, FUSB_MEASURE, measure) != MSG_OK) {
+        ret = MSG_RESET;
+    }
+
+    i2cReleaseBus(cfg->i2cp);
+
+    /* Don't keep a measurement we couldn't finish */
+    if (ret != MSG_OK) {
+        cfg->_vbus_measuring = false;
+        return 0;
+    }
+
+    /* VBUS is between the thresholds of mdac and mdac + 1, so take the middle.
+     * Below the second threshold, we can't tell if there's VBUS at all. */
+    if (mdac == 0) {
+        vbus = 0;
+    } else {
+        vbus = (mdac + 1) * FUSB_MEASURE_VBUS_LSB_MV
+            + FUSB_MEASURE_VBUS_LSB_MV / 2;
+    }
+
+    chSysLock();
+    cfg->_vbus = vbus;
+    cfg->_vbus_time = chVTGetSystemTimeX();
+    cfg->_vbus_valid = true;
+    cfg->_vbus_measuring = false;
+    chSysUnlock();
+    FUSB_STAT_VBUS(cfg, start);
+
+    return vbus;
+}
+
+uint16_t fusb_get_vbus(struct pdb_fusb_config *cfg)
+{
+    uint16_t vbus;
+    bool fresh;
+
+    chSysLock();
+    vbus = cfg->_vbus;
+    fresh = cfg->_vbus_valid
+        && chVTTimeElapsedSinceX(cfg->_vbus_time)
+            <= TIME_MS2I(PDB_VBUS_MAX_AGE_MS);
+    chSysUnlock();
+
+    if (!fresh) {
+        vbus = fusb_measure_vbus(cfg);
+    }
+
+    return vbus;
+}
+
+void fusb_cache_status(struct pdb_fusb_config *cfg,
+        const union fusb_status *status)
+{
+    fusb_cache_status0(cfg, status->status0);
 }
 
 enum fusb_typec_current fusb_get_typec_current(struct pdb_fusb_config *cfg)
 {
+    uint8_t status0;
+    bool fresh;
+    msg_t ret;
+
+    /* Use the STATUS0 of the last status read if it's recent enough */
+    chSysLock();
+    status0 = cfg->_status0;
+    fresh = cfg->_status0_valid && chVTTimeElapsedSinceX(cfg->_status0_time)
+        <= TIME_US2I(PDB_FUSB_STATUS_MAX_AGE_US);
+    chSysUnlock();
+    FUSB_STAT_STATUS0(cfg, fresh);
+
+    if (!fresh) {
+        i2cAcquireBus(cfg->i2cp);
+
+        ret = fusb_read_byte(cfg, FUSB_STATUS0, &status0);
+
+        i2cReleaseBus(cfg->i2cp);
+
+        if (ret != MSG_OK) {
+            return fusb_tcc_none;
+        }
+        fusb_cache_status0(cfg, status0);
+    }
+
+    return status0 & FUSB_STATUS0_BC_LVL;
+}
+
+msg_t fusb_reset(struct pdb_fusb_config *cfg)
+{
+    msg_t ret;
+
     i2cAcquireBus(cfg->i2cp);
 
-    /* Read the BC_LVL into a variable */
-    enum fusb_typec_current bc_lvl = fusb_read_byte(cfg, FUSB_STATUS0)
-        & FUSB_STATUS0_BC_LVL;
+    /* Flush the FIFOs and reset the PD logic */
+    ret = fusb_run_script(cfg, fusb_script_reset);
 
     i2cReleaseBus(cfg->i2cp);
 
-    return bc_lvl;
+    return ret;
 }
 
-void fusb_reset(struct pdb_fusb_config *cfg)
+msg_t fusb_flush_tx(struct pdb_fusb_config *cfg)
 {
+    msg_t ret;
+
     i2cAcquireBus(cfg->i2cp);
 
-    /* Flush the TX buffer */
-    fusb_write_byte(cfg, FUSB_CONTROL0, 0x44);
-    /* Flush the RX buffer */
-    fusb_write_byte(cfg, FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH);
-    /* Reset the PD logic */
-    fusb_write_byte(cfg, FUSB_RESET, FUSB_RESET_PD_RESET);
+    /* Flush the TX FIFO, leaving the received messages alone */
+    ret = fusb_run_script(cfg, fusb_script_tx_flush);
+
+    i2cReleaseBus(cfg->i2cp);
+
+    return ret;
+}
+
+msg_t fusb_set_mask_profile(struct pdb_fusb_config *cfg,
+        enum fusb_mask_profile profile)
+{
+    msg_t ret;
+
+    if (cfg->_mask_profile == profile) {
+        return MSG_OK;
+    }
+
+    i2cAcquireBus(cfg->i2cp);
+
+    ret = fusb_write_masks(cfg, profile);
+
+    i2cReleaseBus(cfg->i2cp);
+
+    return ret;
+}
+
+uint8_t fusb_count_masked_irqs(struct pdb_fusb_config *cfg,
+        const union fusb_status *status)
+{
+    const uint8_t *masks = fusb_mask_profiles[cfg->_mask_profile];
+
+    return __builtin_popcount(status->interrupt & masks[0])
+        + __builtin_popcount(status->interrupta & masks[1])
+        + __builtin_popcount(status->interruptb & masks[2]);
+}
+
+#if PDB_FUSB_USE_ASYNC
+/*
+ * FUSB302B bus thread, doing the queued transfers one after the other
+ */
+static THD_FUNCTION(FUSBBus, vcfg) {
+
+    chRegSetThreadName("USB_PD-FUSB_bus");
+    struct pdb_fusb_config *cfg = vcfg;
+
+    struct fusb_xfer *xfer;
+
+    while (true) {
+        chMBFetchTimeout(&cfg->_xfer_mailbox, (msg_t *) &xfer, TIME_INFINITE);
+
+        i2cAcquireBus(cfg->i2cp);
+        xfer->result = fusb_transfer_for(cfg,
+                xfer->thread != NULL ? xfer->thread : chThdGetSelfX(),
+                xfer->txbuf, xfer->txbytes, xfer->rxbuf, xfer->rxbytes);
+        i2cReleaseBus(cfg->i2cp);
+        FUSB_STAT_XFER(cfg, xfer);
+
+        /* The transfer can be queued again from its completion */
+        xfer->_busy = false;
+        if (xfer->callback != NULL) {
+            xfer->callback(cfg, xfer);
+        }
+        if (xfer->thread != NULL) {
+            chEvtSignal(xfer->thread, xfer->events);
+        }
+    }
+}
+
+void fusb_run_async(struct pdb_fusb_config *cfg)
+{
+    /* Initialize the mailbox before anyone can queue a transfer */
+    chMBObjectInit(&cfg->_xfer_mailbox, cfg->_xfer_mailbox_queue,
+            PDB_FUSB_XFER_QUEUE_SIZE);
+
+    cfg->_thread = chThdCreateStatic(cfg->_wa, sizeof(cfg->_wa), PDB_PRIO_FUSB,
+            FUSBBus, cfg);
+}
+
+void fusb_xfer_read_init(struct fusb_xfer *xfer, uint8_t reg, uint8_t *buf,
+        size_t len)
+{
+    xfer->_reg = reg;
+    xfer->txbuf = &xfer->_reg;
+    xfer->txbytes = 1;
+    xfer->rxbuf = buf;
+    xfer->rxbytes = len;
+}
+
+void fusb_xfer_write_init(struct fusb_xfer *xfer, const uint8_t *frame,
+        size_t len)
+{
+    xfer->txbuf = frame;
+    xfer->txbytes = len;
+    xfer->rxbuf = NULL;
+    xfer->rxbytes = 0;
+}
+
+bool fusb_xfer_submitI(struct pdb_fusb_config *cfg, struct fusb_xfer *xfer)
+{
+    chDbgCheckClassI();
+
+    if (xfer->_busy) {
+        return false;
+    }
+    if (chMBPostI(&cfg->_xfer_mailbox, (msg_t) xfer) != MSG_OK) {
+        return false;
+    }
+    xfer->_busy = true;
+    FUSB_STAT_XFER_QUEUED(xfer);
+
+    return true;
+}
+
+bool fusb_xfer_submit(struct pdb_fusb_config *cfg, struct fusb_xfer *xfer)
+{
+    bool queued;
+
+    chSysLock();
+    queued = fusb_xfer_submitI(cfg, xfer);
+    /* The bus thread may have been made ready */
+    chSchRescheduleS();
+    chSysUnlock();
+
+    return queued;
+}
+#endif
+
+#if PDB_FUSB_USE_TRACE
+void fusb_trace_phase(struct pdb_fusb_config *cfg, enum fusb_trace_phase phase)
+{
+    chSysLock();
+    if (cfg->trace._phase != phase) {
+        fusb_trace_mark(&cfg->trace, chSysGetRealtimeCounterX());
+        cfg->trace._phase = phase;
+    }
+    chSysUnlock();
+}
+
+bool pdb_fusb_trace_get(const struct pdb_fusb_config *cfg, uint32_t seq,
+        struct pdb_fusb_trace_entry *entry)
+{
+    const struct pdb_fusb_trace_entry *slot =
+        &cfg->trace._ring[seq & (PDB_FUSB_TRACE_LEN - 1)];
+
+    if (seq == 0 || slot->seq != seq) {
+        return false;
+    }
+    __sync_synchronize();
+    memcpy(entry, slot, sizeof (*entry));
+    __sync_synchronize();
+
+    /* If the entry was overwritten meanwhile, the copy may be torn */
+    return slot->seq == seq;
+}
+
+uint32_t pdb_fusb_trace_last(const struct pdb_fusb_config *cfg)
+{
+    return cfg->trace._seq;
+}
+
+void pdb_fusb_trace_totals(struct pdb_fusb_config *cfg,
+        struct pdb_fusb_trace_totals *totals)
+{
+    chSysLock();
+    fusb_trace_mark(&cfg->trace, chSysGetRealtimeCounterX());
+    memcpy(totals, &cfg->trace._totals, sizeof (*totals));
+    chSysUnlock();
+}
+
+void pdb_fusb_trace_reset(struct pdb_fusb_config *cfg)
+{
+    /* Keep the writers out while the ring is cleared */
+    i2cAcquireBus(cfg->i2cp);
+
+    memset(cfg->trace._ring, 0, sizeof (cfg->trace._ring));
+    chSysLock();
+    cfg->trace._seq = 0;
+    memset(&cfg->trace._totals, 0, sizeof (cfg->trace._totals));
+    cfg->trace._phase_mark = chSysGetRealtimeCounterX();
+    chSysUnlock();
 
     i2cReleaseBus(cfg->i2cp);
 }
+#endif
@@ -65,6 +65,8 @@
 #define FUSB_MEASURE_MEAS_VBUS (1 << 6)
 #define FUSB_MEASURE_MDAC_SHIFT 0
 #define FUSB_MEASURE_MDAC (0x3F << FUSB_MEASURE_MDAC_SHIFT)
+/* MDAC step when measuring VBUS, in millivolts */
+#define FUSB_MEASURE_VBUS_LSB_MV 420
 
 /* Slice register */
 #define FUSB_SLICE 0x05
@@ -94,11 +96,12 @@
 /* Control2 register */
 #define FUSB_CONTROL2 0x08
 #define FUSB_CONTROL2_TOG_SAVE_PWR_SHIFT 6
-#define FUSB_CONTROL2_TOG_SAVE_PWR (0x3 << FUSB_CONTROL2_TOG_SAVE_PWR)
+#define FUSB_CONTROL2_TOG_SAVE_PWR (0x3 << FUSB_CONTROL2_TOG_SAVE_PWR_SHIFT)
 #define FUSB_CONTROL2_TOG_RD_ONLY (1 << 5)
 #define FUSB_CONTROL2_WAKE_EN (1 << 3)
 #define FUSB_CONTROL2_MODE_SHIFT 1
 #define FUSB_CONTROL2_MODE (0x3 << FUSB_CONTROL2_MODE_SHIFT)
+#define FUSB_CONTROL2_MODE_SNK (0x2 << FUSB_CONTROL2_MODE_SHIFT)
 #define FUSB_CONTROL2_TOGGLE 1
 
 /* Control3 register */
@@ -172,6 +175,8 @@
 #define FUSB_STATUS1A 0x3D
 #define FUSB_STATUS1A_TOGSS_SHIFT 3
 #define FUSB_STATUS1A_TOGSS (0x7 << FUSB_STATUS1A_TOGSS_SHIFT)
+#define FUSB_STATUS1A_TOGSS_SNK1 (0x5 << FUSB_STATUS1A_TOGSS_SHIFT)
+#define FUSB_STATUS1A_TOGSS_SNK2 (0x6 << FUSB_STATUS1A_TOGSS_SHIFT)
 #define FUSB_STATUS1A_RXSOP2DB (1 << 2)
 #define FUSB_STATUS1A_RXSOP1DB (1 << 1)
 #define FUSB_STATUS1A_RXSOP 1
@@ -228,6 +233,13 @@
 #define FUSB_FIFOS 0x43
 
 #define FUSB_FIFO_TX_TXON 0xA1
+
+/* Length of the token sequences around a message in the TX FIFO */
+#define FUSB_TX_SOP_LEN 5
+#define FUSB_TX_EOP_LEN 4
+
+/* Longest block of registers written in one transaction */
+#define FUSB_WRITE_BUF_MAX 16
 #define FUSB_FIFO_TX_SOP1 0x12
 #define FUSB_FIFO_TX_SOP2 0x13
 #define FUSB_FIFO_TX_SOP3 0x1B
@@ -266,47 +278,213 @@ union fusb_status {
 };
 
 
-/* FUSB functions */
+/*
+ * FUSB functions
+ *
+ * Functions returning a msg_t return MSG_OK on success, or the error of the
+ * first I2C transfer that failed.
+ */
 
 /*
  * Send a USB Power Delivery message to the FUSB302B
+ *
+ * The transmit frame is built in place around the message, overwriting the
+ * headroom of msg and the bytes following the message.
  */
-void fusb_send_message(struct pdb_fusb_config *cfg, const union pd_msg *msg);
+msg_t fusb_send_message(struct pdb_fusb_config *cfg, union pd_msg *msg);
 
 /*
  * Read a USB Power Delivery message from the FUSB302B
+ *
+ * Returns 0 on success, or nonzero if there was no message or it couldn't be
+ * read.
  */
 uint8_t fusb_read_message(struct pdb_fusb_config *cfg, union pd_msg *msg);
 
+/*
+ * Read the header of a USB Power Delivery message from the FUSB302B
+ *
+ * The first data object, or the CRC of a control message, is read along with
+ * it in the same transaction.  The rest of the message stays in the RX FIFO
+ * and must be read with fusb_read_rest.
+ *
+ * Returns 0 on success, or nonzero if there was no message or it couldn't be
+ * read.
+ */
+uint8_t fusb_read_header(struct pdb_fusb_config *cfg, union pd_msg *msg);
+
+/*
+ * Read the rest of the message whose header was read into msg with
+ * fusb_read_header
+ *
+ * Returns 0 on success, or nonzero if it couldn't be read.
+ */
+uint8_t fusb_read_rest(struct pdb_fusb_config *cfg, union pd_msg *msg);
+
+/*
+ * Return whether the FUSB302B RX FIFO holds another message
+ *
+ * Returns false if STATUS1 couldn't be read.
+ */
+bool fusb_rx_pending(struct pdb_fusb_config *cfg);
+
 /*
  * Tell the FUSB302B to send a hard reset signal
  */
-void fusb_send_hardrst(struct pdb_fusb_config *cfg);
+msg_t fusb_send_hardrst(struct pdb_fusb_config *cfg);
 
 /*
  * Read the FUSB302B status and interrupt flags into *status
+ *
+ * *status is undefined if the read failed.
  */
-void fusb_get_status(struct pdb_fusb_config *cfg, union fusb_status *status);
+msg_t fusb_get_status(struct pdb_fusb_config *cfg, union fusb_status *status);
+
+/*
+ * Same as fusb_get_status, but the I2C bus must already be acquired
+ */
+msg_t fusb_get_status_locked(struct pdb_fusb_config *cfg,
+        union fusb_status *status);
 
 /*
  * Read the FUSB302B BC_LVL as an enum fusb_typec_current
+ *
+ * The STATUS0 register from the last status read is used if it isn't older
+ * than PDB_FUSB_STATUS_MAX_AGE_US.  Returns fusb_tcc_none if STATUS0
+ * couldn't be read.
  */
 enum fusb_typec_current fusb_get_typec_current(struct pdb_fusb_config *cfg);
 
 /*
  * Test the CC lines and configure the good one to communicate
+ *
+ * If the source is still on the line in use, it's kept.  Otherwise, with
+ * PDB_FUSB_USE_TOGGLE, the sink toggling is started and PDB_PHY_TOGGLING is
+ * returned: the line is found when I_TOGDONE is reported, and selected by
+ * fusb_attach.  Without it, BC_LVL is measured on both lines.
  */
-void fusb_update_cc(struct pdb_fusb_config *cfg);
+msg_t fusb_update_cc(struct pdb_fusb_config *cfg);
 
 /*
  * Initialization routine for the FUSB302B
  */
-void fusb_setup(struct pdb_fusb_config *);
+msg_t fusb_setup(struct pdb_fusb_config *);
 
 /*
  * Reset the FUSB302B
  */
-void fusb_reset(struct pdb_fusb_config *cfg);
+msg_t fusb_reset(struct pdb_fusb_config *cfg);
+
+/*
+ * Flush the TX FIFO of the FUSB302B
+ */
+msg_t fusb_flush_tx(struct pdb_fusb_config *cfg);
+
+#if PDB_FUSB_USE_ASYNC
+/*
+ * Start the FUSB302B bus thread, which does the asynchronous transfers
+ */
+void fusb_run_async(struct pdb_fusb_config *cfg);
+
+/*
+ * Prepare an asynchronous read of len bytes from the register reg into buf
+ */
+void fusb_xfer_read_init(struct fusb_xfer *xfer, uint8_t reg, uint8_t *buf,
+        size_t len);
+
+/*
+ * Prepare an asynchronous write of len bytes from frame, whose first byte is
+ * the register address
+ */
+void fusb_xfer_write_init(struct fusb_xfer *xfer, const uint8_t *frame,
+        size_t len);
+
+/*
+ * Queue an asynchronous transfer
+ *
+ * Returns false if the transfer is already queued or if the queue is full.
+ */
+bool fusb_xfer_submit(struct pdb_fusb_config *cfg, struct fusb_xfer *xfer);
+
+/*
+ * Queue an asynchronous transfer from an ISR or with the system locked
+ *
+ * Returns false if the transfer is already queued or if the queue is full.
+ */
+bool fusb_xfer_submitI(struct pdb_fusb_config *cfg, struct fusb_xfer *xfer);
+#endif
+
+#if PDB_FUSB_USE_LOW_POWER_DETACH
+/*
+ * Power the FUSB302B down to its wake circuit and start the sink toggling
+ *
+ * Only I_TOGDONE is unmasked until fusb_attach succeeds.
+ */
+msg_t fusb_enter_detached(struct pdb_fusb_config *cfg);
+
+#endif
+
+#if PDB_FUSB_USE_TOGGLE || PDB_FUSB_USE_LOW_POWER_DETACH
+/*
+ * Handle the end of the sink toggling started by fusb_enter_detached or
+ * fusb_update_cc
+ *
+ * If a source was found, power the FUSB302B up, select the CC line the
+ * toggling found, and get ready to receive PD messages.
+ *
+ * Returns MSG_OK if a source was found, PDB_PHY_DETACHED if none was, in
+ * which case the FUSB302B is left as it was, or the error of the first
+ * failed transfer.
+ */
+msg_t fusb_attach(struct pdb_fusb_config *cfg);
+#endif
+
+/*
+ * Switch the FUSB302B to the given interrupt mask profile
+ *
+ * Does nothing if the profile is already in use.
+ */
+msg_t fusb_set_mask_profile(struct pdb_fusb_config *cfg,
+        enum fusb_mask_profile profile);
+
+#if PDB_FUSB_USE_TRACE
+/*
+ * Account the following I2C transactions to the given negotiation phase
+ */
+void fusb_trace_phase(struct pdb_fusb_config *cfg, enum fusb_trace_phase phase);
+#endif
+
+/*
+ * Measure VBUS with the MDAC comparator
+ *
+ * Does a binary search of the MDAC in six steps.  The I2C bus is released
+ * while the comparator settles.
+ *
+ * Returns the voltage in millivolts, or 0 if VBUS is below 0.84 V or the
+ * measurement failed.
+ */
+uint16_t fusb_measure_vbus(struct pdb_fusb_config *cfg);
+
+/*
+ * Get VBUS in millivolts
+ *
+ * The last measurement is used if it isn't older than PDB_VBUS_MAX_AGE_MS.
+ * Otherwise, VBUS is measured again.
+ */
+uint16_t fusb_get_vbus(struct pdb_fusb_config *cfg);
+
+/*
+ * Remember the STATUS0 register of a status read done elsewhere
+ */
+void fusb_cache_status(struct pdb_fusb_config *cfg,
+        const union fusb_status *status);
+
+/*
+ * Count the interrupt flags set in *status that are masked by the current
+ * mask profile.  Each of them would have asserted INT_N if unmasked.
+ */
+uint8_t fusb_count_masked_irqs(struct pdb_fusb_config *cfg,
+        const union fusb_status *status);
 
 
 #endif /* PDB_FUSB302B_H */
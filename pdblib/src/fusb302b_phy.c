@@ -0,0 +1,185 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pdb_phy.h>
+
+#include <pdb.h>
+#include "fusb302b.h"
+
+
+/*
+ * FUSB302B PHY operations, forwarding to the fusb_* functions with the
+ * FUSB302B configuration of the port
+ */
+
+static msg_t fusb_phy_setup(struct pdb_config *cfg)
+{
+#if PDB_FUSB_USE_ASYNC
+    /* Create the FUSB302B bus thread, unless this is a PHY reset and it's
+     * already running. */
+    if (cfg->fusb._thread == NULL) {
+        fusb_run_async(&cfg->fusb);
+    }
+#endif
+    return fusb_setup(&cfg->fusb);
+}
+
+static msg_t fusb_phy_send_message(struct pdb_config *cfg, union pd_msg *msg)
+{
+    return fusb_send_message(&cfg->fusb, msg);
+}
+
+static uint8_t fusb_phy_read_message(struct pdb_config *cfg,
+        union pd_msg *msg)
+{
+    return fusb_read_message(&cfg->fusb, msg);
+}
+
+static uint8_t fusb_phy_read_header(struct pdb_config *cfg,
+        union pd_msg *msg)
+{
+    return fusb_read_header(&cfg->fusb, msg);
+}
+
+static uint8_t fusb_phy_read_rest(struct pdb_config *cfg, union pd_msg *msg)
+{
+    return fusb_read_rest(&cfg->fusb, msg);
+}
+
+static bool fusb_phy_rx_pending(struct pdb_config *cfg)
+{
+    return fusb_rx_pending(&cfg->fusb);
+}
+
+static msg_t fusb_phy_send_hardrst(struct pdb_config *cfg)
+{
+    return fusb_send_hardrst(&cfg->fusb);
+}
+
+static msg_t fusb_phy_get_status(struct pdb_config *cfg,
+        union fusb_status *status)
+{
+    return fusb_get_status(&cfg->fusb, status);
+}
+
+static msg_t fusb_phy_get_status_locked(struct pdb_config *cfg,
+        union fusb_status *status)
+{
+    return fusb_get_status_locked(&cfg->fusb, status);
+}
+
+static msg_t fusb_phy_update_cc(struct pdb_config *cfg)
+{
+    return fusb_update_cc(&cfg->fusb);
+}
+
+static enum fusb_typec_current fusb_phy_get_typec_current(
+        struct pdb_config *cfg)
+{
+    return fusb_get_typec_current(&cfg->fusb);
+}
+
+static msg_t fusb_phy_reset(struct pdb_config *cfg)
+{
+    return fusb_reset(&cfg->fusb);
+}
+
+static msg_t fusb_phy_flush_tx(struct pdb_config *cfg)
+{
+    return fusb_flush_tx(&cfg->fusb);
+}
+
+static msg_t fusb_phy_set_mask_profile(struct pdb_config *cfg,
+        enum fusb_mask_profile profile)
+{
+    return fusb_set_mask_profile(&cfg->fusb, profile);
+}
+
+static uint8_t fusb_phy_count_masked_irqs(struct pdb_config *cfg,
+        const union fusb_status *status)
+{
+    return fusb_count_masked_irqs(&cfg->fusb, status);
+}
+
+static uint16_t fusb_phy_measure_vbus(struct pdb_config *cfg)
+{
+    return fusb_measure_vbus(&cfg->fusb);
+}
+
+static uint16_t fusb_phy_get_vbus(struct pdb_config *cfg)
+{
+    return fusb_get_vbus(&cfg->fusb);
+}
+
+#if PDB_FUSB_USE_LOW_POWER_DETACH
+static msg_t fusb_phy_enter_detached(struct pdb_config *cfg)
+{
+    return fusb_enter_detached(&cfg->fusb);
+}
+#endif
+
+#if PDB_FUSB_USE_TOGGLE || PDB_FUSB_USE_LOW_POWER_DETACH
+static msg_t fusb_phy_attach(struct pdb_config *cfg)
+{
+    return fusb_attach(&cfg->fusb);
+}
+#endif
+
+#if PDB_FUSB_USE_TRACE
+static void fusb_phy_set_phase(struct pdb_config *cfg,
+        enum fusb_trace_phase phase)
+{
+    fusb_trace_phase(&cfg->fusb, phase);
+}
+#endif
+
+const struct pdb_phy_ops pdb_fusb302b_phy = {
+    .setup = fusb_phy_setup,
+    .send_message = fusb_phy_send_message,
+    .read_message = fusb_phy_read_message,
+    .read_header = fusb_phy_read_header,
+    .read_rest = fusb_phy_read_rest,
+    .rx_pending = fusb_phy_rx_pending,
+    .read_goodcrc = NULL,
+    .send_hardrst = fusb_phy_send_hardrst,
+    .get_status = fusb_phy_get_status,
+    .get_status_locked = fusb_phy_get_status_locked,
+    .int_n_asserted = NULL,
+    .update_cc = fusb_phy_update_cc,
+    .get_typec_current = fusb_phy_get_typec_current,
+    .reset = fusb_phy_reset,
+    .flush_tx = fusb_phy_flush_tx,
+    .set_mask_profile = fusb_phy_set_mask_profile,
+    .count_masked_irqs = fusb_phy_count_masked_irqs,
+    .measure_vbus = fusb_phy_measure_vbus,
+    .get_vbus = fusb_phy_get_vbus,
+#if PDB_FUSB_USE_LOW_POWER_DETACH
+    .enter_detached = fusb_phy_enter_detached,
+#else
+    .enter_detached = NULL,
+#endif
+#if PDB_FUSB_USE_TOGGLE || PDB_FUSB_USE_LOW_POWER_DETACH
+    .attach = fusb_phy_attach,
+#else
+    .attach = NULL,
+#endif
+#if PDB_FUSB_USE_TRACE
+    .set_phase = fusb_phy_set_phase
+#else
+    .set_phase = NULL
+#endif
+};
@@ -27,6 +27,7 @@
 #include "policy_engine.h"
 #include "protocol_rx.h"
 #include "protocol_tx.h"
+#include "int_n.h"
 #include "fusb302b.h"
 
 
@@ -50,7 +51,14 @@ static enum hardrst_state hardrst_reset_layer(struct pdb_config *cfg)
 {
     /* First, wait for the signal to run a hard reset. */
     eventmask_t evt = chEvtWaitAny(PDB_EVT_HARDRST_RESET
-            | PDB_EVT_HARDRST_I_HARDRST);
+            | PDB_EVT_HARDRST_I_HARDRST | PDB_EVT_HARDRST_PHY_RESET);
+
+    /* If the PHY stopped answering, set it up again before anything else.
+     * That's done here rather than by the INT_N thread, whose stack is only
+     * big enough for reading the status. */
+    if (evt & PDB_EVT_HARDRST_PHY_RESET) {
+        cfg->phy->setup(cfg);
+    }
 
     /* Reset the stored message IDs */
     cfg->prl._rx_messageid = 0;
@@ -69,7 +77,11 @@ static enum hardrst_state hardrst_reset_layer(struct pdb_config *cfg)
         /* Policy Engine started the reset. */
         return PRLHRRequestHardReset;
     } else {
-        /* PHY started the reset */
+        /* PHY started the reset, or lost what we were doing when it was set
+         * up again */
+        if (evt & PDB_EVT_HARDRST_I_HARDRST) {
+            PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_HARDRST);
+        }
         return PRLHRIndicateHardReset;
     }
 }
@@ -84,18 +96,20 @@ static enum hardrst_state hardrst_indicate_hard_reset(struct pdb_config *cfg)
 
 static enum hardrst_state hardrst_request_hard_reset(struct pdb_config *cfg)
 {
-    (void) cfg;
+    /* Poll INT_N faster so I_HARDSENT is seen within tHardResetComplete */
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_FAST);
     /* Tell the PHY to send a hard reset */
-    fusb_send_hardrst(&cfg->fusb);
+    cfg->phy->send_hardrst(cfg);
 
     return PRLHRWaitPHY;
 }
 
 static enum hardrst_state hardrst_wait_phy(struct pdb_config *cfg)
 {
-    (void) cfg;
     /* Wait for the PHY to tell us that it's done sending the hard reset */
-    chEvtWaitAnyTimeout(PDB_EVT_HARDRST_I_HARDSENT, PD_T_HARD_RESET_COMPLETE);
+    if (chEvtWaitAnyTimeout(PDB_EVT_HARDRST_I_HARDSENT, PD_T_HARD_RESET_COMPLETE)) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_HARDSENT);
+    }
 
     /* Move on no matter what made us stop waiting. */
     return PRLHRHardResetRequested;
@@ -129,7 +143,6 @@ static enum hardrst_state hardrst_complete(struct pdb_config *cfg)
 /*
  * Hard Reset state machine thread
  */
-static THD_WORKING_AREA(_hardrst_wa, PDB_HARDRST_WA_SIZE);
 static THD_FUNCTION(HardReset, cfg) {
     chRegSetThreadName("USB_PD-HardReset_Manager");
 
@@ -168,6 +181,6 @@ static THD_FUNCTION(HardReset, cfg) {
 
 void pdb_hardrst_run(struct pdb_config *cfg)
 {
-    cfg->prl.hardrst_thread = chThdCreateStatic(_hardrst_wa,
-            sizeof(_hardrst_wa), PDB_PRIO_PRL, HardReset, cfg);
+    cfg->prl.hardrst_thread = chThdCreateStatic(cfg->prl._hardrst_wa,
+            sizeof(cfg->prl._hardrst_wa), PDB_PRIO_PRL, HardReset, cfg);
 }
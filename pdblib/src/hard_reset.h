@@ -28,6 +28,7 @@
 #define PDB_EVT_HARDRST_I_HARDRST EVENT_MASK(1)
 #define PDB_EVT_HARDRST_I_HARDSENT EVENT_MASK(2)
 #define PDB_EVT_HARDRST_DONE EVENT_MASK(3)
+#define PDB_EVT_HARDRST_PHY_RESET EVENT_MASK(4)
 
 /*
  * Start the Hard Reset thread
@@ -0,0 +1,75 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "i2c.h"
+
+#include <ch.h>
+#include <hal.h>
+
+#include "sim_tcpci.h"
+
+
+#if PDB_USE_STATS
+#define I2C_STAT_NOW() pdb_stats_now()
+#define I2C_STAT_RECOVERY(stats, start) \
+    pdb_hist_add(&(stats)->recovery_time, start)
+#else
+#define I2C_STAT_NOW() 0
+#define I2C_STAT_RECOVERY(stats, start) do {(void) (start);} while (0)
+#endif
+
+
+msg_t pdb_i2c_transfer(I2CDriver *i2cp, i2caddr_t addr,
+        const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes,
+        struct pdb_i2c_stats *stats)
+{
+    sysinterval_t budget = TIME_US2I(PDB_I2C_TIMEOUT_US
+            + (txbytes + rxbytes) * PDB_I2C_TIMEOUT_BYTE_US);
+    msg_t ret;
+
+#if PDB_USE_SIM_PHY
+    /* The register model of a TCPC answers on its own driver */
+    if (pdb_sim_tcpc_transfer(i2cp, txbuf, txbytes, rxbuf, rxbytes, &ret)) {
+        return ret;
+    }
+#endif
+
+    ret = i2cMasterTransmitTimeout(i2cp, addr, txbuf, txbytes, rxbuf,
+            rxbytes, budget);
+    if (ret == MSG_OK) {
+        return MSG_OK;
+    }
+
+    if (ret == MSG_TIMEOUT) {
+        stats->timeouts++;
+
+        /* The driver is locked after a timeout, and must be restarted before
+         * it can be used again */
+        rtcnt_t start = I2C_STAT_NOW();
+        const I2CConfig *config = i2cp->config;
+        i2cStop(i2cp);
+        i2cStart(i2cp, config);
+        stats->recoveries++;
+        I2C_STAT_RECOVERY(stats, start);
+    } else if (i2cGetErrors(i2cp) & I2C_ACK_FAILURE) {
+        stats->nacks++;
+    } else {
+        stats->errors++;
+    }
+
+    return ret;
+}
@@ -0,0 +1,45 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_I2C_INT_H
+#define PDB_I2C_INT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hal.h>
+
+#include <pdb_i2c.h>
+
+
+/*
+ * Do an I2C transfer within a time budget
+ *
+ * The budget is PDB_I2C_TIMEOUT_US plus PDB_I2C_TIMEOUT_BYTE_US for each
+ * byte transferred.  The I2C bus must already be acquired.  If the transfer
+ * times out, the I2C driver is restarted so that the next transfer can be
+ * tried.  Failures are counted in *stats.
+ *
+ * Returns MSG_OK on success, MSG_TIMEOUT if the budget ran out, or MSG_RESET
+ * on a bus error or NACK.
+ */
+msg_t pdb_i2c_transfer(I2CDriver *i2cp, i2caddr_t addr,
+        const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes,
+        struct pdb_i2c_stats *stats);
+
+
+#endif /* PDB_I2C_INT_H */
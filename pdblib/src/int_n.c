@@ -22,6 +22,8 @@
 
 #include "int_n.h"
 
+#include <string.h>
+
 #include <ch.h>
 #include <hal.h>
 
@@ -34,65 +36,667 @@
 #include "policy_engine.h"
 
 
+#if PDB_USE_STATS
 /*
- * INT_N polling thread
+ * Record that INT_N was seen asserted
+ */
+static void int_n_stat_asserted(struct pdb_config *cfg)
+{
+    cfg->int_n.stats._asserted = pdb_stats_now();
+}
+
+/*
+ * Record that the event of src is about to be signaled
+ */
+static void int_n_stat_signal(struct pdb_config *cfg, enum pdb_int_n_src src)
+{
+    struct pdb_int_n_stats *stats = &cfg->int_n.stats;
+
+    stats->count[src]++;
+    pdb_hist_add(&stats->signal_latency[src], stats->_asserted);
+    /* Never store 0, it means no event is pending */
+    stats->_signaled[src] = pdb_stats_now() | 1;
+}
+
+void pdb_int_n_stat_wakeup(struct pdb_config *cfg, enum pdb_int_n_src src)
+{
+    struct pdb_int_n_stats *stats = &cfg->int_n.stats;
+
+    if (stats->_signaled[src] != 0) {
+        pdb_hist_add(&stats->wakeup_latency[src], stats->_signaled[src]);
+        stats->_signaled[src] = 0;
+    }
+}
+
+/*
+ * Record a read of the FUSB302B status
+ */
+static void int_n_stat_status_read(struct pdb_config *cfg,
+        const union fusb_status *status)
+{
+    struct pdb_int_n_stats *stats = &cfg->int_n.stats;
+
+    stats->status_reads++;
+    if (cfg->phy->count_masked_irqs != NULL) {
+        stats->masked_irqs += cfg->phy->count_masked_irqs(cfg, status);
+    }
+    if (!(status->interruptb & FUSB_INTERRUPTB_I_GCRCSENT)
+            && !(status->interrupta & (FUSB_INTERRUPTA_I_RETRYFAIL
+                    | FUSB_INTERRUPTA_I_TXSENT | FUSB_INTERRUPTA_I_HARDRST
+                    | FUSB_INTERRUPTA_I_HARDSENT))
+            && !(status->interrupta & FUSB_INTERRUPTA_I_OCP_TEMP
+                && status->status1 & FUSB_STATUS1_OVRTEMP)) {
+        stats->spurious_reads++;
+    }
+}
+
+#define INT_N_STAT_ASSERTED(cfg) int_n_stat_asserted(cfg)
+#define INT_N_STAT_STATUS_READ(cfg, status) int_n_stat_status_read(cfg, status)
+#define INT_N_STAT_SIGNAL(cfg, src) int_n_stat_signal(cfg, src)
+#else
+#define INT_N_STAT_ASSERTED(cfg) do {} while (0)
+#define INT_N_STAT_STATUS_READ(cfg, status) do {} while (0)
+#define INT_N_STAT_SIGNAL(cfg, src) do {} while (0)
+#endif
+
+/*
+ * Threads the INT_N thread sends events to, in the order they're signaled
+ */
+enum int_n_target {
+    INT_N_TARGET_HARDRST = 0,
+    INT_N_TARGET_PRLRX,
+    INT_N_TARGET_PRLTX,
+    INT_N_TARGET_PE,
+    INT_N_NUM_TARGETS
+};
+
+/*
+ * Return the thread of a port that receives the events of target
+ */
+static thread_t *int_n_target_thread(struct pdb_config *cfg,
+        enum int_n_target target)
+{
+    switch (target) {
+        case INT_N_TARGET_HARDRST:
+            return cfg->prl.hardrst_thread;
+        case INT_N_TARGET_PRLRX:
+            return cfg->prl.rx_thread;
+        case INT_N_TARGET_PRLTX:
+            return cfg->prl.tx_thread;
+        default:
+            return cfg->pe.thread;
+    }
+}
+
+/*
+ * Find the events for the threads concerned by the interrupts set in the
+ * FUSB302B status
+ */
+static void int_n_decode(struct pdb_config *cfg,
+        const union fusb_status *status, eventmask_t *events)
+{
+    memset(events, 0, INT_N_NUM_TARGETS * sizeof (*events));
+
+    INT_N_STAT_STATUS_READ(cfg, status);
+
+    /* If the I_GCRCSENT flag is set, tell the Protocol RX thread */
+    if (status->interruptb & FUSB_INTERRUPTB_I_GCRCSENT) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_GCRCSENT);
+        events[INT_N_TARGET_PRLRX] |= PDB_EVT_PRLRX_I_GCRCSENT;
+    }
+
+    /* If the I_TXSENT or I_RETRYFAIL flag is set, tell the Protocol TX
+     * thread */
+    if (status->interrupta & FUSB_INTERRUPTA_I_RETRYFAIL) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_RETRYFAIL);
+        events[INT_N_TARGET_PRLTX] |= PDB_EVT_PRLTX_I_RETRYFAIL;
+    }
+    if (status->interrupta & FUSB_INTERRUPTA_I_TXSENT) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_TXSENT);
+        events[INT_N_TARGET_PRLTX] |= PDB_EVT_PRLTX_I_TXSENT;
+    }
+
+    /* If the I_HARDRST or I_HARDSENT flag is set, tell the Hard Reset
+     * thread */
+    if (status->interrupta & FUSB_INTERRUPTA_I_HARDRST) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_HARDRST);
+        events[INT_N_TARGET_HARDRST] |= PDB_EVT_HARDRST_I_HARDRST;
+    }
+    if (status->interrupta & FUSB_INTERRUPTA_I_HARDSENT) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_HARDSENT);
+        events[INT_N_TARGET_HARDRST] |= PDB_EVT_HARDRST_I_HARDSENT;
+    }
+
+    /* If the I_OCP_TEMP and OVRTEMP flags are set, tell the Policy
+     * Engine thread */
+    if (status->interrupta & FUSB_INTERRUPTA_I_OCP_TEMP
+            && status->status1 & FUSB_STATUS1_OVRTEMP) {
+        /* Shed the load right away, the hard reset will take a while */
+        if (cfg->dpm.shed_load != NULL) {
+            cfg->dpm.shed_load(cfg);
+            cfg->int_n.load_sheds++;
+        }
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_OCP_TEMP);
+        events[INT_N_TARGET_PE] |= PDB_EVT_PE_I_OVRTEMP;
+    }
+
+    /* If the I_TOGDONE flag is set, tell the Policy Engine thread that
+     * something was attached while detached */
+    if (status->interrupta & FUSB_INTERRUPTA_I_TOGDONE) {
+        INT_N_STAT_SIGNAL(cfg, PDB_INT_N_SRC_TOGDONE);
+        events[INT_N_TARGET_PE] |= PDB_EVT_PE_I_TOGDONE;
+    }
+}
+
+/*
+ * Tell the threads concerned by the interrupts set in the FUSB302B status
+ *
+ * Every thread is signaled before any of them can run, so that they run in
+ * priority order rather than in the order they were signaled.
+ */
+static void int_n_dispatch(struct pdb_config *cfg,
+        const union fusb_status *status)
+{
+    eventmask_t events[INT_N_NUM_TARGETS];
+
+    int_n_decode(cfg, status, events);
+
+    chSysLock();
+    for (uint8_t t = 0; t < INT_N_NUM_TARGETS; t++) {
+        if (events[t] != 0) {
+            chEvtSignalI(int_n_target_thread(cfg, t), events[t]);
+        }
+    }
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/*
+ * Account for the result of a status read
+ *
+ * If the PHY failed to report its status PDB_PHY_MAX_STATUS_FAILURES times
+ * in a row, have the hard reset thread set it up again and take the protocol
+ * layers through a hard reset, since whatever they were doing was lost with
+ * it.
+ *
+ * Returns true if the status was read and can be dispatched.
+ */
+static bool int_n_status_result(struct pdb_config *cfg, msg_t ret)
+{
+    if (ret == MSG_OK) {
+        cfg->int_n._status_failures = 0;
+        return true;
+    }
+
+    if (++cfg->int_n._status_failures >= PDB_PHY_MAX_STATUS_FAILURES) {
+        cfg->int_n._status_failures = 0;
+        cfg->int_n.phy_resets++;
+        chEvtSignal(cfg->prl.hardrst_thread, PDB_EVT_HARDRST_PHY_RESET);
+    }
+    return false;
+}
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * Read the FUSB302B status and interrupt registers and tell the threads
+ * concerned by the interrupts that are set
+ */
+static void int_n_service(struct pdb_config *cfg)
+{
+    union fusb_status status;
+
+    /* Read the FUSB302B status and interrupt registers */
+    if (int_n_status_result(cfg, cfg->phy->get_status(cfg, &status))) {
+        int_n_dispatch(cfg, &status);
+    }
+}
+
+/*
+ * Return whether the PHY of a port asserts its INT_N line
+ */
+static bool int_n_asserted(struct pdb_config *cfg)
+{
+    if (cfg->phy->int_n_asserted != NULL) {
+        return cfg->phy->int_n_asserted(cfg);
+    }
+
+    return palReadLine(cfg->fusb.int_n) == PAL_LOW;
+}
+#endif
+
+#if PDB_FUSB_USE_ASYNC
+#if !PDB_INT_N_USE_EVENTS
+#error "PDB_FUSB_USE_ASYNC requires PDB_INT_N_USE_EVENTS"
+#endif
+
+/*
+ * INT_N falling edge callback, called from the EXTI interrupt
+ *
+ * Queues the status read right away, so that it's done by the time the
+ * INT_N thread wakes up.
+ */
+static void int_n_edge_cb(void *vcfg)
+{
+    struct pdb_config *cfg = vcfg;
+
+    chSysLockFromISR();
+    /* Count the edge, and whether INT_N is still low by now */
+    cfg->int_n.polls[cfg->int_n._rate]++;
+    if (palReadLine(cfg->fusb.int_n) == PAL_LOW) {
+        cfg->int_n.asserted_polls[cfg->int_n._rate]++;
+    }
+    if (cfg->int_n._armed) {
+        cfg->int_n._armed = false;
+        INT_N_STAT_ASSERTED(cfg);
+        fusb_xfer_submitI(&cfg->fusb, &cfg->int_n._status_xfer);
+    }
+    chSysUnlockFromISR();
+}
+
+/*
+ * INT_N thread, woken up when the status read queued on the falling edge of
+ * INT_N is done
  */
-static THD_WORKING_AREA(_wa, PDB_INT_N_WA_SIZE);
 static THD_FUNCTION(IntNPoll, vcfg) {
 
     chRegSetThreadName("USB_PD-Interrupt_manager");
     struct pdb_config *cfg = vcfg;
 
+    struct fusb_xfer *xfer = &cfg->int_n._status_xfer;
     union fusb_status status;
-    eventmask_t events;
+    uint8_t reads = 0;
+    bool asserted;
+
+    /* Read the status registers into our buffer, then wake us up */
+    fusb_xfer_read_init(xfer, FUSB_STATUS0A, cfg->int_n._status,
+            sizeof (cfg->int_n._status));
+    xfer->callback = NULL;
+    xfer->thread = chThdGetSelfX();
+    xfer->events = PDB_EVT_INT_N_STATUS;
+
+    /* Call us back on falling edge of INT_N */
+    palSetLineCallback(cfg->fusb.int_n, int_n_edge_cb, cfg);
+    palEnableLineEvent(cfg->fusb.int_n, PAL_EVENT_MODE_FALLING_EDGE);
 
     while (true) {
-        /* If the INT_N line is low */
-        if (palReadLine(cfg->fusb.int_n) == PAL_LOW) {
-            /* Read the FUSB302B status and interrupt registers */
-            fusb_get_status(&cfg->fusb, &status);
+        /* If INT_N is released, let the edge callback queue the next status
+         * read.  Otherwise, queue it ourselves.  The line is checked with the
+         * system locked so that an edge can't be missed. */
+        chSysLock();
+        asserted = palReadLine(cfg->fusb.int_n) == PAL_LOW;
+        cfg->int_n._armed = !asserted;
+        chSysUnlock();
 
-            /* If the I_GCRCSENT flag is set, tell the Protocol RX thread */
-            if (status.interruptb & FUSB_INTERRUPTB_I_GCRCSENT) {
-                chEvtSignal(cfg->prl.rx_thread, PDB_EVT_PRLRX_I_GCRCSENT);
+        if (asserted) {
+            /* If INT_N is still low after many reads, the line is stuck.
+             * Don't hog the bus: poll it until it's released. */
+            if (reads >= PDB_INT_N_MAX_DRAIN) {
+                chThdSleepMilliseconds(PDB_INT_N_POLL_MS);
+                reads = 0;
+                continue;
             }
+            cfg->int_n.polls[cfg->int_n._rate]++;
+            cfg->int_n.asserted_polls[cfg->int_n._rate]++;
+            INT_N_STAT_ASSERTED(cfg);
+            fusb_xfer_submit(&cfg->fusb, xfer);
+        } else {
+            reads = 0;
+        }
 
-            /* If the I_TXSENT or I_RETRYFAIL flag is set, tell the Protocol TX
-             * thread */
-            events = 0;
-            if (status.interrupta & FUSB_INTERRUPTA_I_RETRYFAIL) {
-                events |= PDB_EVT_PRLTX_I_RETRYFAIL;
-            }
-            if (status.interrupta & FUSB_INTERRUPTA_I_TXSENT) {
-                events |= PDB_EVT_PRLTX_I_TXSENT;
-            }
-            chEvtSignal(cfg->prl.tx_thread, events);
+        /* Wait for the status read to be done */
+        chEvtWaitAny(PDB_EVT_INT_N_STATUS);
+        reads++;
+        if (!int_n_status_result(cfg, xfer->result)) {
+            continue;
+        }
+
+        /* Copy the status before the buffer can be reused */
+        memcpy(status.bytes, cfg->int_n._status, sizeof (status.bytes));
+        fusb_cache_status(&cfg->fusb, &status);
+        int_n_dispatch(cfg, &status);
+    }
+}
+#elif PDB_INT_N_USE_EVENTS
+/*
+ * INT_N falling edge callback, called from the EXTI interrupt
+ */
+static void int_n_edge_cb(void *vcfg)
+{
+    struct pdb_config *cfg = vcfg;
 
-            /* If the I_HARDRST or I_HARDSENT flag is set, tell the Hard Reset
-             * thread */
-            events = 0;
-            if (status.interrupta & FUSB_INTERRUPTA_I_HARDRST) {
-                events |= PDB_EVT_HARDRST_I_HARDRST;
+    chSysLockFromISR();
+    chEvtSignalI(cfg->int_n.thread, PDB_EVT_INT_N_EDGE);
+    chSysUnlockFromISR();
+}
+
+/*
+ * INT_N thread, woken up by the falling edge of INT_N
+ */
+static THD_FUNCTION(IntNPoll, vcfg) {
+
+    chRegSetThreadName("USB_PD-Interrupt_manager");
+    struct pdb_config *cfg = vcfg;
+
+    uint8_t reads;
+
+    /* The edge callback may need it before chThdCreateStatic returns */
+    cfg->int_n.thread = chThdGetSelfX();
+
+    /* Wake us up on falling edge of INT_N, if the PHY has such a line */
+    if (cfg->phy->int_n_asserted == NULL) {
+        palSetLineCallback(cfg->fusb.int_n, int_n_edge_cb, cfg);
+        palEnableLineEvent(cfg->fusb.int_n, PAL_EVENT_MODE_FALLING_EDGE);
+    }
+
+    while (true) {
+        /* Wait for INT_N to fall.  The events were enabled before the line
+         * is read, so an edge happening meanwhile wakes us up right away. */
+        while (!int_n_asserted(cfg)) {
+            chEvtWaitAny(PDB_EVT_INT_N_EDGE);
+        }
+        cfg->int_n.polls[cfg->int_n._rate]++;
+        if (int_n_asserted(cfg)) {
+            cfg->int_n.asserted_polls[cfg->int_n._rate]++;
+        }
+
+        /* Service the FUSB302B until it releases INT_N */
+        reads = 0;
+        do {
+            INT_N_STAT_ASSERTED(cfg);
+            int_n_service(cfg);
+            reads++;
+        } while (int_n_asserted(cfg) && reads < PDB_INT_N_MAX_DRAIN);
+
+        /* If INT_N is still low, the line is stuck.  Don't hog the CPU by
+         * reading the status in a loop: poll it until it's released. */
+        if (reads >= PDB_INT_N_MAX_DRAIN) {
+            chThdSleepMilliseconds(PDB_INT_N_POLL_MS);
+        }
+    }
+}
+#else
+/*
+ * Return the INT_N polling period for the given rate
+ */
+static sysinterval_t int_n_poll_period(enum pdb_int_n_rate rate)
+{
+    switch (rate) {
+        case PDB_INT_N_RATE_FAST:
+            return TIME_US2I(PDB_INT_N_POLL_FAST_US);
+        case PDB_INT_N_RATE_IDLE:
+            return TIME_MS2I(PDB_INT_N_POLL_IDLE_MS);
+        default:
+            return TIME_MS2I(PDB_INT_N_POLL_MS);
+    }
+}
+
+/*
+ * INT_N polling thread
+ */
+static THD_FUNCTION(IntNPoll, vcfg) {
+
+    chRegSetThreadName("USB_PD-Interrupt_manager");
+    struct pdb_config *cfg = vcfg;
+
+    enum pdb_int_n_rate rate;
+
+    while (true) {
+        rate = cfg->int_n._rate;
+        cfg->int_n.polls[rate]++;
+
+        /* If the INT_N line is low */
+        if (int_n_asserted(cfg)) {
+            INT_N_STAT_ASSERTED(cfg);
+            cfg->int_n.asserted_polls[rate]++;
+            int_n_service(cfg);
+        }
+
+        /* Wait for the next poll, or for the rate to be raised */
+        chEvtWaitAnyTimeout(PDB_EVT_INT_N_RATE, int_n_poll_period(rate));
+    }
+}
+#endif
+
+void pdb_int_n_run(struct pdb_config *cfg)
+{
+    cfg->int_n.thread = chThdCreateStatic(cfg->int_n._wa,
+            sizeof(cfg->int_n._wa), PDB_PRIO_PRL_INT_N, IntNPoll, cfg);
+}
+
+void pdb_int_n_set_rate(struct pdb_config *cfg, enum pdb_int_n_rate rate)
+{
+    if (cfg->int_n._rate == rate) {
+        return;
+    }
+
+#if !PDB_INT_N_USE_EVENTS
+    /* If we're polling faster than before, don't wait for the end of the
+     * current (slower) period to start doing it */
+    bool faster = int_n_poll_period(rate) < int_n_poll_period(cfg->int_n._rate);
+    cfg->int_n._rate = rate;
+    if (faster && cfg->int_n.thread != NULL) {
+        chEvtSignal(cfg->int_n.thread, PDB_EVT_INT_N_RATE);
+    }
+#else
+    cfg->int_n._rate = rate;
+#endif
+}
+
+#if !PDB_FUSB_USE_ASYNC
+void pdb_int_n_wake(struct pdb_config *cfg)
+{
+    if (cfg->int_n.thread == NULL) {
+        return;
+    }
+
+#if PDB_INT_N_USE_EVENTS
+    chEvtSignal(cfg->int_n.thread, PDB_EVT_INT_N_EDGE);
+#else
+    chEvtSignal(cfg->int_n.thread, PDB_EVT_INT_N_RATE);
+#endif
+}
+#endif
+
+#if !PDB_FUSB_USE_ASYNC
+#if PDB_INT_N_USE_EVENTS
+/*
+ * INT_N falling edge callback of the ports of a group, called from the EXTI
+ * interrupt
+ */
+static void int_n_group_edge_cb(void *vgroup)
+{
+    struct pdb_int_n_group *group = vgroup;
+
+    chSysLockFromISR();
+    chEvtSignalI(group->thread, PDB_EVT_INT_N_EDGE);
+    chSysUnlockFromISR();
+}
+#endif
+
+/*
+ * Read the status of every port of a group whose INT_N line is low, then
+ * tell the threads concerned by the interrupts that are set
+ *
+ * The statuses of the PHYs that can be read with the bus already acquired
+ * are read in a single ownership of the bus, starting from a different port
+ * each time.  A port whose INT_N line stayed low for PDB_INT_N_MAX_DRAIN
+ * reads in a row is skipped, and *stuck is set.
+ *
+ * Returns true if at least one status was read.
+ */
+static bool int_n_group_service(struct pdb_int_n_group *group, bool *stuck)
+{
+    struct pdb_config *ports[PDB_INT_N_GROUP_MAX_PORTS];
+    union fusb_status status[PDB_INT_N_GROUP_MAX_PORTS];
+    msg_t ret[PDB_INT_N_GROUP_MAX_PORTS];
+    bool asserted[PDB_INT_N_GROUP_MAX_PORTS];
+    eventmask_t events[PDB_INT_N_GROUP_MAX_PORTS][INT_N_NUM_TARGETS];
+    uint8_t n = group->num_ports;
+    bool serviced = false;
+    struct pdb_config *cfg;
+
+    /* Find the ports with INT_N asserted, starting from a different port
+     * each round so that none of them always waits for the others */
+    for (uint8_t i = 0; i < n; i++) {
+        cfg = group->ports[(group->_first + i) % n];
+        ports[i] = cfg;
+        asserted[i] = false;
+        cfg->int_n.polls[cfg->int_n._rate]++;
+
+        if (!int_n_asserted(cfg)) {
+            cfg->int_n._drain = 0;
+            continue;
+        }
+        cfg->int_n.asserted_polls[cfg->int_n._rate]++;
+        if (cfg->int_n._drain >= PDB_INT_N_MAX_DRAIN) {
+            *stuck = true;
+            continue;
+        }
+        cfg->int_n._drain++;
+        asserted[i] = true;
+        serviced = true;
+        INT_N_STAT_ASSERTED(cfg);
+    }
+    group->_first = (group->_first + 1) % n;
+
+    if (!serviced) {
+        return false;
+    }
+
+    /* Read the statuses we can in one ownership of the bus */
+    if (group->i2cp != NULL) {
+        i2cAcquireBus(group->i2cp);
+        for (uint8_t i = 0; i < n; i++) {
+            if (asserted[i] && ports[i]->phy->get_status_locked != NULL) {
+                ret[i] = ports[i]->phy->get_status_locked(ports[i],
+                        &status[i]);
             }
-            if (status.interrupta & FUSB_INTERRUPTA_I_HARDSENT) {
-                events |= PDB_EVT_HARDRST_I_HARDSENT;
+        }
+        i2cReleaseBus(group->i2cp);
+    }
+
+    /* Then the others, and decode them all */
+    for (uint8_t i = 0; i < n; i++) {
+        if (!asserted[i]) {
+            continue;
+        }
+        cfg = ports[i];
+        if (group->i2cp == NULL || cfg->phy->get_status_locked == NULL) {
+            ret[i] = cfg->phy->get_status(cfg, &status[i]);
+        }
+        if (int_n_status_result(cfg, ret[i])) {
+            int_n_decode(cfg, &status[i], events[i]);
+        } else {
+            asserted[i] = false;
+        }
+    }
+
+    /* Signal every thread before any of them can run, the hard reset
+     * threads of all ports first, then their protocol RX threads, and so
+     * on */
+    chSysLock();
+    for (uint8_t t = 0; t < INT_N_NUM_TARGETS; t++) {
+        for (uint8_t i = 0; i < n; i++) {
+            if (asserted[i] && events[i][t] != 0) {
+                chEvtSignalI(int_n_target_thread(ports[i], t), events[i][t]);
             }
-            chEvtSignal(cfg->prl.hardrst_thread, events);
+        }
+    }
+    chSchRescheduleS();
+    chSysUnlock();
 
-            /* If the I_OCP_TEMP and OVRTEMP flags are set, tell the Policy
-             * Engine thread */
-            if (status.interrupta & FUSB_INTERRUPTA_I_OCP_TEMP
-                    && status.status1 & FUSB_STATUS1_OVRTEMP) {
-                chEvtSignal(cfg->pe.thread, PDB_EVT_PE_I_OVRTEMP);
+    return true;
+}
+
+/*
+ * INT_N thread shared by the ports of a group
+ */
+static THD_FUNCTION(IntNGroup, vgroup) {
+
+    chRegSetThreadName("USB_PD-Interrupt_manager");
+    struct pdb_int_n_group *group = vgroup;
+
+    bool stuck;
+
+    /* The edge callback may need it before chThdCreateStatic returns */
+    group->thread = chThdGetSelfX();
+    for (uint8_t i = 0; i < group->num_ports; i++) {
+        group->ports[i]->int_n.thread = chThdGetSelfX();
+    }
+
+#if PDB_INT_N_USE_EVENTS
+    systime_t backoff = 0;
+    bool backing_off = false;
+
+    /* Wake us up on falling edge of any INT_N line */
+    for (uint8_t i = 0; i < group->num_ports; i++) {
+        if (group->ports[i]->phy->int_n_asserted != NULL) {
+            continue;
+        }
+        palSetLineCallback(group->ports[i]->fusb.int_n, int_n_group_edge_cb,
+                group);
+        palEnableLineEvent(group->ports[i]->fusb.int_n,
+                PAL_EVENT_MODE_FALLING_EDGE);
+    }
+
+    while (true) {
+        /* Service the ports until every INT_N line is released or stuck.
+         * The events were enabled before the lines are read, so an edge
+         * happening meanwhile wakes us up right away. */
+        stuck = false;
+        while (int_n_group_service(group, &stuck)) {
+        }
+
+        /* Give the stuck lines another chance after PDB_INT_N_POLL_MS, even
+         * if the other ports keep waking us up */
+        if (stuck && !backing_off) {
+            backoff = chVTGetSystemTime();
+            backing_off = true;
+        }
+        if (backing_off && chVTTimeElapsedSinceX(backoff)
+                >= TIME_MS2I(PDB_INT_N_POLL_MS)) {
+            for (uint8_t i = 0; i < group->num_ports; i++) {
+                group->ports[i]->int_n._drain = 0;
             }
+            backing_off = false;
+            continue;
+        }
+
+        chEvtWaitAnyTimeout(PDB_EVT_INT_N_EDGE, backing_off
+                ? TIME_MS2I(PDB_INT_N_POLL_MS) : TIME_INFINITE);
+    }
+#else
+    sysinterval_t period;
 
+    while (true) {
+        /* Poll at the rate of the port that needs it fastest */
+        period = TIME_INFINITE;
+        for (uint8_t i = 0; i < group->num_ports; i++) {
+            struct pdb_config *cfg = group->ports[i];
+
+            if (int_n_poll_period(cfg->int_n._rate) < period) {
+                period = int_n_poll_period(cfg->int_n._rate);
+            }
+            /* The line is only read once per period, it can't be hogged */
+            cfg->int_n._drain = 0;
         }
-        chThdSleepMilliseconds(5);
+
+        stuck = false;
+        int_n_group_service(group, &stuck);
+
+        /* Wait for the next poll, or for the rate to be raised */
+        chEvtWaitAnyTimeout(PDB_EVT_INT_N_RATE, period);
     }
+#endif
 }
 
-void pdb_int_n_run(struct pdb_config *cfg)
+void pdb_int_n_group_run(struct pdb_int_n_group *group)
 {
-    cfg->int_n.thread = chThdCreateStatic(_wa,
-            sizeof(_wa), PDB_PRIO_PRL_INT_N, IntNPoll, cfg);
+    chDbgAssert(group->num_ports > 0
+            && group->num_ports <= PDB_INT_N_GROUP_MAX_PORTS,
+            "too many ports in the INT_N group");
+
+    group->thread = chThdCreateStatic(group->_wa, sizeof(group->_wa),
+            PDB_PRIO_PRL_INT_N, IntNGroup, group);
 }
+#endif
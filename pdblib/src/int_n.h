@@ -21,10 +21,42 @@
 #include <pdb.h>
 
 
+/* Events for the INT_N thread */
+#define PDB_EVT_INT_N_RATE EVENT_MASK(0)
+#define PDB_EVT_INT_N_STATUS EVENT_MASK(1)
+#define PDB_EVT_INT_N_EDGE EVENT_MASK(2)
+
 /*
  * Start the INT_N polling thread
  */
 void pdb_int_n_run(struct pdb_config *cfg);
 
+/*
+ * Set the rate at which the INT_N thread polls the INT_N line
+ *
+ * Raising the rate takes effect immediately.  When INT_N is serviced on its
+ * edge, the rate is only remembered.
+ */
+void pdb_int_n_set_rate(struct pdb_config *cfg, enum pdb_int_n_rate rate);
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * Wake up the INT_N thread of a port whose PHY has no INT_N line, as if the
+ * line had fallen
+ */
+void pdb_int_n_wake(struct pdb_config *cfg);
+#endif
+
+#if PDB_USE_STATS
+/*
+ * Record that the thread that receives the events of src woke up
+ */
+void pdb_int_n_stat_wakeup(struct pdb_config *cfg, enum pdb_int_n_src src);
+
+#define PDB_INT_N_STAT_WAKEUP(cfg, src) pdb_int_n_stat_wakeup(cfg, src)
+#else
+#define PDB_INT_N_STAT_WAKEUP(cfg, src) do {} while (0)
+#endif
+
 
 #endif /* PDB_INT_N_OLD_H */
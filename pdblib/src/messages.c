@@ -17,23 +17,106 @@
 
 #include "messages.h"
 
-#include <pdb_msg.h>
+#include <pdb.h>
 
 #include "pdb_conf.h"
+#include "protocol_rx.h"
 
 
-/* The messages that will be available for threads to pass each other */
-static union pd_msg pd_messages[PDB_MSG_POOL_SIZE] __attribute__((aligned(sizeof(stkalign_t))));
+void pdb_msg_pool_init(struct pdb_config *cfg)
+{
+    /* Initialize the pool itself */
+    chPoolObjectInit(&cfg->msg_pool, sizeof (union pd_msg), NULL);
 
-/* The pool of available messages */
-memory_pool_t pdb_msg_pool;
+    /* Fill the pool with the port's messages */
+    chPoolLoadArray(&cfg->msg_pool, cfg->_msgs, PDB_MSG_POOL_SIZE);
+}
 
+void pdb_msg_free(struct pdb_config *cfg, union pd_msg *msg)
+{
+    chPoolFree(&cfg->msg_pool, msg);
 
-void pdb_msg_pool_init(void)
+    /* If the RX thread is waiting for a buffer, it can have this one */
+    if (cfg->prl._rx_starved) {
+        cfg->prl._rx_starved = false;
+        chEvtSignal(cfg->prl.rx_thread, PDB_EVT_PRLRX_RETRY);
+    }
+}
+
+/*
+ * Return the slot following slot in a ring
+ */
+static uint8_t pdb_msg_ring_next(uint8_t slot)
 {
-    /* Initialize the pool itself */
-    chPoolObjectInit(&pdb_msg_pool, sizeof (union pd_msg), NULL);
+    return slot == PDB_MSG_POOL_SIZE ? 0 : slot + 1;
+}
+
+void pdb_msg_ring_init(struct pdb_msg_ring *ring)
+{
+    ring->_head = 0;
+    ring->_tail = 0;
+}
+
+bool pdb_msg_ring_push(struct pdb_msg_ring *ring, union pd_msg *msg)
+{
+    uint8_t head = ring->_head;
+    uint8_t next = pdb_msg_ring_next(head);
+
+    /* There are never more messages than the pool holds */
+    chDbgAssert(next != ring->_tail, "message ring full");
+
+    ring->_slots[head] = msg;
+    /* Publish the message before moving the head past it */
+    __sync_synchronize();
+    ring->_head = next;
+    /* Move the head before looking at the tail, so that the consumer either
+     * sees our message or is seen having emptied the ring */
+    __sync_synchronize();
+
+    return ring->_tail == head;
+}
+
+union pd_msg *pdb_msg_ring_pop(struct pdb_msg_ring *ring)
+{
+    uint8_t tail = ring->_tail;
+    union pd_msg *msg;
+
+    if (tail == ring->_head) {
+        return NULL;
+    }
+    /* Read the message only after seeing the head past it */
+    __sync_synchronize();
+    msg = ring->_slots[tail];
+    /* Free the slot once the message is read, and before the caller looks
+     * at the head again */
+    __sync_synchronize();
+    ring->_tail = pdb_msg_ring_next(tail);
+    __sync_synchronize();
+
+    return msg;
+}
+
+union pd_msg *pdb_msg_ring_peek(const struct pdb_msg_ring *ring)
+{
+    uint8_t tail = ring->_tail;
+
+    if (tail == ring->_head) {
+        return NULL;
+    }
+    /* Read the message only after seeing the head past it */
+    __sync_synchronize();
+    return ring->_slots[tail];
+}
+
+bool pdb_msg_ring_empty(const struct pdb_msg_ring *ring)
+{
+    return ring->_tail == ring->_head;
+}
+
+uint8_t pdb_msg_ring_count(const struct pdb_msg_ring *ring)
+{
+    uint8_t tail = ring->_tail;
+    uint8_t head = ring->_head;
 
-    /* Fill the pool with the available buffers */
-    chPoolLoadArray(&pdb_msg_pool, pd_messages, PDB_MSG_POOL_SIZE);
+    return head >= tail ? head - tail : head + PDB_MSG_POOL_SIZE + 1 - tail;
 }
@@ -18,11 +18,52 @@
 #ifndef PDB_MESSAGES_H
 #define PDB_MESSAGES_H
 
+#include <pdb.h>
+
+
+/*
+ * Initialize the message pool of the port
+ */
+void pdb_msg_pool_init(struct pdb_config *cfg);
+
+/*
+ * Initialize an empty message ring
+ */
+void pdb_msg_ring_init(struct pdb_msg_ring *ring);
+
+/*
+ * Add a message at the back of a ring.  Only called by the producer.
+ *
+ * Returns true if the consumer must be woken up: it may have found the ring
+ * empty and be about to wait.  Otherwise, the consumer will find the
+ * message when it checks the ring after popping the one in front.
+ */
+bool pdb_msg_ring_push(struct pdb_msg_ring *ring, union pd_msg *msg);
+
+/*
+ * Remove the message at the front of a ring.  Only called by the consumer.
+ *
+ * Returns NULL if the ring is empty.
+ */
+union pd_msg *pdb_msg_ring_pop(struct pdb_msg_ring *ring);
+
+/*
+ * Return the message at the front of a ring without removing it.  Only
+ * called by the consumer.
+ *
+ * Returns NULL if the ring is empty.
+ */
+union pd_msg *pdb_msg_ring_peek(const struct pdb_msg_ring *ring);
+
+/*
+ * Return whether a ring is empty
+ */
+bool pdb_msg_ring_empty(const struct pdb_msg_ring *ring);
 
 /*
- * Initialize the pdb_msg_pool
+ * Return the number of messages in a ring
  */
-void pdb_msg_pool_init(void);
+uint8_t pdb_msg_ring_count(const struct pdb_msg_ring *ring);
 
 
 #endif /* PDB_MESSAGES_H */
@@ -26,6 +26,7 @@
 #include "protocol_tx.h"
 #include "hard_reset.h"
 #include "int_n.h"
+#include "vbus.h"
 #include "fusb302b.h"
 #include "messages.h"
 
@@ -34,10 +35,13 @@ void pdb_init(struct pdb_config *cfg)
 {
     cfg->dpm.init(cfg);
     /* Initialize the empty message pool */
-    pdb_msg_pool_init();
+    pdb_msg_pool_init(cfg);
 
-    /* Initialize the FUSB302B */
-    fusb_setup(&cfg->fusb);
+    /* Initialize the PHY, the FUSB302B unless told otherwise */
+    if (cfg->phy == NULL) {
+        cfg->phy = &pdb_fusb302b_phy;
+    }
+    cfg->phy->setup(cfg);
 
     /* Create the policy engine thread. */
     pdb_pe_run(cfg);
@@ -47,6 +51,20 @@ void pdb_init(struct pdb_config *cfg)
     pdb_prltx_run(cfg);
     pdb_hardrst_run(cfg);
 
-    /* Create the INT_N thread. */
-    pdb_int_n_run(cfg);
+    /* Create the INT_N thread, unless a shared one serves this port. */
+    if (cfg->int_n_group == NULL) {
+        pdb_int_n_run(cfg);
+    }
+
+    /* Create the VBUS measurement thread, if the PHY can measure VBUS. */
+    pdb_vbus_run(cfg);
+}
+
+uint16_t pdb_get_vbus(struct pdb_config *cfg)
+{
+    if (cfg->phy->get_vbus == NULL) {
+        return 0;
+    }
+
+    return cfg->phy->get_vbus(cfg);
 }
@@ -28,9 +28,57 @@
 #include "priorities.h"
 #include "protocol_tx.h"
 #include "hard_reset.h"
+#include "int_n.h"
+#include "vbus.h"
 #include "fusb302b.h"
+#include "messages.h"
 
 
+#if PDB_USE_STATS
+/*
+ * Get the number of context switches of the whole system so far, if ChibiOS
+ * counts them
+ */
+static uint32_t pe_stat_ctxsw(void)
+{
+#if CH_DBG_STATISTICS
+    return ch.kernel_stats.n_ctxswc;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Record that a negotiation started
+ */
+static void pe_stat_negotiation_begin(struct pdb_config *cfg)
+{
+    cfg->pe.stats._ctxsw_start = pe_stat_ctxsw();
+}
+
+/*
+ * Record that a negotiation ended with an explicit contract
+ */
+static void pe_stat_negotiation_end(struct pdb_config *cfg)
+{
+    struct pdb_pe_stats *stats = &cfg->pe.stats;
+    uint32_t ctxsw = pe_stat_ctxsw() - stats->_ctxsw_start;
+
+    stats->negotiations++;
+    stats->ctxsw_last = ctxsw;
+    stats->ctxsw_total += ctxsw;
+    if (ctxsw > stats->ctxsw_max) {
+        stats->ctxsw_max = ctxsw;
+    }
+}
+
+#define PE_STAT_NEGOTIATION_BEGIN(cfg) pe_stat_negotiation_begin(cfg)
+#define PE_STAT_NEGOTIATION_END(cfg) pe_stat_negotiation_end(cfg)
+#else
+#define PE_STAT_NEGOTIATION_BEGIN(cfg) do {} while (0)
+#define PE_STAT_NEGOTIATION_END(cfg) do {} while (0)
+#endif
+
 static void pe_sink_pps_periodic_timer_cb(void *cfg)
 {
     /* Signal the PE thread to make a new PPS request */
@@ -39,6 +87,17 @@ static void pe_sink_pps_periodic_timer_cb(void *cfg)
     chSysUnlockFromISR();
 }
 
+/*
+ * Switch the PHY to the given interrupt mask profile, if it has them
+ */
+static void pe_set_mask_profile(struct pdb_config *cfg,
+        enum fusb_mask_profile profile)
+{
+    if (cfg->phy->set_mask_profile != NULL) {
+        cfg->phy->set_mask_profile(cfg, profile);
+    }
+}
+
 
 enum policy_engine_state {
     PESinkStartup,
@@ -60,6 +119,212 @@ enum policy_engine_state {
     PESinkSourceUnresponsive
 };
 
+/*
+ * Tell the PHY which negotiation phase its bus traffic belongs to
+ */
+static void pe_set_phase(struct pdb_config *cfg, enum fusb_trace_phase phase)
+{
+    if (cfg->phy->set_phase != NULL) {
+        cfg->phy->set_phase(cfg, phase);
+    }
+}
+
+/*
+ * Return whether a received message can be dropped without leaving the
+ * given state, so that the next one queued is handled right after it
+ *
+ * next is the message queued behind msg, or NULL if there is none.
+ */
+static bool pe_skip_message(enum policy_engine_state state,
+        const union pd_msg *msg, const union pd_msg *next)
+{
+    switch (state) {
+        case PESinkReady:
+            /* Ping and vendor-defined messages are ignored */
+            if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_PING
+                    && PD_NUMOBJ_GET(msg) == 0) {
+                return true;
+            }
+            if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_VENDOR_DEFINED
+                    && PD_NUMOBJ_GET(msg) > 0) {
+                return true;
+            }
+            /* Fall through */
+        case PESinkWaitCap:
+            /* Source_Capabilities followed by newer ones are out of date, so
+             * only the last of them is evaluated */
+            return next != NULL
+                && PD_MSGTYPE_GET(msg) == PD_MSGTYPE_SOURCE_CAPABILITIES
+                && PD_NUMOBJ_GET(msg) > 0
+                && PD_MSGTYPE_GET(next) == PD_MSGTYPE_SOURCE_CAPABILITIES
+                && PD_NUMOBJ_GET(next) > 0;
+        default:
+            /* Any other state is waiting for a response, and whatever comes
+             * first decides where we go */
+            return false;
+    }
+}
+
+/*
+ * Fetch the next message from the protocol layer into cfg->pe._message
+ *
+ * The queued messages the state may skip are freed on the way, in the order
+ * they were received, so a batch of them is dealt with in one wakeup.
+ * Returns MSG_TIMEOUT if no message is left.
+ */
+static msg_t pe_fetch_message(struct pdb_config *cfg,
+        enum policy_engine_state state)
+{
+    uint8_t count = pdb_msg_ring_count(&cfg->pe.rx_queue);
+
+    if (count > cfg->pe.rx_queue_max) {
+        cfg->pe.rx_queue_max = count;
+    }
+
+    while ((cfg->pe._message = pdb_msg_ring_pop(&cfg->pe.rx_queue)) != NULL) {
+        if (!pe_skip_message(state, cfg->pe._message,
+                    pdb_msg_ring_peek(&cfg->pe.rx_queue))) {
+            return MSG_OK;
+        }
+        pdb_msg_free(cfg, cfg->pe._message);
+    }
+
+    return MSG_TIMEOUT;
+}
+
+/*
+ * Wait for one of the events of mask, or for the timeout
+ *
+ * If mask includes PDB_EVT_PE_MSG_RX and messages are already queued, return
+ * right away: the protocol RX thread only signals us when it finds the queue
+ * empty.
+ */
+static eventmask_t pe_wait(struct pdb_config *cfg, eventmask_t mask,
+        sysinterval_t timeout)
+{
+    if ((mask & PDB_EVT_PE_MSG_RX) && !pdb_msg_ring_empty(&cfg->pe.rx_queue)) {
+        return chEvtGetAndClearEvents(mask) | PDB_EVT_PE_MSG_RX;
+    }
+
+    return chEvtWaitAnyTimeout(mask, timeout);
+}
+
+/*
+ * Wait until the protocol TX thread is done with the message of token
+ *
+ * Returns the events of mask that came in meanwhile, plus PDB_EVT_PE_TX_DONE
+ * if the message was sent or PDB_EVT_PE_TX_ERR if it wasn't.  The events of
+ * mask don't cut the wait short: the message must not be freed while the TX
+ * thread still has it, and a reset makes the TX thread give up on it soon.
+ */
+static eventmask_t pe_tx_wait(struct pdb_config *cfg, uint8_t token,
+        eventmask_t mask)
+{
+    eventmask_t evt = 0;
+
+    while (!pdb_prltx_done(cfg, token)) {
+        evt |= chEvtWaitAny(mask | PDB_EVT_PE_TX_DONE) & mask;
+    }
+
+    if (pdb_prltx_sent(cfg, token)) {
+        return evt | PDB_EVT_PE_TX_DONE;
+    } else {
+        return evt | PDB_EVT_PE_TX_ERR;
+    }
+}
+
+/*
+ * Settle the message sent from the Sink Ready state, if there is one
+ *
+ * If wait is false and the TX thread isn't done with it yet, leave it be.
+ * Returns the state to go to if it failed to be sent, or PESinkReady.
+ */
+static enum policy_engine_state pe_tx_async_result(struct pdb_config *cfg,
+        bool wait)
+{
+    if (cfg->pe._tx_async == NULL) {
+        return PESinkReady;
+    }
+    if (!wait && !pdb_prltx_done(cfg, cfg->pe._tx_async_token)) {
+        return PESinkReady;
+    }
+
+    eventmask_t evt = pe_tx_wait(cfg, cfg->pe._tx_async_token, 0);
+
+    pdb_msg_free(cfg, cfg->pe._tx_async);
+    cfg->pe._tx_async = NULL;
+
+    if (evt & PDB_EVT_PE_TX_DONE) {
+        return PESinkReady;
+    }
+    return cfg->pe._tx_async_fail;
+}
+
+/*
+ * Send a message and wait until the protocol TX thread is done with it
+ *
+ * The message sent from the Sink Ready state, if any, must have been settled
+ * with pe_tx_async_result first, so that its failure isn't lost.
+ *
+ * Returns like pe_tx_wait, with PDB_EVT_PE_RESET if reset signaling came in.
+ */
+static eventmask_t pe_tx_send(struct pdb_config *cfg, union pd_msg *msg)
+{
+    uint8_t token = pdb_prltx_submit(cfg, msg);
+
+    return pe_tx_wait(cfg, token, PDB_EVT_PE_RESET);
+}
+
+/*
+ * Send a message from the Sink Ready state without waiting for it
+ *
+ * The Policy Engine goes back to Sink Ready right away, and the result is
+ * looked at there once the protocol TX thread is done with the message.  If
+ * it failed, fail_state is entered.
+ *
+ * Only one message can be in flight this way, since there is only one fail
+ * state to remember.  The caller must settle the previous one with
+ * pe_tx_async_result before taking a buffer for msg, which also gives the
+ * buffer of the previous one back to the pool.
+ *
+ * Returns the state to go to.
+ */
+static enum policy_engine_state pe_tx_send_async(struct pdb_config *cfg,
+        union pd_msg *msg, enum policy_engine_state fail_state)
+{
+    cfg->pe._tx_async = msg;
+    cfg->pe._tx_async_token = pdb_prltx_submit(cfg, msg);
+    cfg->pe._tx_async_fail = fail_state;
+
+    return PESinkReady;
+}
+
+/*
+ * Return the negotiation phase a state belongs to
+ */
+static enum fusb_trace_phase pe_phase(enum policy_engine_state state)
+{
+    switch (state) {
+        case PESinkStartup:
+        case PESinkDiscovery:
+        case PESinkWaitCap:
+            return fusb_phase_wait_cap;
+        case PESinkEvalCap:
+        case PESinkSelectCap:
+            return fusb_phase_negotiate;
+        case PESinkTransitionSink:
+            return fusb_phase_transition;
+        case PESinkHardReset:
+        case PESinkTransitionDefault:
+        case PESinkSoftReset:
+        case PESinkSendSoftReset:
+        case PESinkSourceUnresponsive:
+            return fusb_phase_reset;
+        default:
+            return fusb_phase_ready;
+    }
+}
+
 static enum policy_engine_state pe_sink_startup(struct pdb_config *cfg)
 {
     /* We don't have an explicit contract currently */
@@ -87,8 +352,13 @@ static enum policy_engine_state pe_sink_discovery(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_wait_cap(struct pdb_config *cfg)
 {
+    /* No AMS in progress yet, poll INT_N at the normal rate */
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
+    /* Only listen to PD communication interrupts */
+    pe_set_mask_profile(cfg, fusb_mask_pd);
+
     /* Fetch a message from the protocol layer */
-    eventmask_t evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX
+    eventmask_t evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX
             | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_RESET, PD_T_TYPEC_SINK_WAIT_CAP);
     /* If we timed out waiting for Source_Capabilities, send a hard reset */
     if (evt == 0) {
@@ -100,13 +370,14 @@ static enum policy_engine_state pe_sink_wait_cap(struct pdb_config *cfg)
     }
     /* If we're too hot, we shouldn't negotiate power yet */
     if (evt & PDB_EVT_PE_I_OVRTEMP) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_OCP_TEMP);
         return PESinkWaitCap;
     }
 
     /* If we got a message */
     if (evt & PDB_EVT_PE_MSG_RX) {
         /* Get the message */
-        if (chMBFetchTimeout(&cfg->pe.mailbox, (msg_t *) &cfg->pe._message, TIME_IMMEDIATE) == MSG_OK) {
+        if (pe_fetch_message(cfg, PESinkWaitCap) == MSG_OK) {
             /* If we got a Source_Capabilities message, read it. */
             if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOURCE_CAPABILITIES
                     && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
@@ -126,13 +397,13 @@ static enum policy_engine_state pe_sink_wait_cap(struct pdb_config *cfg)
             /* If the message was a Soft_Reset, do the soft reset procedure */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSoftReset;
             /* If we got an unexpected message, reset */
             } else {
                 /* Free the received message */
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 return PESinkHardReset;
             }
         }
@@ -144,6 +415,8 @@ static enum policy_engine_state pe_sink_wait_cap(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_eval_cap(struct pdb_config *cfg)
 {
+    PE_STAT_NEGOTIATION_BEGIN(cfg);
+
     /* If we have a Source_Capabilities message, remember the index of the
      * first PPS APDO so we can check if the request is for a PPS APDO in
      * PE_SNK_Select_Cap. */
@@ -163,9 +436,18 @@ static enum policy_engine_state pe_sink_eval_cap(struct pdb_config *cfg)
          * same PPS APDO */
         cfg->pe._last_pps = 8;
     }
-    /* Get a message object for the request if we don't have one already */
+    /* Get a message object for the request if we don't have one already.
+     * If none is left, no request can be made, so send a hard reset after
+     * freeing the Source_Capabilities the DPM won't see. */
     if (cfg->pe._last_dpm_request == NULL) {
-        cfg->pe._last_dpm_request = chPoolAlloc(&pdb_msg_pool);
+        cfg->pe._last_dpm_request = chPoolAlloc(&cfg->msg_pool);
+        if (cfg->pe._last_dpm_request == NULL) {
+            if (cfg->pe._message != NULL) {
+                pdb_msg_free(cfg, cfg->pe._message);
+                cfg->pe._message = NULL;
+            }
+            return PESinkHardReset;
+        }
     } else {
         /* Remember the last PDO we requested if it was a PPS APDO */
         if (PD_RDO_OBJPOS_GET(cfg->pe._last_dpm_request) >= cfg->pe._pps_index) {
@@ -188,11 +470,15 @@ static enum policy_engine_state pe_sink_eval_cap(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
 {
+    /* If a message we sent from the Sink Ready state failed, deal with that
+     * first */
+    enum policy_engine_state state = pe_tx_async_result(cfg, true);
+    if (state != PESinkReady) {
+        return state;
+    }
+
     /* Transmit the request */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) cfg->pe._last_dpm_request, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
+    eventmask_t evt = pe_tx_send(cfg, cfg->pe._last_dpm_request);
     /* Don't free the request; we might need it again */
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -218,7 +504,7 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
      * PD_T_PPS_REQUEST */
 
     /* Wait for a response */
-    evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
+    evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
             PD_T_SENDER_RESPONSE);
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -230,7 +516,7 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
     }
 
     /* Get the response message */
-    if (chMBFetchTimeout(&cfg->pe.mailbox, (msg_t *) &cfg->pe._message, TIME_IMMEDIATE) == MSG_OK) {
+    if (pe_fetch_message(cfg, PESinkSelectCap) == MSG_OK) {
         /* If the source accepted our request, wait for the new power */
         if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_ACCEPT
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
@@ -241,13 +527,13 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
 
             cfg->pe._min_power = false;
 
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkTransitionSink;
         /* If the message was a Soft_Reset, do the soft reset procedure */
         } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkSoftReset;
         /* If the message was Wait or Reject */
@@ -256,7 +542,7 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
             /* If we don't have an explicit contract, wait for capabilities */
             if (!cfg->pe._explicit_contract) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkWaitCap;
             /* If we do have an explicit contract, go to the ready state */
@@ -265,12 +551,12 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
                  * SinkRequestTimer in the Ready state. */
                 cfg->pe._min_power = (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_WAIT);
 
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkReady;
             }
         } else {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkSendSoftReset;
         }
@@ -281,7 +567,7 @@ static enum policy_engine_state pe_sink_select_cap(struct pdb_config *cfg)
 static enum policy_engine_state pe_sink_transition_sink(struct pdb_config *cfg)
 {
     /* Wait for the PS_RDY message */
-    eventmask_t evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
+    eventmask_t evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
             PD_T_PS_TRANSITION);
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -293,19 +579,26 @@ static enum policy_engine_state pe_sink_transition_sink(struct pdb_config *cfg)
     }
 
     /* If we received a message, read it */
-    if (chMBFetchTimeout(&cfg->pe.mailbox, (msg_t *) &cfg->pe._message, TIME_IMMEDIATE) == MSG_OK) {
+    if (pe_fetch_message(cfg, PESinkTransitionSink) == MSG_OK) {
         /* If we got a PS_RDY, handle it */
         if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PS_RDY
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
             /* We just finished negotiating an explicit contract */
             cfg->pe._explicit_contract = true;
+            PE_STAT_NEGOTIATION_END(cfg);
 
             /* Set the output appropriately */
             if (!cfg->pe._min_power) {
                 cfg->dpm.transition_requested(cfg);
             }
 
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            /* Have the new VBUS voltage measured, so that the DPM can check
+             * the transition.  That's a few milliseconds of I2C traffic, so
+             * it's done in the background rather than keep us from answering
+             * the source. */
+            pdb_vbus_measure(cfg);
+
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkReady;
         /* If there was a protocol error, send a hard reset */
@@ -315,7 +608,7 @@ static enum policy_engine_state pe_sink_transition_sink(struct pdb_config *cfg)
              */
             cfg->dpm.transition_default(cfg);
 
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkHardReset;
         }
@@ -324,27 +617,120 @@ static enum policy_engine_state pe_sink_transition_sink(struct pdb_config *cfg)
     return PESinkHardReset;
 }
 
+/*
+ * Wait for a source to be attached with the PHY in low power mode
+ *
+ * Returns false if reset signaling ended the wait.
+ */
+static bool pe_sink_wait_attach(struct pdb_config *cfg)
+{
+    eventmask_t evt;
+    msg_t ret;
+
+    /* Nothing but I_TOGDONE can happen, so don't poll INT_N often */
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_IDLE);
+
+    /* Forget any stale I_TOGDONE before arming the toggling */
+    chEvtGetAndClearEvents(PDB_EVT_PE_I_TOGDONE);
+    ret = cfg->phy->enter_detached(cfg);
+
+    while (ret == MSG_OK) {
+        evt = chEvtWaitAnyTimeout(PDB_EVT_PE_I_TOGDONE | PDB_EVT_PE_RESET,
+                TIME_MS2I(PDB_DETACHED_VBUS_CHECK_MS));
+        if (evt & PDB_EVT_PE_RESET) {
+            cfg->phy->setup(cfg);
+            pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
+            return false;
+        }
+        if (evt == 0) {
+            /* If VBUS is there, the toggling missed the attach: stop
+             * waiting for it */
+            if (cfg->dpm.check_vbus(cfg)) {
+                break;
+            }
+            continue;
+        }
+
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_TOGDONE);
+        ret = cfg->phy->attach(cfg);
+        /* If nothing was attached after all, toggle again */
+        if (ret == PDB_PHY_DETACHED) {
+            chEvtGetAndClearEvents(PDB_EVT_PE_I_TOGDONE);
+            ret = cfg->phy->enter_detached(cfg);
+        } else if (ret == MSG_OK) {
+            pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
+            return true;
+        }
+    }
+
+    /* The PHY failed to power down or up, or VBUS came without an
+     * I_TOGDONE: set it up from scratch, which also finds the CC line */
+    cfg->phy->setup(cfg);
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
+    return true;
+}
+
+/*
+ * Find the CC line the source is attached to, waiting for the PHY's toggling
+ * to report it if the PHY started one
+ */
+static void pe_sink_update_cc(struct pdb_config *cfg)
+{
+    /* Forget any stale I_TOGDONE before the toggling can start */
+    chEvtGetAndClearEvents(PDB_EVT_PE_I_TOGDONE);
+    if (cfg->phy->update_cc(cfg) != PDB_PHY_TOGGLING) {
+        return;
+    }
+
+    /* Don't let a slow INT_N poll eat the toggling timeout */
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
+    if (chEvtWaitAnyTimeout(PDB_EVT_PE_I_TOGDONE,
+                TIME_MS2I(PDB_FUSB_TOGGLE_TIMEOUT_MS))) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_TOGDONE);
+        if (cfg->phy->attach(cfg) == MSG_OK) {
+            return;
+        }
+    }
+
+    /* The toggling didn't find the source in time, so set the PHY up again,
+     * which measures the lines instead */
+    cfg->phy->setup(cfg);
+}
+
 static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
 {
     eventmask_t evt;
-    static systime_t time = 0;
-    static bool init = true;
-    if(init){
-        init = false;
-        //needed to not directly fall into the case 3 at init
-        time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
+    eventmask_t tx_evt = 0;
+
+    /* If a message we sent from here failed, deal with it */
+    enum policy_engine_state state = pe_tx_async_result(cfg, false);
+    if (state != PESinkReady) {
+        return state;
+    }
+    /* Otherwise, come back here when the TX thread is done with it */
+    if (cfg->pe._tx_async != NULL) {
+        tx_evt = PDB_EVT_PE_TX_DONE;
+    }
+
+    /* Any AMS is over.  With an explicit contract nothing should happen for
+     * a while, so INT_N can be polled slowly. */
+    if (cfg->pe._explicit_contract) {
+        pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_IDLE);
+    } else {
+        pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_NORMAL);
     }
+    pe_set_mask_profile(cfg, fusb_mask_pd);
 
     /* Wait for an event */
     if (cfg->pe._min_power) {
-        evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
+        evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
                 | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
-                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST,
+                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST | tx_evt,
                 PD_T_SINK_REQUEST);
     } else {
-        evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
+        evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
                 | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
-                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST, 
+                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST | tx_evt,
                 PD_T_SINK_IDLE);
     }
 
@@ -363,28 +749,37 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
         if(!cfg->dpm.check_vbus(cfg)){
             // we are disconnected so update the status
             cfg->pe._explicit_contract = false;
-            //wait vbus
-            cfg->dpm.wait_vbus(cfg);
-            /* we need to configure again the CC lines in order to receive the PDB_EVT_PE_RESET
-             * event from the source 
-             */
-            fusb_update_cc(&cfg->fusb);
-            time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
+            pe_set_phase(cfg, fusb_phase_detached);
+            if (cfg->phy->enter_detached != NULL) {
+                /* sleep with the PHY powered down until a source is
+                 * attached, which also configures the CC lines */
+                if (!pe_sink_wait_attach(cfg)) {
+                    return PESinkTransitionDefault;
+                }
+            } else {
+                //wait vbus
+                cfg->dpm.wait_vbus(cfg);
+                /* we need to configure again the CC lines in order to receive the PDB_EVT_PE_RESET
+                 * event from the source 
+                 */
+                pe_sink_update_cc(cfg);
+            }
+            cfg->pe._reconnect_time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
         }
         //we are connected
         else{
-            if(chVTGetSystemTime() > time){
+            if(chVTGetSystemTime() > cfg->pe._reconnect_time){
                 //case 3
                 //if we fall here, it means that we didn't receive a PDB_EVT_PE_RESET, so we can
                 //send a PDB_EVT_PE_GET_SOURCE_CAP
                 if(cfg->pe._explicit_contract == false){
-                    fusb_update_cc(&cfg->fusb);
+                    pe_sink_update_cc(cfg);
                     chEvtSignal(cfg->pe.thread, PDB_EVT_PE_GET_SOURCE_CAP);
-                    time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
+                    cfg->pe._reconnect_time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
                 }
                 // case 1
                 else{
-                    time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
+                    cfg->pe._reconnect_time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
                 }
             }
         }
@@ -398,6 +793,7 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
 
     /* If we overheated, send a hard reset */
     if (evt & PDB_EVT_PE_I_OVRTEMP) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_OCP_TEMP);
         return PESinkHardReset;
     }
 
@@ -415,7 +811,7 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
     if (evt & PDB_EVT_PE_NEW_POWER) {
         /* Make sure we're evaluating NULL capabilities to use the old ones */
         if (cfg->pe._message != NULL) {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
         }
         /* Tell the protocol layer we're starting an AMS */
@@ -438,53 +834,42 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
 
     /* If we received a message */
     if (evt & PDB_EVT_PE_MSG_RX) {
-        if (chMBFetchTimeout(&cfg->pe.mailbox, (msg_t *) &cfg->pe._message, TIME_IMMEDIATE) == MSG_OK) {
-            /* Ignore vendor-defined messages */
-            if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_VENDOR_DEFINED
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
-                cfg->pe._message = NULL;
-                return PESinkReady;
-            /* Ignore Ping messages */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PING
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
-                cfg->pe._message = NULL;
-                return PESinkReady;
+        /* Ping and vendor-defined messages were skipped while fetching */
+        if (pe_fetch_message(cfg, PESinkReady) == MSG_OK) {
             /* DR_Swap messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_DR_SWAP
+            if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_DR_SWAP
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* Get_Source_Cap messages are not supported */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GET_SOURCE_CAP
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* PR_Swap messages are not supported */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PR_SWAP
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* VCONN_Swap messages are not supported */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_VCONN_SWAP
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* Request messages are not supported */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_REQUEST
                     && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* Sink_Capabilities messages are not supported */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SINK_CAPABILITIES
                     && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendNotSupported;
             /* Handle GotoMin messages */
@@ -496,12 +881,12 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
                     cfg->dpm.transition_min(cfg);
                     cfg->pe._min_power = true;
 
-                    chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                    pdb_msg_free(cfg, cfg->pe._message);
                     cfg->pe._message = NULL;
                     return PESinkTransitionSink;
                 } else {
                     /* GiveBack is not supported */
-                    chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                    pdb_msg_free(cfg, cfg->pe._message);
                     cfg->pe._message = NULL;
                     return PESinkSendNotSupported;
                 }
@@ -514,13 +899,13 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
             /* Give sink capabilities when asked */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GET_SINK_CAP
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkGiveSinkCap;
             /* If the message was a Soft_Reset, do the soft reset procedure */
             } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
                     && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSoftReset;
             /* PD 3.0 messges */
@@ -529,19 +914,19 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
                  * time out. */
                 if ((cfg->pe._message->hdr & PD_HDR_EXT)
                         && (PD_DATA_SIZE_GET(cfg->pe._message) > PD_MAX_EXT_MSG_LEGACY_LEN)) {
-                    chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                    pdb_msg_free(cfg, cfg->pe._message);
                     cfg->pe._message = NULL;
                     return PESinkChunkReceived;
                 /* Tell the DPM a message we sent got a response of
                  * Not_Supported. */
                 } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_NOT_SUPPORTED
                         && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                    chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                    pdb_msg_free(cfg, cfg->pe._message);
                     cfg->pe._message = NULL;
                     return PESinkNotSupportedReceived;
                 /* If we got an unknown message, send a soft reset */
                 } else {
-                    chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                    pdb_msg_free(cfg, cfg->pe._message);
                     cfg->pe._message = NULL;
                     return PESinkSendSoftReset;
                 }
@@ -549,7 +934,7 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
              *
              * XXX I don't like that this is duplicated. */
             } else {
-                chPoolFree(&pdb_msg_pool, cfg->pe._message);
+                pdb_msg_free(cfg, cfg->pe._message);
                 cfg->pe._message = NULL;
                 return PESinkSendSoftReset;
             }
@@ -561,18 +946,26 @@ static enum policy_engine_state pe_sink_ready(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_get_source_cap(struct pdb_config *cfg)
 {
-    /* Get a message object */
-    union pd_msg *get_source_cap = chPoolAlloc(&pdb_msg_pool);
+    /* If a message we sent from the Sink Ready state failed, deal with that
+     * first */
+    enum policy_engine_state state = pe_tx_async_result(cfg, true);
+    if (state != PESinkReady) {
+        return state;
+    }
+
+    /* Get a message object.  If none is left, the request can't be sent,
+     * which is handled like failing to send it. */
+    union pd_msg *get_source_cap = chPoolAlloc(&cfg->msg_pool);
+    if (get_source_cap == NULL) {
+        return PESinkHardReset;
+    }
     /* Make a Get_Source_Cap message */
     get_source_cap->hdr = cfg->pe.hdr_template | PD_MSGTYPE_GET_SOURCE_CAP
         | PD_NUMOBJ(0);
     /* Transmit the Get_Source_Cap */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) get_source_cap, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
+    eventmask_t evt = pe_tx_send(cfg, get_source_cap);
     /* Free the sent message */
-    chPoolFree(&pdb_msg_pool, get_source_cap);
+    pdb_msg_free(cfg, get_source_cap);
     get_source_cap = NULL;
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -588,31 +981,23 @@ static enum policy_engine_state pe_sink_get_source_cap(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_give_sink_cap(struct pdb_config *cfg)
 {
-    /* Get a message object */
-    union pd_msg *snk_cap = chPoolAlloc(&pdb_msg_pool);
-    /* Get our capabilities from the DPM */
-    cfg->dpm.get_sink_capability(cfg, snk_cap);
-
-    /* Transmit our capabilities */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) snk_cap, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
-
-    /* Free the Sink_Capabilities message */
-    chPoolFree(&pdb_msg_pool, snk_cap);
-    snk_cap = NULL;
-
-    /* If we got reset signaling, transition to default */
-    if (evt & PDB_EVT_PE_RESET) {
-        return PESinkTransitionDefault;
+    /* Settle the message we sent before, giving its buffer back */
+    enum policy_engine_state state = pe_tx_async_result(cfg, true);
+    if (state != PESinkReady) {
+        return state;
     }
-    /* If the message transmission failed, send a hard reset */
-    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+
+    /* Get a message object.  If none is left, we can't answer, which is
+     * handled like failing to send the answer. */
+    union pd_msg *snk_cap = chPoolAlloc(&cfg->msg_pool);
+    if (snk_cap == NULL) {
         return PESinkHardReset;
     }
+    /* Get our capabilities from the DPM */
+    cfg->dpm.get_sink_capability(cfg, snk_cap);
 
-    return PESinkReady;
+    /* Transmit our capabilities, sending a hard reset if that fails */
+    return pe_tx_send_async(cfg, snk_cap, PESinkHardReset);
 }
 
 static enum policy_engine_state pe_sink_hard_reset(struct pdb_config *cfg)
@@ -623,6 +1008,9 @@ static enum policy_engine_state pe_sink_hard_reset(struct pdb_config *cfg)
         return PESinkSourceUnresponsive;
     }
 
+    /* Nothing will be transmitted until the hard reset is over */
+    pe_set_mask_profile(cfg, fusb_mask_hard_reset);
+
     /* Generate a hard reset signal */
     chEvtSignal(cfg->prl.hardrst_thread, PDB_EVT_HARDRST_RESET);
     chEvtWaitAny(PDB_EVT_PE_HARD_SENT);
@@ -637,6 +1025,10 @@ static enum policy_engine_state pe_sink_transition_default(struct pdb_config *cf
 {
     cfg->pe._explicit_contract = false;
 
+    /* A message sent from the Sink Ready state was made for the old
+     * contract, so whatever happened to it no longer matters */
+    (void) pe_tx_async_result(cfg, true);
+
     /* Tell the DPM to transition to default power */
     cfg->dpm.transition_default(cfg);
 
@@ -655,17 +1047,22 @@ static enum policy_engine_state pe_sink_soft_reset(struct pdb_config *cfg)
     /* No need to explicitly reset the protocol layer here.  It resets itself
      * when a Soft_Reset message is received. */
 
-    /* Get a message object */
-    union pd_msg *accept = chPoolAlloc(&pdb_msg_pool);
+    /* The source reset the protocol layer, so whatever happened to a message
+     * we sent from the Sink Ready state no longer matters */
+    (void) pe_tx_async_result(cfg, true);
+
+    /* Get a message object.  If none is left, the soft reset can't be
+     * accepted, so send a hard reset instead. */
+    union pd_msg *accept = chPoolAlloc(&cfg->msg_pool);
+    if (accept == NULL) {
+        return PESinkHardReset;
+    }
     /* Make an Accept message */
     accept->hdr = cfg->pe.hdr_template | PD_MSGTYPE_ACCEPT | PD_NUMOBJ(0);
     /* Transmit the Accept */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) accept, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
+    eventmask_t evt = pe_tx_send(cfg, accept);
     /* Free the sent message */
-    chPoolFree(&pdb_msg_pool, accept);
+    pdb_msg_free(cfg, accept);
     accept = NULL;
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -684,17 +1081,25 @@ static enum policy_engine_state pe_sink_send_soft_reset(struct pdb_config *cfg)
     /* No need to explicitly reset the protocol layer here.  It resets itself
      * just before a Soft_Reset message is transmitted. */
 
-    /* Get a message object */
-    union pd_msg *softrst = chPoolAlloc(&pdb_msg_pool);
+    /* If a message we sent from the Sink Ready state failed, deal with that
+     * first */
+    enum policy_engine_state state = pe_tx_async_result(cfg, true);
+    if (state != PESinkReady) {
+        return state;
+    }
+
+    /* Get a message object.  If none is left, the soft reset can't be sent,
+     * so send a hard reset instead. */
+    union pd_msg *softrst = chPoolAlloc(&cfg->msg_pool);
+    if (softrst == NULL) {
+        return PESinkHardReset;
+    }
     /* Make a Soft_Reset message */
     softrst->hdr = cfg->pe.hdr_template | PD_MSGTYPE_SOFT_RESET | PD_NUMOBJ(0);
     /* Transmit the soft reset */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) softrst, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
+    eventmask_t evt = pe_tx_send(cfg, softrst);
     /* Free the sent message */
-    chPoolFree(&pdb_msg_pool, softrst);
+    pdb_msg_free(cfg, softrst);
     softrst = NULL;
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -706,7 +1111,7 @@ static enum policy_engine_state pe_sink_send_soft_reset(struct pdb_config *cfg)
     }
 
     /* Wait for a response */
-    evt = chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
+    evt = pe_wait(cfg, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET,
             PD_T_SENDER_RESPONSE);
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
@@ -718,22 +1123,22 @@ static enum policy_engine_state pe_sink_send_soft_reset(struct pdb_config *cfg)
     }
 
     /* Get the response message */
-    if (chMBFetchTimeout(&cfg->pe.mailbox, (msg_t *) &cfg->pe._message, TIME_IMMEDIATE) == MSG_OK) {
+    if (pe_fetch_message(cfg, PESinkSendSoftReset) == MSG_OK) {
         /* If the source accepted our soft reset, wait for capabilities. */
         if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_ACCEPT
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkWaitCap;
         /* If the message was a Soft_Reset, do the soft reset procedure */
         } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
                 && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkSoftReset;
         /* Otherwise, send a hard reset */
         } else {
-            chPoolFree(&pdb_msg_pool, cfg->pe._message);
+            pdb_msg_free(cfg, cfg->pe._message);
             cfg->pe._message = NULL;
             return PESinkHardReset;
         }
@@ -743,8 +1148,18 @@ static enum policy_engine_state pe_sink_send_soft_reset(struct pdb_config *cfg)
 
 static enum policy_engine_state pe_sink_send_not_supported(struct pdb_config *cfg)
 {
-    /* Get a message object */
-    union pd_msg *not_supported = chPoolAlloc(&pdb_msg_pool);
+    /* Settle the message we sent before, giving its buffer back */
+    enum policy_engine_state state = pe_tx_async_result(cfg, true);
+    if (state != PESinkReady) {
+        return state;
+    }
+
+    /* Get a message object.  If none is left, we can't answer, which is
+     * handled like failing to send the answer. */
+    union pd_msg *not_supported = chPoolAlloc(&cfg->msg_pool);
+    if (not_supported == NULL) {
+        return PESinkSendSoftReset;
+    }
 
     if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_2_0) {
         /* Make a Reject message */
@@ -754,26 +1169,8 @@ static enum policy_engine_state pe_sink_send_not_supported(struct pdb_config *cf
         not_supported->hdr = cfg->pe.hdr_template | PD_MSGTYPE_NOT_SUPPORTED | PD_NUMOBJ(0);
     }
 
-    /* Transmit the message */
-    chMBPostTimeout(&cfg->prl.tx_mailbox, (msg_t) not_supported, TIME_IMMEDIATE);
-    chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
-    eventmask_t evt = chEvtWaitAny(PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR
-            | PDB_EVT_PE_RESET);
-
-    /* Free the message */
-    chPoolFree(&pdb_msg_pool, not_supported);
-    not_supported = NULL;
-
-    /* If we got reset signaling, transition to default */
-    if (evt & PDB_EVT_PE_RESET) {
-        return PESinkTransitionDefault;
-    }
-    /* If the message transmission failed, send a soft reset */
-    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
-        return PESinkSendSoftReset;
-    }
-
-    return PESinkReady;
+    /* Transmit the message, sending a soft reset if that fails */
+    return pe_tx_send_async(cfg, not_supported, PESinkSendSoftReset);
 }
 
 static enum policy_engine_state pe_sink_chunk_received(struct pdb_config *cfg)
@@ -807,11 +1204,16 @@ static enum policy_engine_state pe_sink_not_supported_received(struct pdb_config
  */
 static enum policy_engine_state pe_sink_source_unresponsive(struct pdb_config *cfg)
 {
+    /* The source won't talk to us, so don't poll INT_N often */
+    pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_IDLE);
+    /* Only a hard reset or an over-temperature matter now */
+    pe_set_mask_profile(cfg, fusb_mask_typec);
+
     /* If the DPM can evaluate the Type-C Current advertisement */
     if (cfg->dpm.evaluate_typec_current != NULL) {
         /* Make the DPM evaluate the Type-C Current advertisement */
         int tcc_match = cfg->dpm.evaluate_typec_current(cfg,
-                fusb_get_typec_current(&cfg->fusb));
+                cfg->phy->get_typec_current(cfg));
 
         /* If the last two readings are the same, set the output */
         if (cfg->pe._old_tcc_match == tcc_match) {
@@ -831,7 +1233,6 @@ static enum policy_engine_state pe_sink_source_unresponsive(struct pdb_config *c
 /*
  * Policy Engine state machine thread
  */
-static THD_WORKING_AREA(_wa, PDB_PE_WA_SIZE);
 static THD_FUNCTION(PolicyEngine, vcfg) {
 
     chRegSetThreadName("USB_PD-Policy_Engine");
@@ -839,8 +1240,8 @@ static THD_FUNCTION(PolicyEngine, vcfg) {
     struct pdb_config *cfg = vcfg;
     enum policy_engine_state state = PESinkReady;
 
-    /* Initialize the mailbox */
-    chMBObjectInit(&cfg->pe.mailbox, cfg->pe._mailbox_queue, PDB_MSG_POOL_SIZE);
+    /* Initialize the queue of received messages */
+    pdb_msg_ring_init(&cfg->pe.rx_queue);
     /* Initialize the VT for SinkPPSPeriodicTimer */
     chVTObjectInit(&cfg->pe._sink_pps_periodic_timer);
     /* Initialize the old_tcc_match */
@@ -853,8 +1254,15 @@ static THD_FUNCTION(PolicyEngine, vcfg) {
     cfg->pe.hdr_template = PD_DATAROLE_UFP | PD_POWERROLE_SINK;
 
     cfg->pe._min_power = false;
+    /* Don't directly fall into the case 3 of the Sink Ready state at
+     * startup */
+    cfg->pe._reconnect_time = chVTGetSystemTime() + PD_T_SINK_RECONECT;
+    /* Nothing was sent from the Sink Ready state yet */
+    cfg->pe._tx_async = NULL;
 
     while (true) {
+        pe_set_phase(cfg, pe_phase(state));
+
         switch (state) {
             case PESinkStartup:
                 state = pe_sink_startup(cfg);
@@ -918,6 +1326,6 @@ static THD_FUNCTION(PolicyEngine, vcfg) {
 
 void pdb_pe_run(struct pdb_config *cfg)
 {
-    cfg->pe.thread = chThdCreateStatic(_wa, sizeof(_wa),
+    cfg->pe.thread = chThdCreateStatic(cfg->pe._wa, sizeof(cfg->pe._wa),
             PDB_PRIO_PE, PolicyEngine, cfg);
 }
@@ -31,10 +31,13 @@
 #define PDB_EVT_PE_RESET EVENT_MASK(0)
 #define PDB_EVT_PE_MSG_RX EVENT_MASK(1)
 #define PDB_EVT_PE_TX_DONE EVENT_MASK(2)
+/* Never signaled: reported by the PE in place of PDB_EVT_PE_TX_DONE when a
+ * message failed to be sent */
 #define PDB_EVT_PE_TX_ERR EVENT_MASK(3)
 #define PDB_EVT_PE_HARD_SENT EVENT_MASK(4)
 #define PDB_EVT_PE_I_OVRTEMP EVENT_MASK(5)
 #define PDB_EVT_PE_PPS_REQUEST EVENT_MASK(6)
+#define PDB_EVT_PE_I_TOGDONE EVENT_MASK(9)
 
 
 /*
@@ -22,9 +22,11 @@
 #include <ch.h>
 
 /* PD Buddy thread priorities */
+#define PDB_PRIO_FUSB (NORMALPRIO + 11)
 #define PDB_PRIO_PE (NORMALPRIO + 10)
 #define PDB_PRIO_PRL (PDB_PRIO_PE - 1)
 #define PDB_PRIO_PRL_INT_N (PDB_PRIO_PRL - 1)
+#define PDB_PRIO_VBUS (PDB_PRIO_PRL_INT_N - 1)
 
 
 #endif /* PDB_PRIORITIES_H */
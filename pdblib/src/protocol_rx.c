@@ -28,7 +28,9 @@
 #include "priorities.h"
 #include "policy_engine.h"
 #include "protocol_tx.h"
+#include "int_n.h"
 #include "fusb302b.h"
+#include "messages.h"
 
 
 /*
@@ -36,19 +38,70 @@
  *
  * There is no Send_GoodCRC state because the PHY sends the GoodCRC for us.
  * All transitions that would go to that state instead go to Check_MessageID.
+ *
+ * Read_PHY_Message isn't in the specification: it reads a message that came
+ * in the PHY together with the previous one, without waiting for an
+ * interrupt.
  */
 enum protocol_rx_state {
     PRLRxWaitPHY,
+    PRLRxReadPHY,
     PRLRxReset,
     PRLRxCheckMessageID,
     PRLRxStoreMessageID
 };
 
+/*
+ * Wake up the policy engine once for all the messages passed to it since it
+ * was last signaled
+ */
+static void protocol_rx_flush(struct pdb_config *cfg)
+{
+    if (cfg->prl._rx_wake) {
+        cfg->prl._rx_wake = false;
+        chEvtSignal(cfg->pe.thread, PDB_EVT_PE_MSG_RX);
+    }
+}
+
+/*
+ * Find the state after a message was dealt with: read the next one if the
+ * PHY has one waiting, or wait for an interrupt otherwise
+ */
+static enum protocol_rx_state protocol_rx_next(struct pdb_config *cfg)
+{
+    if (cfg->phy->rx_pending == NULL || !cfg->phy->rx_pending(cfg)) {
+        return PRLRxWaitPHY;
+    }
+
+    cfg->prl._rx_ahead = true;
+    cfg->prl.rx_read_ahead++;
+    return PRLRxReadPHY;
+}
+
+/*
+ * Return whether a message is a retransmission of the last one we received
+ *
+ * A Soft_Reset never is, since it resets the stored MessageID.
+ */
+static bool protocol_rx_is_duplicate(struct pdb_config *cfg,
+        const union pd_msg *msg)
+{
+    if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_SOFT_RESET
+            && PD_NUMOBJ_GET(msg) == 0) {
+        return false;
+    }
+
+    return PD_MESSAGEID_GET(msg) == cfg->prl._rx_messageid;
+}
+
 /*
  * PRL_Rx_Wait_for_PHY_Message state
  */
 static enum protocol_rx_state protocol_rx_wait_phy(struct pdb_config *cfg)
 {
+    /* Tell the policy engine about the messages we just read */
+    protocol_rx_flush(cfg);
+
     /* Wait for an event */
     eventmask_t evt = chEvtWaitAny(ALL_EVENTS);
 
@@ -56,27 +109,101 @@ static enum protocol_rx_state protocol_rx_wait_phy(struct pdb_config *cfg)
     if (evt & PDB_EVT_PRLRX_RESET) {
         return PRLRxWaitPHY;
     }
-    /* If we got an I_GCRCSENT event, read the message and decide what to do */
+    /* If we got an I_GCRCSENT event, or a buffer was freed for the message
+     * we left in the PHY, read the message */
     if (evt & PDB_EVT_PRLRX_I_GCRCSENT) {
-        /* Get a buffer to read the message into.  Guaranteed to not fail
-         * because we have a big enough pool and are careful. */
-        cfg->prl._rx_message = chPoolAlloc(&pdb_msg_pool);
-        /* Read the message */
-        fusb_read_message(&cfg->fusb, cfg->prl._rx_message);
-        /* If it's a Soft_Reset, go to the soft reset state */
-        if (PD_MSGTYPE_GET(cfg->prl._rx_message) == PD_MSGTYPE_SOFT_RESET
-                && PD_NUMOBJ_GET(cfg->prl._rx_message) == 0) {
-            return PRLRxReset;
-        /* Otherwise, check the message ID */
-        } else {
-            return PRLRxCheckMessageID;
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_GCRCSENT);
+        /* If we read messages ahead of their interrupt, this one may have
+         * been read already */
+        if (cfg->prl._rx_ahead) {
+            cfg->prl._rx_ahead = false;
+            if (!cfg->phy->rx_pending(cfg)) {
+                return PRLRxWaitPHY;
+            }
         }
+        return PRLRxReadPHY;
+    }
+    if (evt & PDB_EVT_PRLRX_RETRY) {
+        /* The buffer may have been freed while we were getting one, in
+         * which case no message was left behind.  Without rx_pending, that's
+         * the only way to know there's nothing to read. */
+        if (!cfg->prl._rx_left) {
+            return PRLRxWaitPHY;
+        }
+        if (cfg->phy->rx_pending != NULL && !cfg->phy->rx_pending(cfg)) {
+            cfg->prl._rx_left = false;
+            return PRLRxWaitPHY;
+        }
+        return PRLRxReadPHY;
     }
 
     /* We shouldn't ever get here.  This just silence the compiler warning. */
     return PRLRxWaitPHY;
 }
 
+/*
+ * Read a message from the PHY and decide what to do
+ */
+static enum protocol_rx_state protocol_rx_read_phy(struct pdb_config *cfg)
+{
+    union pd_msg *msg;
+    uint8_t ret;
+
+    /* Get a buffer to read the message into before reading anything, so that
+     * no part of the message is taken out of the PHY without a place to put
+     * it.  This fails if the policy engine is slow to free the messages we
+     * gave it; the message is then left in the PHY and read as soon as
+     * pdb_msg_free gives a buffer back.  The flag is raised first so that a
+     * buffer freed right after chPoolAlloc failed isn't missed. */
+    cfg->prl._rx_starved = true;
+    msg = chPoolAlloc(&cfg->msg_pool);
+    if (msg == NULL) {
+        cfg->prl.rx_starved++;
+        cfg->prl._rx_left = true;
+        return PRLRxWaitPHY;
+    }
+    cfg->prl._rx_starved = false;
+    cfg->prl._rx_left = false;
+    cfg->prl._rx_message = msg;
+
+    /* If the PHY can give us the header alone, look at it first, and drop a
+     * retransmission without passing it through the rest of the machine.
+     * If the PHY couldn't give us the message, drop it; the source will
+     * retry since it won't get a GoodCRC, or it did get one and will go on
+     * without us seeing it. */
+    if (cfg->phy->read_header != NULL) {
+        ret = cfg->phy->read_header(cfg, msg);
+        if (ret == 0 && protocol_rx_is_duplicate(cfg, msg)) {
+            ret = cfg->phy->read_rest(cfg, msg);
+            chPoolFree(&cfg->msg_pool, msg);
+            cfg->prl._rx_message = NULL;
+            if (ret != 0) {
+                return PRLRxWaitPHY;
+            }
+            cfg->prl.rx_duplicates++;
+            return protocol_rx_next(cfg);
+        }
+        if (ret == 0) {
+            ret = cfg->phy->read_rest(cfg, msg);
+        }
+    } else {
+        ret = cfg->phy->read_message(cfg, msg);
+    }
+    if (ret != 0) {
+        chPoolFree(&cfg->msg_pool, cfg->prl._rx_message);
+        cfg->prl._rx_message = NULL;
+        return PRLRxWaitPHY;
+    }
+    /* If it's a Soft_Reset, go to the soft reset state */
+    if (PD_MSGTYPE_GET(cfg->prl._rx_message) == PD_MSGTYPE_SOFT_RESET
+            && PD_NUMOBJ_GET(cfg->prl._rx_message) == 0) {
+        return PRLRxReset;
+    /* Otherwise, check the message ID */
+    } else {
+        return PRLRxCheckMessageID;
+    }
+}
+
 /*
  * PRL_Rx_Layer_Reset_for_Receive state
  */
@@ -94,7 +221,7 @@ static enum protocol_rx_state protocol_rx_reset(struct pdb_config *cfg)
 
     /* If we got a RESET signal, reset the machine */
     if (chEvtGetAndClearEvents(PDB_EVT_PRLRX_RESET) != 0) {
-        chPoolFree(&pdb_msg_pool, cfg->prl._rx_message);
+        chPoolFree(&cfg->msg_pool, cfg->prl._rx_message);
         cfg->prl._rx_message = NULL;
         return PRLRxWaitPHY;
     }
@@ -110,17 +237,18 @@ static enum protocol_rx_state protocol_rx_check_messageid(struct pdb_config *cfg
 {
     /* If we got a RESET signal, reset the machine */
     if (chEvtGetAndClearEvents(PDB_EVT_PRLRX_RESET) != 0) {
-        chPoolFree(&pdb_msg_pool, cfg->prl._rx_message);
+        chPoolFree(&cfg->msg_pool, cfg->prl._rx_message);
         cfg->prl._rx_message = NULL;
         return PRLRxWaitPHY;
     }
 
     /* If the message has the stored ID, we've seen this message before.  Free
      * it and don't pass it to the policy engine. */
-    if (PD_MESSAGEID_GET(cfg->prl._rx_message) == cfg->prl._rx_messageid) {
-        chPoolFree(&pdb_msg_pool, cfg->prl._rx_message);
+    if (protocol_rx_is_duplicate(cfg, cfg->prl._rx_message)) {
+        chPoolFree(&cfg->msg_pool, cfg->prl._rx_message);
         cfg->prl._rx_message = NULL;
-        return PRLRxWaitPHY;
+        cfg->prl.rx_duplicates++;
+        return protocol_rx_next(cfg);
     /* Otherwise, there's either no stored ID or this message has an ID we
      * haven't just seen.  Transition to the Store_MessageID state. */
     } else {
@@ -140,19 +268,21 @@ static enum protocol_rx_state protocol_rx_store_messageid(struct pdb_config *cfg
     /* Update the stored MessageID */
     cfg->prl._rx_messageid = PD_MESSAGEID_GET(cfg->prl._rx_message);
 
-    /* Pass the message to the policy engine. */
-    chMBPostTimeout(&cfg->pe.mailbox, (msg_t) cfg->prl._rx_message, TIME_IMMEDIATE);
-    chEvtSignal(cfg->pe.thread, PDB_EVT_PE_MSG_RX);
+    /* Pass the message to the policy engine.  It's woken up once we have
+     * read every message waiting in the PHY. */
+    if (pdb_msg_ring_push(&cfg->pe.rx_queue, cfg->prl._rx_message)) {
+        cfg->prl._rx_wake = true;
+    }
+    cfg->prl._rx_message = NULL;
 
     /* Don't check if we got a RESET because we'd do nothing different. */
 
-    return PRLRxWaitPHY;
+    return protocol_rx_next(cfg);
 }
 
 /*
  * Protocol layer RX state machine thread
  */
-static THD_WORKING_AREA(_rx_wa, PDB_PRLRX_WA_SIZE);
 static THD_FUNCTION(ProtocolRX, cfg) {
 
     chRegSetThreadName("USB_PD-Protocol_RX");
@@ -164,6 +294,9 @@ static THD_FUNCTION(ProtocolRX, cfg) {
             case PRLRxWaitPHY:
                 state = protocol_rx_wait_phy(cfg);
                 break;
+            case PRLRxReadPHY:
+                state = protocol_rx_read_phy(cfg);
+                break;
             case PRLRxReset:
                 state = protocol_rx_reset(cfg);
                 break;
@@ -185,6 +318,6 @@ void pdb_prlrx_run(struct pdb_config *cfg)
 {
     cfg->prl._rx_messageid = -1;
 
-    cfg->prl.rx_thread = chThdCreateStatic(_rx_wa,
-            sizeof(_rx_wa), PDB_PRIO_PRL, ProtocolRX, cfg);
+    cfg->prl.rx_thread = chThdCreateStatic(cfg->prl._rx_wa,
+            sizeof(cfg->prl._rx_wa), PDB_PRIO_PRL, ProtocolRX, cfg);
 }
@@ -28,6 +28,7 @@
 /* Events for the Protocol RX thread */
 #define PDB_EVT_PRLRX_RESET EVENT_MASK(0)
 #define PDB_EVT_PRLRX_I_GCRCSENT EVENT_MASK(1)
+#define PDB_EVT_PRLRX_RETRY EVENT_MASK(2)
 
 /*
  * Start the Protocol RX thread
@@ -26,7 +26,9 @@
 #include "priorities.h"
 #include "policy_engine.h"
 #include "protocol_rx.h"
+#include "int_n.h"
 #include "fusb302b.h"
+#include "messages.h"
 
 
 /*
@@ -49,22 +51,85 @@ enum protocol_tx_state {
 };
 
 
+#if PDB_USE_STATS
 /*
- * PRL_Tx_PHY_Layer_Reset state
+ * Record that the TX thread started working on a message
  */
-static enum protocol_tx_state protocol_tx_phy_reset(struct pdb_config *cfg)
+static void protocol_tx_stat_start(struct pdb_config *cfg)
 {
-    /* Reset the PHY */
-    fusb_reset(&cfg->fusb);
+    cfg->prl._tx_start = pdb_stats_now();
+}
+
+/*
+ * Record that the TX thread is done with the message of token
+ */
+static void protocol_tx_stat_done(struct pdb_config *cfg, uint8_t token)
+{
+    cfg->prl.tx_msgs++;
+    cfg->prl.tx_busy += pdb_stats_now() - cfg->prl._tx_start;
+    pdb_hist_add(&cfg->prl.tx_latency,
+            cfg->prl._tx_submit_time[token % PDB_PRL_TX_TOKENS]);
+}
+
+#define PROTOCOL_TX_STAT_START(cfg) protocol_tx_stat_start(cfg)
+#define PROTOCOL_TX_STAT_DONE(cfg, token) protocol_tx_stat_done(cfg, token)
+#else
+#define PROTOCOL_TX_STAT_START(cfg) do {} while (0)
+#define PROTOCOL_TX_STAT_DONE(cfg, token) do {} while (0)
+#endif
 
+/*
+ * Report the result of the oldest message submitted we weren't done with,
+ * and wake up the policy engine
+ */
+static void protocol_tx_complete(struct pdb_config *cfg, bool sent)
+{
+    uint8_t token = cfg->prl._tx_completed;
+    uint32_t bit = 1U << (token % PDB_PRL_TX_TOKENS);
+
+    PROTOCOL_TX_STAT_DONE(cfg, token);
+
+    if (sent) {
+        cfg->prl._tx_failed &= ~bit;
+    } else {
+        cfg->prl._tx_failed |= bit;
+    }
+    /* Publish the result before saying we're done with the message */
+    __sync_synchronize();
+    cfg->prl._tx_completed = token + 1;
+
+    chEvtSignal(cfg->pe.thread, PDB_EVT_PE_TX_DONE);
+}
+
+/*
+ * Fail the message being sent and the ones queued behind it
+ */
+static void protocol_tx_fail_all(struct pdb_config *cfg)
+{
     /* If a message was pending when we got here, tell the policy engine that
      * we failed to send it */
     if (cfg->prl._tx_message != NULL) {
-        /* Tell the policy engine that we failed */
-        chEvtSignal(cfg->pe.thread, PDB_EVT_PE_TX_ERR);
+        protocol_tx_complete(cfg, false);
         /* Finish failing to send the message */
         cfg->prl._tx_message = NULL;
     }
+    /* The messages queued behind it were made before whatever reset us, so
+     * fail them too */
+    while (pdb_msg_ring_pop(&cfg->prl.tx_queue) != NULL) {
+        PROTOCOL_TX_STAT_START(cfg);
+        protocol_tx_complete(cfg, false);
+    }
+}
+
+/*
+ * PRL_Tx_PHY_Layer_Reset state
+ */
+static enum protocol_tx_state protocol_tx_phy_reset(struct pdb_config *cfg)
+{
+    /* Reset the PHY */
+    cfg->phy->reset(cfg);
+
+    protocol_tx_fail_all(cfg);
 
     /* Wait for a message request */
     return PRLTxWaitMessage;
@@ -82,14 +147,22 @@ static enum protocol_tx_state protocol_tx_wait_message(struct pdb_config *cfg)
     if (evt & PDB_EVT_PRLTX_RESET) {
         return PRLTxPHYReset;
     }
-    if (evt & PDB_EVT_PRLTX_DISCARD) {
-        return PRLTxDiscardMessage;
-    }
+    /* A discard needs no handling here, since nothing is being sent */
 
     /* If the policy engine is trying to send a message */
     if (evt & PDB_EVT_PRLTX_MSG_TX) {
-        /* Get the message */
-        chMBFetchTimeout(&cfg->prl.tx_mailbox, (msg_t *) &cfg->prl._tx_message, TIME_IMMEDIATE);
+        /* We'll need the PHY's answer quickly, so poll INT_N faster */
+        pdb_int_n_set_rate(cfg, PDB_INT_N_RATE_FAST);
+        /* Get the message, and look for the next one right away if the
+         * policy engine queued more */
+        cfg->prl._tx_message = pdb_msg_ring_pop(&cfg->prl.tx_queue);
+        if (cfg->prl._tx_message == NULL) {
+            return PRLTxWaitMessage;
+        }
+        PROTOCOL_TX_STAT_START(cfg);
+        if (!pdb_msg_ring_empty(&cfg->prl.tx_queue)) {
+            chEvtAddEvents(PDB_EVT_PRLTX_MSG_TX);
+        }
         /* If it's a Soft_Reset, reset the TX layer first */
         if (PD_MSGTYPE_GET(cfg->prl._tx_message) == PD_MSGTYPE_SOFT_RESET
                 && PD_NUMOBJ_GET(cfg->prl._tx_message) == 0) {
@@ -100,8 +173,8 @@ static enum protocol_tx_state protocol_tx_wait_message(struct pdb_config *cfg)
         }
     }
 
-    /* Silence the compiler warning */
-    return PRLTxDiscardMessage;
+    /* Only a discard woke us up */
+    return PRLTxWaitMessage;
 }
 
 static enum protocol_tx_state protocol_tx_reset(struct pdb_config *cfg)
@@ -140,14 +213,17 @@ static enum protocol_tx_state protocol_tx_construct_message(struct pdb_config *c
         /* If we're starting an AMS, wait for permission to transmit */
         evt = chEvtGetAndClearEvents(PDB_EVT_PRLTX_START_AMS);
         if (evt & PDB_EVT_PRLTX_START_AMS) {
-            while (fusb_get_typec_current(&cfg->fusb) != fusb_sink_tx_ok) {
+            while (cfg->phy->get_typec_current(cfg) != fusb_sink_tx_ok) {
                 chThdSleepMilliseconds(1);
             }
         }
     }
 
-    /* Send the message to the PHY */
-    fusb_send_message(&cfg->fusb, cfg->prl._tx_message);
+    /* Send the message to the PHY.  If it couldn't be handed over, it wasn't
+     * sent at all. */
+    if (cfg->phy->send_message(cfg, cfg->prl._tx_message) != MSG_OK) {
+        return PRLTxTransmissionError;
+    }
 
     return PRLTxWaitResponse;
 }
@@ -157,7 +233,6 @@ static enum protocol_tx_state protocol_tx_construct_message(struct pdb_config *c
  */
 static enum protocol_tx_state protocol_tx_wait_response(struct pdb_config *cfg)
 {
-    (void) cfg;
     /* Wait for an event.  There is no need to run CRCReceiveTimer, since the
      * FUSB302B handles that as part of its retry mechanism. */
     eventmask_t evt = chEvtWaitAny(PDB_EVT_PRLTX_RESET | PDB_EVT_PRLTX_DISCARD
@@ -166,18 +241,23 @@ static enum protocol_tx_state protocol_tx_wait_response(struct pdb_config *cfg)
     if (evt & PDB_EVT_PRLTX_RESET) {
         return PRLTxPHYReset;
     }
-    if (evt & PDB_EVT_PRLTX_DISCARD) {
-        return PRLTxDiscardMessage;
-    }
 
-    /* If the message was sent successfully */
+    /* If the message was sent successfully.  This is checked before a
+     * discard: when the answer to our message comes in the same status read
+     * as its GoodCRC, the RX thread asks for the discard first, but our
+     * message was already through. */
     if (evt & PDB_EVT_PRLTX_I_TXSENT) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_TXSENT);
         return PRLTxMatchMessageID;
     }
     /* If the message failed to be sent */
     if (evt & PDB_EVT_PRLTX_I_RETRYFAIL) {
+        PDB_INT_N_STAT_WAKEUP(cfg, PDB_INT_N_SRC_RETRYFAIL);
         return PRLTxTransmissionError;
     }
+    if (evt & PDB_EVT_PRLTX_DISCARD) {
+        return PRLTxDiscardMessage;
+    }
 
     /* Silence the compiler warning */
     return PRLTxDiscardMessage;
@@ -189,9 +269,17 @@ static enum protocol_tx_state protocol_tx_wait_response(struct pdb_config *cfg)
 static enum protocol_tx_state protocol_tx_match_messageid(struct pdb_config *cfg)
 {
     union pd_msg goodcrc;
+    uint8_t ret;
 
     /* Read the GoodCRC */
-    fusb_read_message(&cfg->fusb, &goodcrc);
+    if (cfg->phy->read_goodcrc != NULL) {
+        ret = cfg->phy->read_goodcrc(cfg, &goodcrc);
+    } else {
+        ret = cfg->phy->read_message(cfg, &goodcrc);
+    }
+    if (ret != 0) {
+        return PRLTxTransmissionError;
+    }
 
     /* Check that the message is correct */
     if (PD_MSGTYPE_GET(&goodcrc) == PD_MSGTYPE_GOODCRC
@@ -209,7 +297,7 @@ static enum protocol_tx_state protocol_tx_transmission_error(struct pdb_config *
     cfg->prl._tx_messageidcounter = (cfg->prl._tx_messageidcounter + 1) % 8;
 
     /* Tell the policy engine that we failed */
-    chEvtSignal(cfg->pe.thread, PDB_EVT_PE_TX_ERR);
+    protocol_tx_complete(cfg, false);
 
     cfg->prl._tx_message = NULL;
     return PRLTxWaitMessage;
@@ -221,26 +309,44 @@ static enum protocol_tx_state protocol_tx_message_sent(struct pdb_config *cfg)
     cfg->prl._tx_messageidcounter = (cfg->prl._tx_messageidcounter + 1) % 8;
 
     /* Tell the policy engine that we succeeded */
-    chEvtSignal(cfg->pe.thread, PDB_EVT_PE_TX_DONE);
+    protocol_tx_complete(cfg, true);
 
     cfg->prl._tx_message = NULL;
     return PRLTxWaitMessage;
 }
 
+/*
+ * PRL_Tx_Discard_Message state
+ *
+ * Only the message being sent is dropped.  Resetting the PHY here would also
+ * flush the message whose reception made us discard, along with any other
+ * received one still waiting to be read.
+ */
 static enum protocol_tx_state protocol_tx_discard_message(struct pdb_config *cfg)
 {
-    /* If we were working on sending a message, increment MessageIDCounter */
-    if (cfg->prl._tx_message != NULL) {
-        cfg->prl._tx_messageidcounter = (cfg->prl._tx_messageidcounter + 1) % 8;
+    /* This state is only entered while sending a message, but check anyway */
+    if (cfg->prl._tx_message == NULL) {
+        return PRLTxWaitMessage;
     }
 
-    return PRLTxPHYReset;
+    /* Increment MessageIDCounter */
+    cfg->prl._tx_messageidcounter = (cfg->prl._tx_messageidcounter + 1) % 8;
+
+    /* Take the message back from the PHY if it can, and forget what it said
+     * about it */
+    if (cfg->phy->flush_tx != NULL) {
+        cfg->phy->flush_tx(cfg);
+    }
+    chEvtGetAndClearEvents(PDB_EVT_PRLTX_I_TXSENT | PDB_EVT_PRLTX_I_RETRYFAIL);
+
+    protocol_tx_fail_all(cfg);
+
+    return PRLTxWaitMessage;
 }
 
 /*
  * Protocol layer TX state machine thread
  */
-static THD_WORKING_AREA(_tx_wa, PDB_PRLTX_WA_SIZE);
 static THD_FUNCTION(ProtocolTX, vcfg) {
 
     chRegSetThreadName("USB_PD-Protocol_TX");
@@ -249,8 +355,11 @@ static THD_FUNCTION(ProtocolTX, vcfg) {
 
     enum protocol_tx_state state = PRLTxPHYReset;
 
-    /* Initialize the mailbox */
-    chMBObjectInit(&cfg->prl.tx_mailbox, cfg->prl._tx_mailbox_queue, PDB_MSG_POOL_SIZE);
+    /* Initialize the queue of messages to send */
+    pdb_msg_ring_init(&cfg->prl.tx_queue);
+    /* Nothing was submitted yet */
+    cfg->prl._tx_submitted = 0;
+    cfg->prl._tx_completed = 0;
 
     while (true) {
         switch (state) {
@@ -291,6 +400,32 @@ static THD_FUNCTION(ProtocolTX, vcfg) {
 
 void pdb_prltx_run(struct pdb_config *cfg)
 {
-    cfg->prl.tx_thread = chThdCreateStatic(_tx_wa,
-            sizeof(_tx_wa), PDB_PRIO_PRL, ProtocolTX, cfg);
+    cfg->prl.tx_thread = chThdCreateStatic(cfg->prl._tx_wa,
+            sizeof(cfg->prl._tx_wa), PDB_PRIO_PRL, ProtocolTX, cfg);
+}
+
+uint8_t pdb_prltx_submit(struct pdb_config *cfg, union pd_msg *msg)
+{
+    uint8_t token = cfg->prl._tx_submitted++;
+
+#if PDB_USE_STATS
+    cfg->prl._tx_submit_time[token % PDB_PRL_TX_TOKENS] = pdb_stats_now();
+#endif
+    if (pdb_msg_ring_push(&cfg->prl.tx_queue, msg)) {
+        chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_MSG_TX);
+    }
+
+    return token;
+}
+
+bool pdb_prltx_done(struct pdb_config *cfg, uint8_t token)
+{
+    return (int8_t) (cfg->prl._tx_completed - token) > 0;
+}
+
+bool pdb_prltx_sent(struct pdb_config *cfg, uint8_t token)
+{
+    /* Read the result only after seeing the message done */
+    __sync_synchronize();
+    return !(cfg->prl._tx_failed & (1U << (token % PDB_PRL_TX_TOKENS)));
 }
@@ -19,6 +19,7 @@
 #define PDB_PROTOCOL_TX_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <ch.h>
 
@@ -39,5 +40,27 @@
  */
 void pdb_prltx_run(struct pdb_config *cfg);
 
+/*
+ * Queue a message for the Protocol TX thread to send.  Only called by the
+ * Policy Engine.
+ *
+ * Returns the message's token.  The messages are sent in the order they are
+ * submitted, and their results come back in the same order.  The message
+ * belongs to the Protocol TX thread until pdb_prltx_done returns true for
+ * its token, which is signaled with PDB_EVT_PE_TX_DONE.
+ */
+uint8_t pdb_prltx_submit(struct pdb_config *cfg, union pd_msg *msg);
+
+/*
+ * Return whether the Protocol TX thread is done with the message of token
+ */
+bool pdb_prltx_done(struct pdb_config *cfg, uint8_t token);
+
+/*
+ * Return whether the message of token was sent.  Only meaningful once
+ * pdb_prltx_done returned true for it.
+ */
+bool pdb_prltx_sent(struct pdb_config *cfg, uint8_t token);
+
 
 #endif /* PDB_PROTOCOL_TX_H */
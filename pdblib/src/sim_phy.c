@@ -0,0 +1,682 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pdb_sim.h>
+
+#if PDB_USE_SIM_PHY
+
+#include <string.h>
+
+#include <ch.h>
+
+#include <pdb.h>
+#include <pd.h>
+#include "policy_engine.h"
+#include "protocol_rx.h"
+#include "protocol_tx.h"
+#include "hard_reset.h"
+#include "int_n.h"
+#include "fusb302b.h"
+#include "messages.h"
+
+
+/*
+ * Capabilities of the simulated source: 5 V at 3 A and 9 V at 2 A
+ */
+static const uint32_t sim_src_caps[] = {
+    PD_PDO_TYPE_FIXED | (PD_MV2PDV(5000) << PD_PDO_SRC_FIXED_VOLTAGE_SHIFT)
+        | (PD_MA2PDI(3000) << PD_PDO_SRC_FIXED_CURRENT_SHIFT),
+    PD_PDO_TYPE_FIXED | (PD_MV2PDV(9000) << PD_PDO_SRC_FIXED_VOLTAGE_SHIFT)
+        | (PD_MA2PDI(2000) << PD_PDO_SRC_FIXED_CURRENT_SHIFT)
+};
+
+#define SIM_SRC_NUM_CAPS (sizeof(sim_src_caps) / sizeof(sim_src_caps[0]))
+
+/*
+ * Raise interrupts of a simulated PHY
+ *
+ * If the port has an INT_N thread, they're latched for it to read.
+ * Otherwise they're signaled straight to the threads that handle them.
+ */
+static void sim_raise(struct pdb_config *cfg, uint8_t interrupta,
+        uint8_t interruptb)
+{
+#if !PDB_FUSB_USE_ASYNC
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    if (cfg->int_n.thread != NULL) {
+        chSysLock();
+        sim->_interrupta |= interrupta;
+        sim->_interruptb |= interruptb;
+        chSysUnlock();
+        pdb_int_n_wake(cfg);
+        return;
+    }
+#endif
+
+    if (interrupta & FUSB_INTERRUPTA_I_TXSENT) {
+        chEvtSignal(cfg->prl.tx_thread, PDB_EVT_PRLTX_I_TXSENT);
+    }
+    if (interrupta & FUSB_INTERRUPTA_I_HARDSENT) {
+        chEvtSignal(cfg->prl.hardrst_thread, PDB_EVT_HARDRST_I_HARDSENT);
+    }
+    if (interruptb & FUSB_INTERRUPTB_I_GCRCSENT) {
+        chEvtSignal(cfg->prl.rx_thread, PDB_EVT_PRLRX_I_GCRCSENT);
+    }
+}
+
+/*
+ * Put a message from the simulated source in the RX FIFO
+ *
+ * The message is a control message if numobj is 0.
+ */
+static void sim_src_inject(struct pdb_config *cfg, uint8_t type,
+        const uint32_t *obj, uint8_t numobj)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    union pd_msg msg;
+
+    msg.hdr = type | PD_NUMOBJ(numobj) | PD_DATAROLE_DFP
+        | PD_POWERROLE_SOURCE | PD_SPECREV_2_0
+        | (sim->_src_messageid << PD_HDR_MESSAGEID_SHIFT);
+    memcpy(msg.obj, obj, numobj * 4);
+    sim->_src_messageid = (sim->_src_messageid + 1) % 8;
+
+    pdb_sim_inject(cfg, &msg);
+}
+
+/*
+ * Answer a message the sink sent, like a source would, reporting the answers
+ * with a single I_GCRCSENT
+ */
+static void sim_src_answer(struct pdb_config *cfg, const union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    uint8_t objpos;
+
+    if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_REQUEST
+            && PD_NUMOBJ_GET(msg) > 0) {
+        objpos = PD_RDO_OBJPOS_GET(msg);
+        /* Take any request for one of our PDOs within its current */
+        if (objpos >= 1 && objpos <= SIM_SRC_NUM_CAPS
+                && ((msg->obj[0] & PD_RDO_FV_CURRENT)
+                    >> PD_RDO_FV_CURRENT_SHIFT)
+                <= PD_PDO_SRC_FIXED_CURRENT_GET(sim_src_caps[objpos - 1])) {
+            sim_src_inject(cfg, PD_MSGTYPE_ACCEPT, NULL, 0);
+            sim_src_inject(cfg, PD_MSGTYPE_PS_RDY, NULL, 0);
+            sim->contract_pdo = objpos;
+            sim->contracts++;
+        } else {
+            sim_src_inject(cfg, PD_MSGTYPE_REJECT, NULL, 0);
+        }
+    } else if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_GET_SOURCE_CAP
+            && PD_NUMOBJ_GET(msg) == 0) {
+        sim_src_inject(cfg, PD_MSGTYPE_SOURCE_CAPABILITIES, sim_src_caps,
+                SIM_SRC_NUM_CAPS);
+    } else if (PD_MSGTYPE_GET(msg) == PD_MSGTYPE_SOFT_RESET
+            && PD_NUMOBJ_GET(msg) == 0) {
+        sim->_src_messageid = 0;
+        sim_src_inject(cfg, PD_MSGTYPE_ACCEPT, NULL, 0);
+        sim_src_inject(cfg, PD_MSGTYPE_SOURCE_CAPABILITIES, sim_src_caps,
+                SIM_SRC_NUM_CAPS);
+    } else {
+        /* Nothing else needs an answer */
+        return;
+    }
+
+    sim_raise(cfg, 0, FUSB_INTERRUPTB_I_GCRCSENT);
+}
+
+
+/*
+ * Simulated PHY operations
+ */
+
+static msg_t sim_setup(struct pdb_config *cfg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    chSysLock();
+    sim->_rx_in = 0;
+    sim->_rx_out = 0;
+    sim->_rx_header_read = false;
+    sim->_interrupta = 0;
+    sim->_interruptb = 0;
+    chSysUnlock();
+
+    return MSG_OK;
+}
+
+static msg_t sim_ok(struct pdb_config *cfg)
+{
+    (void) cfg;
+
+    return MSG_OK;
+}
+
+static msg_t sim_reset(struct pdb_config *cfg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    /* Flush the RX FIFO */
+    chSysLock();
+    sim->_rx_out = sim->_rx_in;
+    sim->_rx_header_read = false;
+    chSysUnlock();
+
+    return MSG_OK;
+}
+
+static msg_t sim_send_message(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    sim->_tx_messageid = PD_MESSAGEID_GET(msg);
+    sim->tx_msgs++;
+
+    /* The source got it right away and answered with a GoodCRC */
+    sim_raise(cfg, FUSB_INTERRUPTA_I_TXSENT, 0);
+
+    if (sim->_source) {
+        sim_src_answer(cfg, msg);
+    }
+
+    return MSG_OK;
+}
+
+static msg_t sim_send_hardrst(struct pdb_config *cfg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    sim->hard_resets++;
+    sim_raise(cfg, FUSB_INTERRUPTA_I_HARDSENT, 0);
+
+    return MSG_OK;
+}
+
+static uint8_t sim_read_header(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    uint8_t ret = 1;
+
+    chSysLock();
+    if (sim->_rx_out != sim->_rx_in) {
+        msg->hdr = sim->_rx[sim->_rx_out % PDB_SIM_RX_LEN].hdr;
+        sim->_rx_header_read = true;
+        ret = 0;
+    }
+    chSysUnlock();
+
+    return ret;
+}
+
+static uint8_t sim_read_rest(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    const union pd_msg *in;
+
+    if (!sim->_rx_header_read) {
+        return 1;
+    }
+
+    /* The slot is only reused once we moved past it, so it can be copied
+     * without locking */
+    in = &sim->_rx[sim->_rx_out % PDB_SIM_RX_LEN];
+    memcpy(msg->obj, in->obj, PD_NUMOBJ_GET(in) * 4);
+
+    chSysLock();
+    sim->_rx_header_read = false;
+    sim->_rx_out++;
+    chSysUnlock();
+    sim->rx_msgs++;
+
+    return 0;
+}
+
+static uint8_t sim_read_message(struct pdb_config *cfg, union pd_msg *msg)
+{
+    if (sim_read_header(cfg, msg) != 0) {
+        return 1;
+    }
+
+    return sim_read_rest(cfg, msg);
+}
+
+static bool sim_rx_pending(struct pdb_config *cfg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    return sim->_rx_out != sim->_rx_in;
+}
+
+static uint8_t sim_read_goodcrc(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    msg->hdr = PD_MSGTYPE_GOODCRC | PD_NUMOBJ(0)
+        | (sim->_tx_messageid << PD_HDR_MESSAGEID_SHIFT);
+
+    return 0;
+}
+
+static msg_t sim_get_status(struct pdb_config *cfg, union fusb_status *status)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    /* Reading the interrupts clears them, like on the FUSB302B */
+    memset(status, 0, sizeof(*status));
+    chSysLock();
+    status->interrupta = sim->_interrupta;
+    status->interruptb = sim->_interruptb;
+    sim->_interrupta = 0;
+    sim->_interruptb = 0;
+    chSysUnlock();
+
+    return MSG_OK;
+}
+
+static bool sim_int_n_asserted(struct pdb_config *cfg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    return sim->_interrupta != 0 || sim->_interruptb != 0;
+}
+
+static enum fusb_typec_current sim_get_typec_current(struct pdb_config *cfg)
+{
+    (void) cfg;
+
+    return fusb_sink_tx_ok;
+}
+
+const struct pdb_phy_ops pdb_sim_phy = {
+    .setup = sim_setup,
+    .send_message = sim_send_message,
+    .read_message = sim_read_message,
+    .read_header = sim_read_header,
+    .read_rest = sim_read_rest,
+    .rx_pending = sim_rx_pending,
+    .read_goodcrc = sim_read_goodcrc,
+    .send_hardrst = sim_send_hardrst,
+    .get_status = sim_get_status,
+    .get_status_locked = NULL,
+    .int_n_asserted = sim_int_n_asserted,
+    .update_cc = sim_ok,
+    .get_typec_current = sim_get_typec_current,
+    .reset = sim_reset,
+    /* Messages are sent as soon as they're handed over */
+    .flush_tx = NULL,
+    .set_mask_profile = NULL,
+    .count_masked_irqs = NULL,
+    .measure_vbus = NULL,
+    .get_vbus = NULL,
+    .enter_detached = NULL,
+    .attach = NULL,
+    .set_phase = NULL
+};
+
+
+/*
+ * Simulated port
+ */
+
+void pdb_sim_start(struct pdb_config *cfg)
+{
+    union pd_msg *msg;
+
+    cfg->pe.thread = chThdGetSelfX();
+
+    if (cfg->prl.rx_thread == NULL) {
+        pdb_msg_pool_init(cfg);
+        pdb_msg_ring_init(&cfg->pe.rx_queue);
+        cfg->pe.hdr_template = PD_DATAROLE_UFP | PD_POWERROLE_SINK
+            | PD_SPECREV_2_0;
+        cfg->phy->setup(cfg);
+
+        pdb_prlrx_run(cfg);
+        pdb_prltx_run(cfg);
+    }
+
+    /* Free the messages the last thread didn't take, and forget what it was
+     * told */
+    while ((msg = pdb_msg_ring_pop(&cfg->pe.rx_queue)) != NULL) {
+        pdb_msg_free(cfg, msg);
+    }
+    chEvtGetAndClearEvents(PDB_EVT_PE_MSG_RX | PDB_EVT_PE_TX_DONE);
+}
+
+bool pdb_sim_inject(struct pdb_config *cfg, const union pd_msg *msg)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    bool ret = false;
+
+    chSysLock();
+    if (sim->_rx_in - sim->_rx_out < PDB_SIM_RX_LEN) {
+        sim->_rx[sim->_rx_in % PDB_SIM_RX_LEN] = *msg;
+        sim->_rx_in++;
+        ret = true;
+    }
+    chSysUnlock();
+
+    return ret;
+}
+
+void pdb_sim_gcrcsent(struct pdb_config *cfg)
+{
+    chEvtSignal(cfg->prl.rx_thread, PDB_EVT_PRLRX_I_GCRCSENT);
+}
+
+bool pdb_sim_rx_stress(struct pdb_config *cfg, uint16_t bursts,
+        struct pdb_sim_rx_result *res)
+{
+    union pd_msg msg;
+    union pd_msg *rx;
+    uint32_t duplicates;
+    uint32_t starved;
+    uint8_t messageid;
+    systime_t start;
+
+    pdb_sim_start(cfg);
+
+    memset(res, 0, sizeof(*res));
+    duplicates = cfg->prl.rx_duplicates;
+    starved = cfg->prl.rx_starved;
+    /* Go on from the MessageID the RX thread saw last */
+    messageid = cfg->prl._rx_messageid < 0 ? 7 : cfg->prl._rx_messageid;
+    start = chVTGetSystemTimeX();
+
+    for (uint16_t burst = 0; burst < bursts; burst++) {
+        /* Fill the FIFO, sending the last message twice like a source that
+         * missed our GoodCRC.  The first data object numbers the message. */
+        for (uint8_t i = 0; i < PDB_SIM_RX_LEN; i++) {
+            if (i < PDB_SIM_RX_LEN - 1) {
+                messageid = (messageid + 1) % 8;
+                res->sent++;
+            }
+            msg.hdr = PD_MSGTYPE_VENDOR_DEFINED | PD_NUMOBJ(1)
+                | PD_DATAROLE_DFP | PD_POWERROLE_SOURCE | PD_SPECREV_2_0
+                | (messageid << PD_HDR_MESSAGEID_SHIFT);
+            msg.obj[0] = res->sent;
+            pdb_sim_inject(cfg, &msg);
+        }
+        /* Report the whole burst with one interrupt */
+        pdb_sim_gcrcsent(cfg);
+
+        /* Take the messages slowly enough for the pool to run out */
+        while (res->received < res->sent) {
+            rx = pdb_msg_ring_pop(&cfg->pe.rx_queue);
+            if (rx == NULL) {
+                if (chEvtWaitAnyTimeout(PDB_EVT_PE_MSG_RX, TIME_MS2I(100))
+                        == 0) {
+                    break;
+                }
+                continue;
+            }
+            if (rx->obj[0] != res->received + 1) {
+                res->out_of_order++;
+            }
+            res->received++;
+            chThdSleepMilliseconds(1);
+            pdb_msg_free(cfg, rx);
+        }
+        if (res->received < res->sent) {
+            break;
+        }
+    }
+
+    res->ms = TIME_I2MS(chVTTimeElapsedSinceX(start));
+    res->duplicates = cfg->prl.rx_duplicates - duplicates;
+    res->starved = cfg->prl.rx_starved - starved;
+
+    return res->received == res->sent && res->out_of_order == 0;
+}
+
+/*
+ * Send count messages with up to *depth of them in flight
+ *
+ * *depth is lowered to the number of buffers we could get.  Returns the time
+ * it took, in microseconds, and adds the messages that failed to *failed.
+ */
+static uint32_t sim_tx_run(struct pdb_config *cfg, uint32_t count,
+        uint8_t *pdepth, uint32_t *failed)
+{
+    union pd_msg *msgs[PDB_MSG_POOL_SIZE];
+    uint8_t tokens[PDB_MSG_POOL_SIZE];
+    uint32_t submitted = 0;
+    uint32_t done = 0;
+    systime_t start;
+    uint32_t us;
+    uint8_t depth;
+
+    /* Take the buffers first, so that only the protocol layer is timed */
+    for (depth = 0; depth < *pdepth; depth++) {
+        msgs[depth] = chPoolAlloc(&cfg->msg_pool);
+        if (msgs[depth] == NULL) {
+            break;
+        }
+        msgs[depth]->hdr = cfg->pe.hdr_template | PD_MSGTYPE_GET_SOURCE_CAP
+            | PD_NUMOBJ(0);
+    }
+    *pdepth = depth;
+    if (depth == 0) {
+        *failed += count;
+        return 0;
+    }
+
+    start = chVTGetSystemTimeX();
+    while (done < count) {
+        /* Keep the TX thread fed */
+        while (submitted < count && submitted - done < depth) {
+            tokens[submitted % depth] = pdb_prltx_submit(cfg,
+                    msgs[submitted % depth]);
+            submitted++;
+        }
+        /* Wait for the oldest message, whose buffer is then reused */
+        while (!pdb_prltx_done(cfg, tokens[done % depth])) {
+            chEvtWaitAny(PDB_EVT_PE_TX_DONE);
+        }
+        if (!pdb_prltx_sent(cfg, tokens[done % depth])) {
+            (*failed)++;
+        }
+        done++;
+    }
+    us = TIME_I2US(chVTTimeElapsedSinceX(start));
+
+    for (uint8_t i = 0; i < depth; i++) {
+        pdb_msg_free(cfg, msgs[i]);
+    }
+
+    return us;
+}
+
+bool pdb_sim_tx_bench(struct pdb_config *cfg, uint32_t count,
+        struct pdb_sim_tx_result *res)
+{
+    uint8_t depth = 1;
+
+    pdb_sim_start(cfg);
+
+    /* Unless the RX thread still holds a message, the whole pool is ours */
+    memset(res, 0, sizeof(*res));
+    res->sent = count;
+    res->serial_us = sim_tx_run(cfg, count, &depth, &res->failed);
+    res->depth = PDB_MSG_POOL_SIZE;
+    res->pipelined_us = sim_tx_run(cfg, count, &res->depth, &res->failed);
+
+    return res->failed == 0;
+}
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * DPM of the ports of pdb_sim_group_negotiate
+ *
+ * It requests the PDO set in the request_pdo of the port's simulated PHY, at
+ * the current that PDO offers.  There is no power to switch.
+ */
+
+static void sim_dpm_nop(struct pdb_config *cfg)
+{
+    (void) cfg;
+}
+
+static bool sim_dpm_check_vbus(struct pdb_config *cfg)
+{
+    (void) cfg;
+
+    return true;
+}
+
+static bool sim_dpm_evaluate_capability(struct pdb_config *cfg,
+        const union pd_msg *caps, union pd_msg *request)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+    uint8_t objpos = sim->request_pdo;
+    uint16_t current;
+
+    /* Without new capabilities, repeat the last request */
+    if (caps == NULL) {
+        return true;
+    }
+
+    if (objpos < 1 || objpos > PD_NUMOBJ_GET(caps)) {
+        objpos = 1;
+    }
+    current = PD_PDO_SRC_FIXED_CURRENT_GET(caps->obj[objpos - 1]);
+
+    request->hdr = cfg->pe.hdr_template | PD_MSGTYPE_REQUEST | PD_NUMOBJ(1);
+    request->obj[0] = PD_RDO_FV_MAX_CURRENT_SET(current)
+        | PD_RDO_FV_CURRENT_SET(current) | PD_RDO_NO_USB_SUSPEND
+        | PD_RDO_OBJPOS_SET(objpos);
+
+    /* We're done with the capabilities */
+    pdb_msg_free(cfg, (union pd_msg *) caps);
+
+    return true;
+}
+
+static void sim_dpm_get_sink_capability(struct pdb_config *cfg,
+        union pd_msg *cap)
+{
+    cap->obj[0] = PD_PDO_TYPE_FIXED
+        | PD_PDO_SNK_FIXED_VOLTAGE_SET(PD_MV2PDV(5000))
+        | PD_PDO_SNK_FIXED_CURRENT_SET(PD_MA2PDI(100));
+    cap->hdr = cfg->pe.hdr_template | PD_MSGTYPE_SINK_CAPABILITIES
+        | PD_NUMOBJ(1);
+}
+
+static const struct pdb_dpm_callbacks sim_dpm = {
+    .init = sim_dpm_nop,
+    .evaluate_capability = sim_dpm_evaluate_capability,
+    .get_sink_capability = sim_dpm_get_sink_capability,
+    .giveback_enabled = NULL,
+    .evaluate_typec_current = NULL,
+    .check_vbus = sim_dpm_check_vbus,
+    .wait_vbus = sim_dpm_nop,
+    .pd_start = NULL,
+    .transition_default = sim_dpm_nop,
+    .transition_min = NULL,
+    .transition_standby = sim_dpm_nop,
+    .transition_requested = sim_dpm_nop,
+    .transition_typec = NULL,
+    .not_supported_received = NULL,
+    .shed_load = NULL
+};
+
+/*
+ * Return whether a port of pdb_sim_group_negotiate is done with the contract
+ * its source made, given the number of contracts it had before
+ */
+static bool sim_group_port_done(struct pdb_config *cfg, uint32_t contracts)
+{
+    struct pdb_sim_config *sim = cfg->phy_data;
+
+    return sim->contracts != contracts && !sim_rx_pending(cfg)
+        && pdb_msg_ring_empty(&cfg->pe.rx_queue)
+        && cfg->pe._explicit_contract;
+}
+
+bool pdb_sim_group_negotiate(struct pdb_int_n_group *group,
+        struct pdb_sim_group_result *res)
+{
+    uint32_t contracts[PDB_INT_N_GROUP_MAX_PORTS];
+    uint32_t hard_resets[PDB_INT_N_GROUP_MAX_PORTS];
+    struct pdb_config *cfg;
+    struct pdb_sim_config *sim;
+    systime_t start;
+    bool done;
+
+    memset(res, 0, sizeof(*res));
+    res->ports = group->num_ports;
+
+    /* Start the ports and their shared INT_N thread the first time, each
+     * port asking for another PDO than the one before */
+    if (group->thread == NULL) {
+        for (uint8_t i = 0; i < group->num_ports; i++) {
+            cfg = group->ports[i];
+            sim = cfg->phy_data;
+            cfg->dpm = sim_dpm;
+            sim->request_pdo = i % SIM_SRC_NUM_CAPS + 1;
+            sim->_source = true;
+            pdb_init(cfg);
+        }
+        pdb_int_n_group_run(group);
+    }
+
+    /* Have every source send its capabilities, then tell the INT_N thread
+     * about all of them */
+    for (uint8_t i = 0; i < group->num_ports; i++) {
+        cfg = group->ports[i];
+        sim = cfg->phy_data;
+        contracts[i] = sim->contracts;
+        hard_resets[i] = sim->hard_resets;
+        sim_src_inject(cfg, PD_MSGTYPE_SOURCE_CAPABILITIES, sim_src_caps,
+                SIM_SRC_NUM_CAPS);
+    }
+    start = chVTGetSystemTimeX();
+    for (uint8_t i = 0; i < group->num_ports; i++) {
+        sim_raise(group->ports[i], 0, FUSB_INTERRUPTB_I_GCRCSENT);
+    }
+
+    /* Wait for every port to be done negotiating */
+    do {
+        chThdSleepMilliseconds(1);
+        done = true;
+        for (uint8_t i = 0; i < group->num_ports; i++) {
+            if (!sim_group_port_done(group->ports[i], contracts[i])) {
+                done = false;
+            }
+        }
+    } while (!done && chVTTimeElapsedSinceX(start) < TIME_MS2I(500));
+    res->ms = TIME_I2MS(chVTTimeElapsedSinceX(start));
+
+    /* Each port must have the contract it asked for, and not another
+     * port's */
+    for (uint8_t i = 0; i < group->num_ports; i++) {
+        cfg = group->ports[i];
+        sim = cfg->phy_data;
+        res->hard_resets += sim->hard_resets - hard_resets[i];
+        if (sim_group_port_done(cfg, contracts[i])
+                && sim->contract_pdo == sim->request_pdo) {
+            res->negotiated++;
+        }
+    }
+
+    return res->negotiated == res->ports && res->hard_resets == 0;
+}
+#endif
+
+#endif
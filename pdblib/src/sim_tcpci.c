@@ -0,0 +1,333 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_tcpci.h"
+
+#if PDB_USE_SIM_PHY
+
+#include <string.h>
+
+#include <ch.h>
+#include <hal.h>
+
+#include <pdb.h>
+#include <pd.h>
+#include "tcpci.h"
+#include "fusb302b.h"
+
+
+/* The model pdb_sim_tcpci_test runs against */
+static struct pdb_sim_tcpc *sim_tcpc_active;
+
+
+/*
+ * TCPC register model
+ */
+
+static uint16_t sim_tcpc_reg16(struct pdb_sim_tcpc *tcpc, uint8_t reg)
+{
+    return tcpc->regs[reg] | (tcpc->regs[reg + 1] << 8);
+}
+
+static void sim_tcpc_raise(struct pdb_sim_tcpc *tcpc, uint16_t alert)
+{
+    tcpc->regs[TCPCI_ALERT] |= alert & 0xFF;
+    tcpc->regs[TCPCI_ALERT + 1] |= alert >> 8;
+}
+
+/*
+ * Write a register, with the side effects the TCPC has
+ */
+static void sim_tcpc_write(struct pdb_sim_tcpc *tcpc, uint8_t reg,
+        uint8_t byte)
+{
+    switch (reg) {
+        case TCPCI_ALERT:
+            /* Clearing RX_STATUS frees the RX_BUFFER */
+            if (byte & TCPCI_ALERT_RX_STATUS) {
+                tcpc->regs[TCPCI_RX_BUFFER] = 0;
+            }
+            /* Fall through */
+        case TCPCI_ALERT + 1:
+        case TCPCI_FAULT_STATUS:
+            tcpc->regs[reg] &= ~byte;
+            break;
+        case TCPCI_TRANSMIT:
+            tcpc->regs[reg] = byte;
+            if ((byte & 0x7) == TCPCI_TRANSMIT_HARD_RESET) {
+                tcpc->hard_resets++;
+                sim_tcpc_raise(tcpc, TCPCI_ALERT_TX_SUCCESS
+                        | TCPCI_ALERT_TX_FAILED);
+            } else {
+                tcpc->tx_msgs++;
+                sim_tcpc_raise(tcpc, tcpc->tx_fail ? TCPCI_ALERT_TX_FAILED
+                        : TCPCI_ALERT_TX_SUCCESS);
+            }
+            break;
+        default:
+            tcpc->regs[reg] = byte;
+            break;
+    }
+}
+
+/*
+ * Put a message in the RX_BUFFER of the model, as if it was received
+ */
+static void sim_tcpc_receive(struct pdb_sim_tcpc *tcpc,
+        const union pd_msg *msg, uint8_t frame_type)
+{
+    uint8_t len = 2 + 4 * PD_NUMOBJ_GET(msg);
+
+    tcpc->regs[TCPCI_RX_BUFFER] = 1 + len;
+    tcpc->regs[TCPCI_RX_BUFFER + 1] = frame_type;
+    memcpy(&tcpc->regs[TCPCI_RX_BUFFER + 2], msg->bytes, len);
+    sim_tcpc_raise(tcpc, TCPCI_ALERT_RX_STATUS);
+}
+
+bool pdb_sim_tcpc_transfer(I2CDriver *i2cp, const uint8_t *txbuf,
+        size_t txbytes, uint8_t *rxbuf, size_t rxbytes, msg_t *ret)
+{
+    struct pdb_sim_tcpc *tcpc = sim_tcpc_active;
+    uint8_t reg;
+
+    if (tcpc == NULL || i2cp != &tcpc->i2c) {
+        return false;
+    }
+
+    tcpc->transfers++;
+    /* Every transfer starts with the register address */
+    if (txbytes < 1) {
+        *ret = MSG_RESET;
+        return true;
+    }
+    reg = txbuf[0];
+
+    /* Write the bytes that follow the address, if any, then read */
+    for (size_t i = 1; i < txbytes; i++) {
+        sim_tcpc_write(tcpc, reg + i - 1, txbuf[i]);
+    }
+    if (rxbytes > 0 && reg == TCPCI_RX_BUFFER) {
+        tcpc->rx_buffer_reads++;
+    }
+    for (size_t i = 0; i < rxbytes; i++) {
+        rxbuf[i] = tcpc->regs[(uint8_t) (reg + i)];
+    }
+
+    *ret = MSG_OK;
+    return true;
+}
+
+
+/*
+ * TCPCI PHY test
+ */
+
+/*
+ * Count a check, remembering the first one that failed
+ */
+static void sim_tcpci_check(struct pdb_sim_tcpci_result *res, bool ok,
+        const char *what)
+{
+    res->checks++;
+    if (!ok) {
+        if (res->failed == 0) {
+            res->first_failed = what;
+        }
+        res->failed++;
+    }
+}
+
+/*
+ * Read the status of the PHY like the INT_N thread of a group does
+ */
+static msg_t sim_tcpci_status(struct pdb_config *cfg,
+        union fusb_status *status)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+    ret = cfg->phy->get_status_locked(cfg, status);
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+/*
+ * Return whether two messages have the same header and data objects
+ */
+static bool sim_tcpci_same(const union pd_msg *a, const union pd_msg *b)
+{
+    return a->hdr == b->hdr
+        && memcmp(a->obj, b->obj, 4 * PD_NUMOBJ_GET(a)) == 0;
+}
+
+bool pdb_sim_tcpci_test(struct pdb_config *cfg, struct pdb_sim_tcpc *tcpc,
+        struct pdb_sim_tcpci_result *res)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    union fusb_status status;
+    union pd_msg accept;
+    union pd_msg caps;
+    union pd_msg msg;
+    uint32_t reads;
+    msg_t ret;
+
+    memset(res, 0, sizeof(*res));
+
+    /* Start from a TCPC fresh out of reset, with a source on CC1 */
+    memset(tcpc->regs, 0, sizeof(tcpc->regs));
+    tcpc->regs[TCPCI_CC_STATUS] = 0x2 << TCPCI_CC_STATUS_CC1_SHIFT;
+    tcpc->tx_fail = false;
+    tcpc->transfers = 0;
+    tcpc->rx_buffer_reads = 0;
+    tcpc->tx_msgs = 0;
+    tcpc->hard_resets = 0;
+    i2cObjectInit(&tcpc->i2c);
+    sim_tcpc_active = tcpc;
+
+    /* A control message, and a data message too long for the first burst */
+    accept.hdr = PD_MSGTYPE_ACCEPT | PD_NUMOBJ(0) | PD_DATAROLE_DFP
+        | PD_POWERROLE_SOURCE | PD_SPECREV_2_0
+        | (1 << PD_HDR_MESSAGEID_SHIFT);
+    caps.hdr = PD_MSGTYPE_SOURCE_CAPABILITIES | PD_NUMOBJ(5)
+        | PD_DATAROLE_DFP | PD_POWERROLE_SOURCE | PD_SPECREV_2_0
+        | (2 << PD_HDR_MESSAGEID_SHIFT);
+    for (uint8_t i = 0; i < 5; i++) {
+        caps.obj[i] = 0x01010101 * (i + 1);
+    }
+
+    ret = cfg->phy->setup(cfg);
+    sim_tcpci_check(res, ret == MSG_OK
+            && sim_tcpc_reg16(tcpc, TCPCI_ALERT_MASK) == tcpci->_alert_mask
+            && (tcpci->_alert_mask & TCPCI_ALERT_RX_STATUS)
+            && tcpc->regs[TCPCI_RECEIVE_DETECT] != 0,
+            "setup");
+
+    /* A received message is reported once, with RX_STATUS masked until
+     * it's read */
+    sim_tcpc_receive(tcpc, &accept, TCPCI_RX_BUF_FRAME_TYPE_SOP);
+    ret = sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, ret == MSG_OK
+            && status.interruptb == FUSB_INTERRUPTB_I_GCRCSENT
+            && status.interrupta == 0
+            && !(sim_tcpc_reg16(tcpc, TCPCI_ALERT_MASK)
+                & TCPCI_ALERT_RX_STATUS)
+            && (sim_tcpc_reg16(tcpc, TCPCI_ALERT) & TCPCI_ALERT_RX_STATUS),
+            "RX_STATUS is I_GCRCSENT");
+    ret = sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, ret == MSG_OK && status.interruptb == 0,
+            "RX_STATUS reported once");
+
+    /* A control message is read in one burst, which frees the RX_BUFFER
+     * and unmasks RX_STATUS */
+    reads = tcpc->rx_buffer_reads;
+    sim_tcpci_check(res, cfg->phy->read_message(cfg, &msg) == 0
+            && sim_tcpci_same(&msg, &accept)
+            && tcpc->rx_buffer_reads - reads == 1
+            && !(sim_tcpc_reg16(tcpc, TCPCI_ALERT) & TCPCI_ALERT_RX_STATUS)
+            && (sim_tcpc_reg16(tcpc, TCPCI_ALERT_MASK)
+                & TCPCI_ALERT_RX_STATUS),
+            "control message read");
+
+    /* A longer message is read again in full */
+    sim_tcpc_receive(tcpc, &caps, TCPCI_RX_BUF_FRAME_TYPE_SOP);
+    sim_tcpci_status(cfg, &status);
+    reads = tcpc->rx_buffer_reads;
+    sim_tcpci_check(res, cfg->phy->read_message(cfg, &msg) == 0
+            && sim_tcpci_same(&msg, &caps)
+            && tcpc->rx_buffer_reads - reads == 2,
+            "data message read again");
+
+    /* A frame too short for a header is dropped */
+    sim_tcpc_receive(tcpc, &accept, TCPCI_RX_BUF_FRAME_TYPE_SOP);
+    tcpc->regs[TCPCI_RX_BUFFER] = 1 + 1;
+    sim_tcpci_check(res, cfg->phy->read_message(cfg, &msg) != 0
+            && !(sim_tcpc_reg16(tcpc, TCPCI_ALERT) & TCPCI_ALERT_RX_STATUS),
+            "frame shorter than a header");
+
+    /* So is a frame too short for its data objects, without reading it
+     * again */
+    sim_tcpc_receive(tcpc, &caps, TCPCI_RX_BUF_FRAME_TYPE_SOP);
+    tcpc->regs[TCPCI_RX_BUFFER] = 1 + 2 + 4 * 2;
+    reads = tcpc->rx_buffer_reads;
+    sim_tcpci_check(res, cfg->phy->read_message(cfg, &msg) != 0
+            && tcpc->rx_buffer_reads - reads == 1
+            && !(sim_tcpc_reg16(tcpc, TCPCI_ALERT) & TCPCI_ALERT_RX_STATUS),
+            "frame shorter than its data objects");
+
+    /* And a frame that isn't SOP */
+    sim_tcpc_receive(tcpc, &accept, 0x1);
+    sim_tcpci_check(res, cfg->phy->read_message(cfg, &msg) != 0
+            && !(sim_tcpc_reg16(tcpc, TCPCI_ALERT) & TCPCI_ALERT_RX_STATUS),
+            "frame not SOP");
+
+    /* The result of a transmission, and the GoodCRC made up for it */
+    msg = accept;
+    msg.hdr = (msg.hdr & ~PD_HDR_MESSAGEID) | (3 << PD_HDR_MESSAGEID_SHIFT);
+    ret = cfg->phy->send_message(cfg, &msg);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, ret == MSG_OK && tcpc->tx_msgs == 1
+            && status.interrupta == FUSB_INTERRUPTA_I_TXSENT
+            && sim_tcpc_reg16(tcpc, TCPCI_ALERT) == 0
+            && cfg->phy->read_goodcrc(cfg, &msg) == 0
+            && PD_MESSAGEID_GET(&msg) == 3,
+            "TX_SUCCESS is I_TXSENT");
+    tcpc->tx_fail = true;
+    msg = accept;
+    cfg->phy->send_message(cfg, &msg);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, status.interrupta == FUSB_INTERRUPTA_I_RETRYFAIL,
+            "TX_FAILED is I_RETRYFAIL");
+
+    /* The end of hard reset signaling is I_HARDSENT alone, whatever the TCPC
+     * says about it, and the next transmission is a message again */
+    ret = cfg->phy->send_hardrst(cfg);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, ret == MSG_OK && tcpc->hard_resets == 1
+            && status.interrupta == FUSB_INTERRUPTA_I_HARDSENT
+            && !tcpci->_hardrst_pending,
+            "hard reset is I_HARDSENT");
+    tcpc->tx_fail = false;
+    msg = accept;
+    cfg->phy->send_message(cfg, &msg);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, status.interrupta == FUSB_INTERRUPTA_I_TXSENT,
+            "TX_SUCCESS after a hard reset is I_TXSENT");
+
+    /* Hard reset signaling from the source */
+    sim_tcpc_raise(tcpc, TCPCI_ALERT_RX_HARD_RESET);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, status.interrupta == FUSB_INTERRUPTA_I_HARDRST,
+            "RX_HARD_RESET is I_HARDRST");
+
+    /* A VBUS fault is read, cleared, and handled like an over-temperature */
+    tcpc->regs[TCPCI_FAULT_STATUS] = TCPCI_FAULT_STATUS_VBUS_OVP;
+    sim_tcpc_raise(tcpc, TCPCI_ALERT_FAULT);
+    sim_tcpci_status(cfg, &status);
+    sim_tcpci_check(res, status.interrupta == FUSB_INTERRUPTA_I_OCP_TEMP
+            && (status.status1 & FUSB_STATUS1_OVRTEMP)
+            && tcpc->regs[TCPCI_FAULT_STATUS] == 0
+            && sim_tcpc_reg16(tcpc, TCPCI_ALERT) == 0,
+            "VBUS fault is I_OCP_TEMP");
+
+    sim_tcpc_active = NULL;
+
+    return res->failed == 0;
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_SIM_TCPCI_H
+#define PDB_SIM_TCPCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hal.h>
+
+#include <pdb_sim.h>
+
+
+#if PDB_USE_SIM_PHY
+/*
+ * Do an I2C transfer with the TCPC register model under test, if i2cp is its
+ * driver
+ *
+ * Returns false, leaving *ret alone, if i2cp is any other driver.
+ */
+bool pdb_sim_tcpc_transfer(I2CDriver *i2cp, const uint8_t *txbuf,
+        size_t txbytes, uint8_t *rxbuf, size_t rxbytes, msg_t *ret);
+#endif
+
+
+#endif /* PDB_SIM_TCPCI_H */
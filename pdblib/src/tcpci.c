@@ -0,0 +1,565 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tcpci.h"
+
+#include <string.h>
+
+#include <ch.h>
+#include <hal.h>
+
+#include <pdb.h>
+#include <pd.h>
+#include "fusb302b.h"
+#include "i2c.h"
+
+
+/* The transmit frame is built in place in front of the message */
+#if PDB_MSG_HEADROOM < 2
+#error "union pd_msg lacks room for the TCPCI transmit frame"
+#endif
+
+/* Alerts that assert ALERT#.  RX_STATUS is masked from the moment a message
+ * is reported until it's read, since it stays set until then. */
+#define TCPCI_ALERT_MASK_DEFAULT (TCPCI_ALERT_RX_STATUS \
+        | TCPCI_ALERT_RX_HARD_RESET | TCPCI_ALERT_TX_FAILED \
+        | TCPCI_ALERT_TX_DISCARDED | TCPCI_ALERT_TX_SUCCESS \
+        | TCPCI_ALERT_FAULT | TCPCI_ALERT_RX_BUF_OVERFLOW)
+
+/* Alerts that are cleared by reading the received message */
+#define TCPCI_ALERT_RX (TCPCI_ALERT_RX_STATUS | TCPCI_ALERT_RX_BUF_OVERFLOW)
+
+#if PDB_USE_STATS
+#define TCPCI_STAT_NOW() pdb_stats_now()
+#define TCPCI_STAT_TX(tcpci, transactions, start) do { \
+        (tcpci)->stats.tx_msgs++; \
+        (tcpci)->stats.tx_transactions += (transactions); \
+        pdb_hist_add(&(tcpci)->stats.tx_time, start); \
+    } while (0)
+#define TCPCI_STAT_RX(tcpci, transactions, bytes, start) do { \
+        (tcpci)->stats.rx_msgs++; \
+        (tcpci)->stats.rx_transactions += (transactions); \
+        (tcpci)->stats.rx_bytes += (bytes); \
+        pdb_hist_add(&(tcpci)->stats.rx_time, start); \
+    } while (0)
+#define TCPCI_STAT_ALERT(tcpci, transactions, start) do { \
+        (tcpci)->stats.alert_reads++; \
+        (tcpci)->stats.alert_transactions += (transactions); \
+        pdb_hist_add(&(tcpci)->stats.alert_time, start); \
+    } while (0)
+#else
+#define TCPCI_STAT_NOW() 0
+#define TCPCI_STAT_TX(tcpci, transactions, start) do {(void) (start);} while (0)
+#define TCPCI_STAT_RX(tcpci, transactions, bytes, start) \
+    do {(void) (start);} while (0)
+#define TCPCI_STAT_ALERT(tcpci, transactions, start) \
+    do {(void) (start);} while (0)
+#endif
+
+
+/*
+ * Do an I2C transfer with the TCPC within its time budget
+ */
+static msg_t tcpci_transfer(struct pdb_tcpci_config *tcpci,
+        const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes)
+{
+    return pdb_i2c_transfer(tcpci->i2cp, tcpci->addr, txbuf, txbytes, rxbuf,
+            rxbytes, &tcpci->i2c_stats);
+}
+
+/*
+ * Read multiple bytes from the TCPC
+ */
+static msg_t tcpci_read_buf(struct pdb_tcpci_config *tcpci, uint8_t addr,
+        uint8_t size, uint8_t *buf)
+{
+    return tcpci_transfer(tcpci, &addr, 1, buf, size);
+}
+
+/*
+ * Read a single byte from the TCPC
+ */
+static msg_t tcpci_read_byte(struct pdb_tcpci_config *tcpci, uint8_t addr,
+        uint8_t *byte)
+{
+    return tcpci_read_buf(tcpci, addr, 1, byte);
+}
+
+/*
+ * Write a single byte to the TCPC
+ */
+static msg_t tcpci_write_byte(struct pdb_tcpci_config *tcpci, uint8_t addr,
+        uint8_t byte)
+{
+    uint8_t buf[2] = {addr, byte};
+    return tcpci_transfer(tcpci, buf, 2, NULL, 0);
+}
+
+/*
+ * Clear alerts and set the alert mask
+ *
+ * ALERT_MASK follows ALERT, so both are written in one burst.  The mask is
+ * only remembered if it was written.
+ */
+static msg_t tcpci_write_alert(struct pdb_tcpci_config *tcpci, uint16_t clear,
+        uint16_t mask)
+{
+    uint8_t buf[5] = {
+        TCPCI_ALERT,
+        clear & 0xFF, clear >> 8,
+        mask & 0xFF, mask >> 8
+    };
+    msg_t ret = tcpci_transfer(tcpci, buf, 5, NULL, 0);
+
+    if (ret == MSG_OK) {
+        tcpci->_alert_mask = mask;
+    }
+    return ret;
+}
+
+/*
+ * Use the CC line with the highest Type-C Current for BMC signaling
+ *
+ * The I2C bus must already be acquired.
+ */
+static msg_t tcpci_select_cc(struct pdb_tcpci_config *tcpci)
+{
+    uint8_t cc_status;
+    uint8_t cc1;
+    uint8_t cc2;
+    msg_t ret;
+
+    ret = tcpci_read_byte(tcpci, TCPCI_CC_STATUS, &cc_status);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+    cc1 = (cc_status >> TCPCI_CC_STATUS_CC1_SHIFT) & TCPCI_CC_STATUS_CC_STATE;
+    cc2 = (cc_status >> TCPCI_CC_STATUS_CC2_SHIFT) & TCPCI_CC_STATUS_CC_STATE;
+
+    tcpci->_cc = cc1 > cc2 ? 1 : 2;
+    return tcpci_write_byte(tcpci, TCPCI_TCPC_CONTROL,
+            tcpci->_cc == 2 ? TCPCI_TCPC_CONTROL_PLUG_ORIENTATION : 0);
+}
+
+/*
+ * Configure the TCPC once it's ready
+ *
+ * The I2C bus must already be acquired.
+ */
+static msg_t tcpci_configure(struct pdb_tcpci_config *tcpci)
+{
+    systime_t start = chVTGetSystemTime();
+    uint8_t power_status;
+    msg_t ret;
+
+    /* Wait for the TCPC to be ready to take its configuration */
+    while ((ret = tcpci_read_byte(tcpci, TCPCI_POWER_STATUS, &power_status))
+                == MSG_OK
+            && (power_status & TCPCI_POWER_STATUS_UNINITIALIZED)) {
+        if (chVTTimeElapsedSinceX(start)
+                >= TIME_MS2I(PDB_TCPCI_INIT_TIMEOUT_MS)) {
+            break;
+        }
+        i2cReleaseBus(tcpci->i2cp);
+        chThdSleepMilliseconds(1);
+        i2cAcquireBus(tcpci->i2cp);
+    }
+    if (ret != MSG_OK) {
+        return ret;
+    }
+
+    /* Rd on both CC lines, VBUS measured without alarms, and GoodCRC sent as
+     * a PD 2.0 UFP sink */
+    if ((ret = tcpci_write_byte(tcpci, TCPCI_ROLE_CONTROL,
+                    TCPCI_ROLE_CONTROL_SNK)) != MSG_OK
+            || (ret = tcpci_write_byte(tcpci, TCPCI_POWER_CONTROL,
+                    TCPCI_POWER_CONTROL_VOLT_ALARMS_DISABLE)) != MSG_OK
+            || (ret = tcpci_write_byte(tcpci, TCPCI_MESSAGE_HEADER_INFO,
+                    TCPCI_MESSAGE_HEADER_INFO_REV20)) != MSG_OK) {
+        return ret;
+    }
+
+    /* Clear every alert and unmask the ones we handle */
+    tcpci->_rx_pending = false;
+    tcpci->_hardrst_pending = false;
+    ret = tcpci_write_alert(tcpci, 0xFFFF, TCPCI_ALERT_MASK_DEFAULT);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+
+    /* Select the CC line for BMC signaling, then start receiving */
+    ret = tcpci_select_cc(tcpci);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+    return tcpci_write_byte(tcpci, TCPCI_RECEIVE_DETECT,
+            TCPCI_RECEIVE_DETECT_SOP | TCPCI_RECEIVE_DETECT_HARD_RESET);
+}
+
+static msg_t tcpci_setup(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    ret = tcpci_configure(tcpci);
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+static msg_t tcpci_send_message(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    /* The frame starts in the headroom of the message with the TX_BUFFER
+     * address and TX_BYTE_COUNT */
+    uint8_t *frame = msg->bytes - 2;
+    uint8_t msg_len = 2 + 4 * PD_NUMOBJ_GET(msg);
+    uint8_t transmit[2] = {
+        TCPCI_TRANSMIT,
+        (TCPCI_TRANSMIT_RETRIES << TCPCI_TRANSMIT_RETRY_SHIFT)
+            | TCPCI_TRANSMIT_SOP
+    };
+
+    frame[0] = TCPCI_TX_BUFFER;
+    frame[1] = msg_len;
+    /* Remember the MessageID for the GoodCRC */
+    tcpci->_tx_messageid = PD_MESSAGEID_GET(msg);
+
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    /* Fill the transmit buffer, then start the transmission */
+    rtcnt_t start = TCPCI_STAT_NOW();
+    ret = tcpci_transfer(tcpci, frame, 2 + msg_len, NULL, 0);
+    if (ret == MSG_OK) {
+        ret = tcpci_transfer(tcpci, transmit, 2, NULL, 0);
+    }
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    if (ret == MSG_OK) {
+        TCPCI_STAT_TX(tcpci, 2, start);
+    }
+    return ret;
+}
+
+static uint8_t tcpci_read_message(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    /* READABLE_BYTE_COUNT and RX_BUF_FRAME_TYPE land in the headroom, just
+     * in front of the header */
+    uint8_t *frame = msg->bytes - 2;
+    uint8_t numobj;
+    uint8_t transactions = 1;
+    uint8_t bytes = 2 + 2 + 4;
+    uint8_t ret = 0;
+    rtcnt_t start = TCPCI_STAT_NOW();
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    /* Read the byte count, the frame type, the header and four more bytes in
+     * one burst.  That's all of a control message, or of a data message with
+     * one data object.  If the buffer couldn't be read or there's no SOP
+     * message in it, return error. */
+    if (tcpci_read_buf(tcpci, TCPCI_RX_BUFFER, bytes, frame) != MSG_OK
+            || frame[0] < 1 + 2
+            || (frame[1] & TCPCI_RX_BUF_FRAME_TYPE)
+                != TCPCI_RX_BUF_FRAME_TYPE_SOP) {
+        ret = 1;
+    } else {
+        /* If there are more data objects, read the whole buffer again.  The
+         * RX_BUFFER can only be read from its start, in one burst. */
+        numobj = PD_NUMOBJ_GET(msg);
+        if (numobj > 1) {
+            if (frame[0] < 1 + 2 + numobj * 4
+                    || tcpci_read_buf(tcpci, TCPCI_RX_BUFFER,
+                        2 + 2 + numobj * 4, frame) != MSG_OK) {
+                ret = 1;
+            }
+            transactions++;
+            bytes += 2 + 2 + numobj * 4;
+        }
+    }
+
+    /* Free the receive buffer for the next message, and let RX_STATUS
+     * assert ALERT# again */
+    tcpci->_rx_pending = false;
+    tcpci_write_alert(tcpci, TCPCI_ALERT_RX,
+            tcpci->_alert_mask | TCPCI_ALERT_RX_STATUS);
+    transactions++;
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    if (ret == 0) {
+        TCPCI_STAT_RX(tcpci, transactions, bytes, start);
+    }
+    return ret;
+}
+
+static uint8_t tcpci_read_goodcrc(struct pdb_config *cfg, union pd_msg *msg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+
+    /* The TCPC only reports TX_SUCCESS once it received a GoodCRC with the
+     * right MessageID, and doesn't pass the GoodCRC on, so make it up */
+    msg->hdr = PD_MSGTYPE_GOODCRC | PD_NUMOBJ(0)
+        | (tcpci->_tx_messageid << PD_HDR_MESSAGEID_SHIFT);
+
+    return 0;
+}
+
+static msg_t tcpci_send_hardrst(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    /* The next TX_SUCCESS or TX_FAILED is about the hard reset */
+    ret = tcpci_write_byte(tcpci, TCPCI_TRANSMIT, TCPCI_TRANSMIT_HARD_RESET);
+    tcpci->_hardrst_pending = ret == MSG_OK;
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+static msg_t tcpci_get_status_locked(struct pdb_config *cfg,
+        union fusb_status *status)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    uint8_t buf[2];
+    uint16_t alert;
+    uint16_t mask;
+    uint8_t fault = 0;
+    uint8_t transactions = 1;
+    msg_t ret;
+    rtcnt_t start = TCPCI_STAT_NOW();
+
+    memset(status, 0, sizeof(*status));
+
+    ret = tcpci_read_buf(tcpci, TCPCI_ALERT, 2, buf);
+    if (ret != MSG_OK) {
+        return ret;
+    }
+    alert = buf[0] | (buf[1] << 8);
+
+    /* Read and clear the fault */
+    if (alert & TCPCI_ALERT_FAULT) {
+        ret = tcpci_read_byte(tcpci, TCPCI_FAULT_STATUS, &fault);
+        if (ret == MSG_OK) {
+            ret = tcpci_write_byte(tcpci, TCPCI_FAULT_STATUS, fault);
+        }
+        if (ret != MSG_OK) {
+            return ret;
+        }
+        transactions += 2;
+    }
+
+    /* Translate the alerts into FUSB302B interrupts.  A received message is
+     * only reported once, and RX_STATUS is masked until it's read. */
+    mask = tcpci->_alert_mask;
+    if ((alert & TCPCI_ALERT_RX_STATUS) && !tcpci->_rx_pending) {
+        tcpci->_rx_pending = true;
+        mask &= ~TCPCI_ALERT_RX_STATUS;
+        status->interruptb |= FUSB_INTERRUPTB_I_GCRCSENT;
+    }
+    if (alert & TCPCI_ALERT_RX_HARD_RESET) {
+        status->interrupta |= FUSB_INTERRUPTA_I_HARDRST;
+    }
+    if (alert & (TCPCI_ALERT_TX_SUCCESS | TCPCI_ALERT_TX_FAILED
+                | TCPCI_ALERT_TX_DISCARDED)) {
+        if (tcpci->_hardrst_pending) {
+            /* The hard reset is over whether it was acknowledged or not */
+            tcpci->_hardrst_pending = false;
+            status->interrupta |= FUSB_INTERRUPTA_I_HARDSENT;
+        } else if (alert & TCPCI_ALERT_TX_SUCCESS) {
+            status->interrupta |= FUSB_INTERRUPTA_I_TXSENT;
+        } else {
+            status->interrupta |= FUSB_INTERRUPTA_I_RETRYFAIL;
+        }
+    }
+    /* There's no over-temperature in TCPCI, so VBUS faults are what makes us
+     * shed the load and send a hard reset */
+    if (fault & (TCPCI_FAULT_STATUS_VBUS_OCP | TCPCI_FAULT_STATUS_VBUS_OVP)) {
+        status->interrupta |= FUSB_INTERRUPTA_I_OCP_TEMP;
+        status->status1 |= FUSB_STATUS1_OVRTEMP;
+    }
+
+    /* Clear the alerts we handled, except those of the received message */
+    alert &= ~TCPCI_ALERT_RX;
+    if (alert != 0 || mask != tcpci->_alert_mask) {
+        ret = tcpci_write_alert(tcpci, alert, mask);
+        transactions++;
+    }
+
+    TCPCI_STAT_ALERT(tcpci, transactions, start);
+
+    /* The alerts were read, so report them even if clearing them failed; they
+     * will just be reported again */
+    return MSG_OK;
+}
+
+static msg_t tcpci_get_status(struct pdb_config *cfg,
+        union fusb_status *status)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    ret = tcpci_get_status_locked(cfg, status);
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+static msg_t tcpci_update_cc(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    /* Stop receiving while the CC line changes */
+    ret = tcpci_write_byte(tcpci, TCPCI_RECEIVE_DETECT, 0);
+    if (ret == MSG_OK) {
+        ret = tcpci_select_cc(tcpci);
+    }
+    /* Start receiving again even if the CC line couldn't be changed */
+    if (tcpci_write_byte(tcpci, TCPCI_RECEIVE_DETECT,
+                TCPCI_RECEIVE_DETECT_SOP | TCPCI_RECEIVE_DETECT_HARD_RESET)
+            != MSG_OK) {
+        ret = MSG_RESET;
+    }
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+static enum fusb_typec_current tcpci_get_typec_current(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    uint8_t cc_status;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    ret = tcpci_read_byte(tcpci, TCPCI_CC_STATUS, &cc_status);
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    if (ret != MSG_OK) {
+        return fusb_tcc_none;
+    }
+
+    /* The sink CC states are numbered like the FUSB302B BC_LVL */
+    if (tcpci->_cc == 2) {
+        cc_status >>= TCPCI_CC_STATUS_CC2_SHIFT;
+    } else {
+        cc_status >>= TCPCI_CC_STATUS_CC1_SHIFT;
+    }
+    return cc_status & TCPCI_CC_STATUS_CC_STATE;
+}
+
+static msg_t tcpci_reset(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    /* Turning the receiver off and on resets the PD logic of the TCPC.
+     * Drop the received message and the transmission results in the
+     * meantime. */
+    tcpci->_rx_pending = false;
+    tcpci->_hardrst_pending = false;
+    if ((ret = tcpci_write_byte(tcpci, TCPCI_RECEIVE_DETECT, 0)) == MSG_OK
+            && (ret = tcpci_write_alert(tcpci, TCPCI_ALERT_RX
+                    | TCPCI_ALERT_TX_SUCCESS | TCPCI_ALERT_TX_FAILED
+                    | TCPCI_ALERT_TX_DISCARDED, TCPCI_ALERT_MASK_DEFAULT))
+                == MSG_OK) {
+        ret = tcpci_write_byte(tcpci, TCPCI_RECEIVE_DETECT,
+                TCPCI_RECEIVE_DETECT_SOP | TCPCI_RECEIVE_DETECT_HARD_RESET);
+    }
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    return ret;
+}
+
+static uint16_t tcpci_measure_vbus(struct pdb_config *cfg)
+{
+    struct pdb_tcpci_config *tcpci = cfg->phy_data;
+    uint8_t buf[2];
+    uint16_t vbus;
+    uint32_t mv;
+    msg_t ret;
+
+    i2cAcquireBus(tcpci->i2cp);
+
+    ret = tcpci_read_buf(tcpci, TCPCI_VBUS_VOLTAGE, 2, buf);
+
+    i2cReleaseBus(tcpci->i2cp);
+
+    if (ret != MSG_OK) {
+        return 0;
+    }
+
+    /* The measurement is scaled down by 1, 2 or 4 */
+    vbus = buf[0] | (buf[1] << 8);
+    mv = (uint32_t) (vbus & TCPCI_VBUS_VOLTAGE_MEAS)
+        << ((vbus >> TCPCI_VBUS_VOLTAGE_SCALE_SHIFT) & TCPCI_VBUS_VOLTAGE_SCALE);
+    mv *= TCPCI_VBUS_VOLTAGE_LSB_MV;
+
+    return mv > UINT16_MAX ? UINT16_MAX : mv;
+}
+
+/*
+ * TCPCI PHY operations.  VBUS is measured continuously by the TCPC, so
+ * getting it is always a fresh measurement.
+ */
+const struct pdb_phy_ops pdb_tcpci_phy = {
+    .setup = tcpci_setup,
+    .send_message = tcpci_send_message,
+    .read_message = tcpci_read_message,
+    .read_header = NULL,
+    .read_rest = NULL,
+    .rx_pending = NULL,
+    .read_goodcrc = tcpci_read_goodcrc,
+    .send_hardrst = tcpci_send_hardrst,
+    .get_status = tcpci_get_status,
+    .get_status_locked = tcpci_get_status_locked,
+    .int_n_asserted = NULL,
+    .update_cc = tcpci_update_cc,
+    .get_typec_current = tcpci_get_typec_current,
+    .reset = tcpci_reset,
+    .flush_tx = NULL,
+    .set_mask_profile = NULL,
+    .count_masked_irqs = NULL,
+    .measure_vbus = tcpci_measure_vbus,
+    .get_vbus = tcpci_measure_vbus,
+    .enter_detached = NULL,
+    .attach = NULL,
+    .set_phase = NULL
+};
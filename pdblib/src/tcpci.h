@@ -0,0 +1,100 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_TCPCI_REGS_H
+#define PDB_TCPCI_REGS_H
+
+#include <stdint.h>
+
+#include <pdb_tcpci.h>
+
+
+/* TCPCI Revision 2.0 registers.  Multi-byte registers are little-endian. */
+#define TCPCI_ALERT 0x10
+#define TCPCI_ALERT_CC_STATUS (1 << 0)
+#define TCPCI_ALERT_POWER_STATUS (1 << 1)
+#define TCPCI_ALERT_RX_STATUS (1 << 2)
+#define TCPCI_ALERT_RX_HARD_RESET (1 << 3)
+#define TCPCI_ALERT_TX_FAILED (1 << 4)
+#define TCPCI_ALERT_TX_DISCARDED (1 << 5)
+#define TCPCI_ALERT_TX_SUCCESS (1 << 6)
+#define TCPCI_ALERT_VBUS_ALARM_HI (1 << 7)
+#define TCPCI_ALERT_VBUS_ALARM_LO (1 << 8)
+#define TCPCI_ALERT_FAULT (1 << 9)
+#define TCPCI_ALERT_RX_BUF_OVERFLOW (1 << 10)
+#define TCPCI_ALERT_VBUS_SINK_DISCONNECT (1 << 11)
+
+#define TCPCI_ALERT_MASK 0x12
+
+#define TCPCI_TCPC_CONTROL 0x19
+#define TCPCI_TCPC_CONTROL_PLUG_ORIENTATION (1 << 0)
+
+#define TCPCI_ROLE_CONTROL 0x1A
+#define TCPCI_ROLE_CONTROL_CC2_SHIFT 2
+#define TCPCI_ROLE_CONTROL_CC1_SHIFT 0
+#define TCPCI_ROLE_CONTROL_CC_RD 0x2
+#define TCPCI_ROLE_CONTROL_SNK ((TCPCI_ROLE_CONTROL_CC_RD \
+            << TCPCI_ROLE_CONTROL_CC2_SHIFT) \
+        | (TCPCI_ROLE_CONTROL_CC_RD << TCPCI_ROLE_CONTROL_CC1_SHIFT))
+
+#define TCPCI_POWER_CONTROL 0x1C
+#define TCPCI_POWER_CONTROL_VBUS_MON_DISABLE (1 << 6)
+#define TCPCI_POWER_CONTROL_VOLT_ALARMS_DISABLE (1 << 5)
+
+#define TCPCI_CC_STATUS 0x1D
+#define TCPCI_CC_STATUS_CC2_SHIFT 2
+#define TCPCI_CC_STATUS_CC1_SHIFT 0
+#define TCPCI_CC_STATUS_CC_STATE 0x3
+
+#define TCPCI_POWER_STATUS 0x1E
+#define TCPCI_POWER_STATUS_UNINITIALIZED (1 << 6)
+
+#define TCPCI_FAULT_STATUS 0x1F
+#define TCPCI_FAULT_STATUS_VBUS_OCP (1 << 3)
+#define TCPCI_FAULT_STATUS_VBUS_OVP (1 << 2)
+
+#define TCPCI_MESSAGE_HEADER_INFO 0x2E
+#define TCPCI_MESSAGE_HEADER_INFO_REV_SHIFT 1
+#define TCPCI_MESSAGE_HEADER_INFO_REV20 (0x1 << TCPCI_MESSAGE_HEADER_INFO_REV_SHIFT)
+
+#define TCPCI_RECEIVE_DETECT 0x2F
+#define TCPCI_RECEIVE_DETECT_HARD_RESET (1 << 5)
+#define TCPCI_RECEIVE_DETECT_SOP (1 << 0)
+
+/* READABLE_BYTE_COUNT, followed by RX_BUF_FRAME_TYPE and the message.  Every
+ * read starts at READABLE_BYTE_COUNT, so it must be read in one burst. */
+#define TCPCI_RX_BUFFER 0x30
+#define TCPCI_RX_BUF_FRAME_TYPE_SOP 0x0
+#define TCPCI_RX_BUF_FRAME_TYPE 0x7
+
+#define TCPCI_TRANSMIT 0x50
+#define TCPCI_TRANSMIT_RETRY_SHIFT 4
+#define TCPCI_TRANSMIT_RETRIES 3
+#define TCPCI_TRANSMIT_SOP 0x0
+#define TCPCI_TRANSMIT_HARD_RESET 0x5
+
+/* TX_BYTE_COUNT, followed by the message */
+#define TCPCI_TX_BUFFER 0x51
+
+#define TCPCI_VBUS_VOLTAGE 0x70
+#define TCPCI_VBUS_VOLTAGE_SCALE_SHIFT 10
+#define TCPCI_VBUS_VOLTAGE_SCALE 0x3
+#define TCPCI_VBUS_VOLTAGE_MEAS 0x3FF
+#define TCPCI_VBUS_VOLTAGE_LSB_MV 25
+
+
+#endif /* PDB_TCPCI_REGS_H */
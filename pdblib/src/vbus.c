@@ -0,0 +1,57 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vbus.h"
+
+#include "priorities.h"
+
+
+/*
+ * VBUS measurement thread
+ */
+static THD_FUNCTION(VBus, vcfg) {
+    struct pdb_config *cfg = vcfg;
+
+    chRegSetThreadName("USB_PD-VBUS");
+
+    while (true) {
+        /* Wait to be asked for a measurement.  Requests made while measuring
+         * are answered by a single measurement afterwards. */
+        chEvtWaitAny(PDB_EVT_VBUS_MEASURE);
+
+        cfg->phy->measure_vbus(cfg);
+    }
+}
+
+void pdb_vbus_run(struct pdb_config *cfg)
+{
+    if (cfg->phy->measure_vbus == NULL) {
+        return;
+    }
+
+    cfg->vbus.thread = chThdCreateStatic(cfg->vbus._wa,
+            sizeof(cfg->vbus._wa), PDB_PRIO_VBUS, VBus, cfg);
+}
+
+void pdb_vbus_measure(struct pdb_config *cfg)
+{
+    if (cfg->vbus.thread == NULL) {
+        return;
+    }
+
+    chEvtSignal(cfg->vbus.thread, PDB_EVT_VBUS_MEASURE);
+}
@@ -0,0 +1,44 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_VBUS_THREAD_H
+#define PDB_VBUS_THREAD_H
+
+#include <ch.h>
+
+#include <pdb.h>
+
+
+/* Events for the VBUS measurement thread */
+#define PDB_EVT_VBUS_MEASURE EVENT_MASK(0)
+
+/*
+ * Start the VBUS measurement thread, if the PHY can measure VBUS
+ */
+void pdb_vbus_run(struct pdb_config *cfg);
+
+/*
+ * Have VBUS measured, so that pdb_get_vbus finds a fresh measurement
+ * afterwards
+ *
+ * Doesn't wait for the measurement.  Does nothing if the PHY can't measure
+ * VBUS.
+ */
+void pdb_vbus_measure(struct pdb_config *cfg);
+
+
+#endif /* PDB_VBUS_THREAD_H */
@@ -108,7 +108,7 @@ bool pdbs_dpm_evaluate_capability(struct pdb_config *cfg,
     /* Update the stored Source_Capabilities */
     if (caps != NULL) {
         if (dpm_data->capabilities != NULL) {
-            chPoolFree(&pdb_msg_pool, (union pd_msg *) dpm_data->capabilities);
+            pdb_msg_free(cfg, (union pd_msg *) dpm_data->capabilities);
         }
         dpm_data->capabilities = caps;
     } else {
@@ -155,8 +155,9 @@ bool pdbs_dpm_evaluate_capability(struct pdb_config *cfg,
                     request->obj[0] |= PD_RDO_USB_COMMS;
                 }
 
-                /* Update requested voltage */
+                /* Update requested voltage and current */
                 dpm_data->_requested_voltage = PD_PDV2MV(PD_MV2PDV(scfg->v));
+                dpm_data->_requested_current = current;
 
                 dpm_data->_capability_match = true;
                 return true;
@@ -180,8 +181,9 @@ bool pdbs_dpm_evaluate_capability(struct pdb_config *cfg,
                     request->obj[0] |= PD_RDO_USB_COMMS;
                 }
 
-                /* Update requested voltage */
+                /* Update requested voltage and current */
                 dpm_data->_requested_voltage = PD_PRV2MV(PD_MV2PRV(scfg->v));
+                dpm_data->_requested_current = current;
 
                 dpm_data->_capability_match = true;
                 return true;
@@ -211,8 +213,9 @@ bool pdbs_dpm_evaluate_capability(struct pdb_config *cfg,
                 request->obj[0] |= PD_RDO_USB_COMMS;
             }
 
-            /* Update requested voltage */
+            /* Update requested voltage and current */
             dpm_data->_requested_voltage = PD_PDV2MV(PD_PDO_SRC_FIXED_VOLTAGE_GET(caps->obj[i]));
+            dpm_data->_requested_current = current;
 
             dpm_data->_capability_match = true;
             return true;
@@ -234,8 +237,9 @@ bool pdbs_dpm_evaluate_capability(struct pdb_config *cfg,
         request->obj[0] |= PD_RDO_USB_COMMS;
     }
 
-    /* Update requested voltage */
+    /* Update requested voltage and current */
     dpm_data->_requested_voltage = 5000;
+    dpm_data->_requested_current = DPM_MIN_CURRENT;
 
     /* At this point, we have a capability match iff the output is disabled */
     dpm_data->_capability_match = !dpm_data->output_enabled;
@@ -341,6 +345,7 @@ bool pdbs_dpm_evaluate_typec_current(struct pdb_config *cfg,
 
     /* We don't control the voltage anymore; it will always be 5 V. */
     dpm_data->_requested_voltage = 5000;
+    dpm_data->_requested_current = DPM_MIN_CURRENT;
 
     /* Make the present Type-C Current advertisement available to the rest of
      * the DPM */
@@ -359,11 +364,13 @@ bool pdbs_dpm_evaluate_typec_current(struct pdb_config *cfg,
 
     /* If 1.5 A is available and we want no more than that, great. */
     if (tcc == fusb_tcc_1_5 && current <= 150) {
+        dpm_data->_requested_current = current;
         dpm_data->_capability_match = true;
         return true;
     }
     /* If 3 A is available and we want no more than that, that's great too. */
     if (tcc == fusb_tcc_3_0 && current <= 300) {
+        dpm_data->_requested_current = current;
         dpm_data->_capability_match = true;
         return true;
     }
@@ -399,6 +406,11 @@ void pdbs_dpm_transition_default(struct pdb_config *cfg)
 
     /* Pretend we requested 5 V */
     dpm_data->_requested_voltage = 5000;
+
+    /* Until a new contract is made, only the default USB current is
+     * allowed */
+    dpm_data->_present_voltage = 5000;
+    dpm_data->_present_current = DPM_MIN_CURRENT;
 }
 
 void pdbs_dpm_transition_min(struct pdb_config *cfg)
@@ -413,10 +425,32 @@ void pdbs_dpm_transition_standby(struct pdb_config *cfg)
 
 void pdbs_dpm_transition_requested(struct pdb_config *cfg)
 {
-    (void)cfg;
+    /* Cast the dpm_data to the right type */
+    struct pdbs_dpm_data *dpm_data = cfg->dpm_data;
+
+    /* The load may now draw what was negotiated */
+    dpm_data->_present_voltage = dpm_data->_requested_voltage;
+    dpm_data->_present_current = dpm_data->_requested_current;
 }
 
 void pdbs_dpm_transition_typec(struct pdb_config *cfg)
 {
-    (void)cfg;
+    /* Cast the dpm_data to the right type */
+    struct pdbs_dpm_data *dpm_data = cfg->dpm_data;
+
+    dpm_data->_present_voltage = dpm_data->_requested_voltage;
+    dpm_data->_present_current = dpm_data->_requested_current;
+}
+
+void pdbs_dpm_shed_load(struct pdb_config *cfg)
+{
+    /* Cast the dpm_data to the right type */
+    struct pdbs_dpm_data *dpm_data = cfg->dpm_data;
+
+    /* Nothing may be drawn until the hard reset gives us a new contract */
+    dpm_data->_present_current = 0;
+
+    if (dpm_data->shed_load != NULL) {
+        dpm_data->shed_load();
+    }
 }
@@ -39,6 +39,8 @@ struct pdbs_dpm_data {
     bool led_pd_status;
     /* Whether the device is capable of USB communications */
     bool usb_comms;
+    /* Function cutting the load when the FUSB302B overheats, or NULL */
+    void (*shed_load)(void);
 
     /* Whether or not the power supply is unconstrained */
     bool _unconstrained_power;
@@ -46,8 +48,12 @@ struct pdbs_dpm_data {
     bool _capability_match;
     /* The last explicitly or implicitly negotiated voltage, in millivolts */
     int _present_voltage;
+    /* The current the load may draw, in centiamperes */
+    int _present_current;
     /* The requested voltage, in millivolts */
     int _requested_voltage;
+    /* The requested current, in centiamperes */
+    int _requested_current;
 };
 
 /*
@@ -123,5 +129,10 @@ void pdbs_dpm_transition_requested(struct pdb_config *cfg);
  */
 void pdbs_dpm_transition_typec(struct pdb_config *cfg);
 
+/*
+ * Shed the load right away because the FUSB302B overheated
+ */
+void pdbs_dpm_shed_load(struct pdb_config *cfg);
+
 
 #endif /* PDBS_DEVICE_POLICY_MANAGER_H */
@@ -9,6 +9,7 @@
 #include <hal.h>
 
 #include <pdb.h>
+#include <pdb_sim.h>
 #include <pd.h>
 #include <device_policy_manager.h>
 
@@ -16,6 +17,7 @@
 #include "chprintf.h"
 #include "shell.h"
 #include "stdlib.h"
+#include "string.h"
 
 
 /********************            CONFIGURATION VARIABLES           ********************/
@@ -78,13 +80,76 @@ static struct pdb_config pdb_config = {
         pdbs_dpm_transition_standby,
         pdbs_dpm_transition_requested,
         pdbs_dpm_transition_typec,
-        NULL /* not_supported_received */
+        NULL, /* not_supported_received */
+        pdbs_dpm_shed_load
     },
     .dpm_data = &dpm_data,
     .pd_config = &pd_config,
     .vbus_line = LINE_PWR_PP_STATE,
 };
 
+#if PDB_USE_SIM_PHY
+/*
+ * Simulated port, to exercise the protocol layers without a source
+ */
+static struct pdb_sim_config sim_data;
+
+static struct pdb_config sim_config = {
+    .phy = &pdb_sim_phy,
+    .phy_data = &sim_data,
+};
+
+/*
+ * TCPCI port controller answered by a register model, to test the TCPCI PHY
+ * without the chip
+ */
+static struct pdb_sim_tcpc sim_tcpc;
+
+static struct pdb_tcpci_config sim_tcpci_data = {
+    .i2cp = &sim_tcpc.i2c,
+    .addr = 0x50,
+};
+
+static struct pdb_config sim_tcpci_config = {
+    .phy = &pdb_tcpci_phy,
+    .phy_data = &sim_tcpci_data,
+};
+
+#if !PDB_FUSB_USE_ASYNC
+/*
+ * Two simulated ports sharing an INT_N thread, each with its own simulated
+ * source
+ */
+static struct pdb_int_n_group sim_group;
+
+static struct pdb_sim_config sim_group_data[2];
+
+static struct pdb_config sim_group_configs[2] = {
+    {
+        .phy = &pdb_sim_phy,
+        .phy_data = &sim_group_data[0],
+        .int_n_group = &sim_group,
+    },
+    {
+        .phy = &pdb_sim_phy,
+        .phy_data = &sim_group_data[1],
+        .int_n_group = &sim_group,
+    },
+};
+
+static struct pdb_config *sim_group_ports[2] = {
+    &sim_group_configs[0],
+    &sim_group_configs[1],
+};
+
+static struct pdb_int_n_group sim_group = {
+    .ports = sim_group_ports,
+    .num_ports = 2,
+    .i2cp = NULL,
+};
+#endif
+#endif
+
 /********************               PRIVATE FUNCTIONS              ********************/
 
 /*
@@ -197,6 +262,37 @@ static void print_src_pdo(BaseSequentialStream *chp, uint32_t pdo, uint8_t index
     }
 }
 
+/*
+ * Helper function for printing the statistics
+ */
+#if PDB_USE_STATS
+static void print_hist(BaseSequentialStream *chp, const char *name,
+        const struct pdb_hist *hist)
+{
+    chprintf(chp, "\t%s:", name);
+    for (uint8_t i = 0; i < PDB_HIST_BINS - 1; i++) {
+        if (hist->bins[i]) {
+            chprintf(chp, " <%uus:%u", 1U << i, hist->bins[i]);
+        }
+    }
+    if (hist->bins[PDB_HIST_BINS - 1]) {
+        chprintf(chp, " >=%uus:%u", 1U << (PDB_HIST_BINS - 2),
+                hist->bins[PDB_HIST_BINS - 1]);
+    }
+    chprintf(chp, " (max %u us)\r\n", hist->max);
+}
+#endif
+
+#if PDB_FUSB_USE_TRACE
+/*
+ * Helper function converting realtime counter ticks to microseconds
+ */
+static uint32_t trace_us(uint64_t ticks)
+{
+    return ticks / (PDB_STATS_RTC_FREQ / 1000000);
+}
+#endif
+
 /********************                PUBLIC FUNCTIONS              ********************/
 
 void usbPDControllerStart(void){
@@ -222,6 +318,21 @@ uint16_t usbPDControllerGetNegociatedVoltage(void){
     return dpm_data._requested_voltage;
 }
 
+uint16_t usbPDControllerGetNegociatedCurrent(void){
+
+    return PD_PDI2MA(dpm_data._present_current);
+}
+
+void usbPDControllerSetShedLoadCallback(void (*shed_load)(void)){
+
+    dpm_data.shed_load = shed_load;
+}
+
+uint16_t usbPDControllerGetMeasuredVoltage(void){
+
+    return pdb_get_vbus(&pdb_config);
+}
+
 bool usbPDControllerSetFixedVoltage(uint16_t voltage){
     if (voltage <= PD_MV_MAX) {
         pd_config.v = voltage;
@@ -375,6 +486,354 @@ void usbPDControllerPrintConfig(BaseSequentialStream *chp)
     }
 }
 
+void usbPDControllerPrintIntNStats(BaseSequentialStream *chp)
+{
+    static const char *rate_names[PDB_INT_N_NUM_RATES] = {
+        "normal", "fast", "idle"
+    };
+
+    /* Print the number of wakeups of the INT_N thread at each rate */
+    for (uint8_t i = 0; i < PDB_INT_N_NUM_RATES; i++) {
+        chprintf(chp, "%s rate: %u wakeups, %u with INT_N asserted\r\n",
+                rate_names[i], pdb_config.int_n.polls[i],
+                pdb_config.int_n.asserted_polls[i]);
+    }
+
+    chprintf(chp, "load sheds: %u\r\n", pdb_config.int_n.load_sheds);
+    chprintf(chp, "PHY resets: %u\r\n", pdb_config.int_n.phy_resets);
+    chprintf(chp, "RX messages read ahead: %u\r\n",
+            pdb_config.prl.rx_read_ahead);
+    chprintf(chp, "RX duplicates dropped: %u\r\n",
+            pdb_config.prl.rx_duplicates);
+    chprintf(chp, "RX messages left in the PHY for want of a buffer: %u\r\n",
+            pdb_config.prl.rx_starved);
+    chprintf(chp, "RX queue high-water: %u\r\n", pdb_config.pe.rx_queue_max);
+
+#if PDB_USE_STATS
+    static const char *src_names[PDB_INT_N_NUM_SRC] = {
+        "I_GCRCSENT", "I_TXSENT", "I_RETRYFAIL", "I_HARDRST", "I_HARDSENT",
+        "I_OCP_TEMP", "I_TOGDONE"
+    };
+    const struct pdb_int_n_stats *stats = &pdb_config.int_n.stats;
+
+    chprintf(chp, "status reads: %u, %u spurious\r\n", stats->status_reads,
+            stats->spurious_reads);
+    chprintf(chp, "masked interrupts: %u\r\n", stats->masked_irqs);
+    /* Print the latencies of each interrupt source */
+    for (uint8_t i = 0; i < PDB_INT_N_NUM_SRC; i++) {
+        chprintf(chp, "%s: %u\r\n", src_names[i], stats->count[i]);
+        if (stats->count[i]) {
+            print_hist(chp, "INT_N to signal", &stats->signal_latency[i]);
+            print_hist(chp, "signal to wakeup", &stats->wakeup_latency[i]);
+        }
+    }
+
+    const struct pdb_pe_stats *pe_stats = &pdb_config.pe.stats;
+
+    /* Print the context switches per negotiation */
+    chprintf(chp, "negotiations: %u\r\n", pe_stats->negotiations);
+    if (pe_stats->negotiations) {
+        chprintf(chp, "\tcontext switches: last %u, max %u, average %u\r\n",
+                pe_stats->ctxsw_last, pe_stats->ctxsw_max,
+                pe_stats->ctxsw_total / pe_stats->negotiations);
+    }
+
+    /* Print the transmit throughput and latency */
+    chprintf(chp, "TX messages: %u\r\n", pdb_config.prl.tx_msgs);
+    if (pdb_config.prl.tx_busy) {
+        chprintf(chp, "\tthroughput: %u messages/s while busy\r\n",
+                (uint32_t) ((uint64_t) pdb_config.prl.tx_msgs
+                    * PDB_STATS_RTC_FREQ / pdb_config.prl.tx_busy));
+    }
+    if (pdb_config.prl.tx_msgs) {
+        print_hist(chp, "submit to done", &pdb_config.prl.tx_latency);
+    }
+#else
+    chprintf(chp, "Set PDB_USE_STATS to TRUE for the interrupt latencies\r\n");
+#endif
+}
+
+void usbPDControllerResetIntNStats(void)
+{
+    for (uint8_t i = 0; i < PDB_INT_N_NUM_RATES; i++) {
+        pdb_config.int_n.polls[i] = 0;
+        pdb_config.int_n.asserted_polls[i] = 0;
+    }
+    pdb_config.int_n.load_sheds = 0;
+    pdb_config.int_n.phy_resets = 0;
+    pdb_config.prl.rx_read_ahead = 0;
+    pdb_config.prl.rx_duplicates = 0;
+    pdb_config.prl.rx_starved = 0;
+    pdb_config.pe.rx_queue_max = 0;
+#if PDB_USE_STATS
+    memset(&pdb_config.int_n.stats, 0, sizeof(pdb_config.int_n.stats));
+    memset(&pdb_config.pe.stats, 0, sizeof(pdb_config.pe.stats));
+    memset(&pdb_config.prl.tx_latency, 0, sizeof(pdb_config.prl.tx_latency));
+    pdb_config.prl.tx_msgs = 0;
+    pdb_config.prl.tx_busy = 0;
+#endif
+}
+
+void usbPDControllerPrintFusbStats(BaseSequentialStream *chp)
+{
+    const struct pdb_i2c_stats *i2c_stats = &pdb_config.fusb.i2c_stats;
+
+    /* Print the I2C errors, which are always counted */
+    chprintf(chp, "I2C: %u timeouts, %u NACKs, %u other errors, %u recoveries\r\n",
+            i2c_stats->timeouts, i2c_stats->nacks, i2c_stats->errors,
+            i2c_stats->recoveries);
+#if PDB_USE_STATS
+    if (i2c_stats->recoveries) {
+        print_hist(chp, "I2C recovery", &i2c_stats->recovery_time);
+    }
+
+    static const char *script_names[fusb_num_scripts] = {
+        "setup", "measure CC1", "measure CC2", "select CC1", "select CC2",
+        "PD reset", "reset", "hard reset", "toggle", "toggle stop", "detach",
+        "attach", "TX flush"
+    };
+    const struct pdb_fusb_stats *stats = &pdb_config.fusb.stats;
+
+    chprintf(chp, "TX: %u messages, %u bytes, %u bytes saved\r\n",
+            stats->tx_msgs, stats->tx_bytes, stats->tx_bytes_saved);
+    if (stats->tx_msgs) {
+        print_hist(chp, "TX FIFO write", &stats->tx_time);
+    }
+    chprintf(chp, "RX: %u messages, %u transactions, %u bytes\r\n",
+            stats->rx_msgs, stats->rx_transactions, stats->rx_bytes);
+    if (stats->rx_msgs) {
+        print_hist(chp, "RX FIFO read", &stats->rx_time);
+    }
+    if (stats->rx_src_caps) {
+        chprintf(chp, "Source_Capabilities: %u, %u transactions and %u bytes each\r\n",
+                stats->rx_src_caps,
+                stats->rx_src_cap_transactions / stats->rx_src_caps,
+                stats->rx_src_cap_bytes / stats->rx_src_caps);
+    }
+    /* Print the writes skipped thanks to the register shadow */
+    chprintf(chp, "Register writes (skipped/done):");
+    for (uint8_t i = 0; i < PDB_FUSB_SHADOW_LEN; i++) {
+        if (stats->shadow_hits[i] || stats->shadow_writes[i]) {
+            chprintf(chp, " 0x%02x:%u/%u", PDB_FUSB_SHADOW_FIRST + i,
+                    stats->shadow_hits[i], stats->shadow_writes[i]);
+        }
+    }
+    chprintf(chp, "\r\n");
+    chprintf(chp, "STATUS0 reads (cached/done): %u/%u\r\n",
+            stats->status0_hits, stats->status0_reads);
+    chprintf(chp, "CC orientation: %u kept, %u by toggling, %u by BC_LVL\r\n",
+            stats->orient_kept, stats->orient_toggle, stats->orient_bc_lvl);
+    if (stats->orient_kept || stats->orient_toggle || stats->orient_bc_lvl) {
+        print_hist(chp, "attach to orientation", &stats->orient_time);
+    }
+    chprintf(chp, "low power detach: %u powered down, %u attaches\r\n",
+            stats->lp_detaches, stats->lp_attaches);
+    chprintf(chp, "VBUS measurements: %u\r\n", stats->vbus_measurements);
+    if (stats->vbus_measurements) {
+        print_hist(chp, "time", &stats->vbus_time);
+    }
+    /* Print the time taken by each register script */
+    for (uint8_t i = 0; i < fusb_num_scripts; i++) {
+        if (stats->script_runs[i]) {
+            chprintf(chp, "%s script: %u runs\r\n", script_names[i],
+                    stats->script_runs[i]);
+            print_hist(chp, "time", &stats->script_time[i]);
+        }
+    }
+#if PDB_FUSB_USE_ASYNC
+    chprintf(chp, "Asynchronous transfers: %u\r\n", stats->async_xfers);
+    if (stats->async_xfers) {
+        print_hist(chp, "queued to done", &stats->async_time);
+    }
+#endif
+#else
+    chprintf(chp, "Set PDB_USE_STATS to TRUE for the FUSB302B statistics\r\n");
+#endif
+}
+
+void usbPDControllerResetFusbStats(void)
+{
+    memset(&pdb_config.fusb.i2c_stats, 0, sizeof(pdb_config.fusb.i2c_stats));
+#if PDB_USE_STATS
+    memset(&pdb_config.fusb.stats, 0, sizeof(pdb_config.fusb.stats));
+#endif
+}
+
+void usbPDControllerPrintTrace(BaseSequentialStream *chp)
+{
+#if PDB_FUSB_USE_TRACE
+    static const char *phase_names[fusb_num_phases] = {
+        "detached", "wait cap", "negotiate", "transition", "ready", "reset"
+    };
+    struct pdb_fusb_trace_entry entry;
+    struct pdb_fusb_trace_totals totals;
+    uint32_t last = pdb_fusb_trace_last(&pdb_config.fusb);
+    uint32_t first = last > PDB_FUSB_TRACE_LEN ? last - PDB_FUSB_TRACE_LEN + 1 : 1;
+    uint32_t lost = 0;
+    rtcnt_t base = 0;
+    bool have_base = false;
+    const char *name;
+
+    /* Print the transactions in the ring, oldest first.  Those overwritten
+     * while we print are skipped. */
+    chprintf(chp, "seq\tstart us\tus\tphase\tthread\top reg len data\r\n");
+    for (uint32_t seq = first; seq <= last && last != 0; seq++) {
+        if (!pdb_fusb_trace_get(&pdb_config.fusb, seq, &entry)) {
+            lost++;
+            continue;
+        }
+        if (!have_base) {
+            base = entry.start;
+            have_base = true;
+        }
+#if CH_CFG_USE_REGISTRY
+        name = chRegGetThreadNameX(entry.thread);
+#else
+        name = NULL;
+#endif
+        chprintf(chp, "%u\t%u\t%u\t%s\t", seq,
+                trace_us((rtcnt_t) (entry.start - base)),
+                trace_us((rtcnt_t) (entry.end - entry.start)),
+                phase_names[entry.phase]);
+        if (name != NULL) {
+            chprintf(chp, "%s\t", name);
+        } else {
+            chprintf(chp, "%08x\t", (uint32_t) (uintptr_t) entry.thread);
+        }
+        chprintf(chp, "%c 0x%02x %u",
+                (entry.flags & PDB_FUSB_TRACE_READ) ? 'R' : 'W',
+                entry.addr, entry.len);
+        for (uint8_t i = 0; i < entry.len && i < PDB_FUSB_TRACE_DATA_LEN; i++) {
+            chprintf(chp, " %02x", entry.data[i]);
+        }
+        if (entry.flags & PDB_FUSB_TRACE_ERROR) {
+            chprintf(chp, " error");
+        }
+        chprintf(chp, "\r\n");
+    }
+    if (lost) {
+        chprintf(chp, "%u transactions overwritten while printing\r\n", lost);
+    }
+
+    /* Print how busy the bus was in each phase */
+    pdb_fusb_trace_totals(&pdb_config.fusb, &totals);
+    for (uint8_t i = 0; i < fusb_num_phases; i++) {
+        uint32_t permille = totals.elapsed[i] == 0 ? 0
+            : totals.busy[i] * 1000 / totals.elapsed[i];
+        chprintf(chp, "%s: %u transactions, %u bytes, %u us busy over %u ms (%u.%u%%)\r\n",
+                phase_names[i], totals.transactions[i], totals.bytes[i],
+                trace_us(totals.busy[i]), trace_us(totals.elapsed[i]) / 1000,
+                permille / 10, permille % 10);
+    }
+#else
+    chprintf(chp, "Set PDB_FUSB_USE_TRACE to TRUE for the FUSB302B trace\r\n");
+#endif
+}
+
+void usbPDControllerResetTrace(void)
+{
+#if PDB_FUSB_USE_TRACE
+    pdb_fusb_trace_reset(&pdb_config.fusb);
+#endif
+}
+
+void usbPDControllerSimRxStress(BaseSequentialStream *chp, uint16_t bursts)
+{
+#if PDB_USE_SIM_PHY
+    struct pdb_sim_rx_result res;
+    bool ok = pdb_sim_rx_stress(&sim_config, bursts, &res);
+
+    chprintf(chp, "%u messages sent, %u received, %u out of order\r\n",
+            res.sent, res.received, res.out_of_order);
+    chprintf(chp, "%u retransmissions dropped, %u waits for a buffer, %u ms\r\n",
+            res.duplicates, res.starved, res.ms);
+    chprintf(chp, "%s\r\n", ok ? "PASS" : "FAIL");
+#else
+    (void) bursts;
+    chprintf(chp, "Set PDB_USE_SIM_PHY to TRUE for the simulated PHY\r\n");
+#endif
+}
+
+#if PDB_USE_SIM_PHY
+/*
+ * Helper function converting a number of messages sent in us microseconds
+ * to messages per second
+ */
+static uint32_t sim_msgs_per_s(uint32_t count, uint32_t us)
+{
+    return us == 0 ? 0 : (uint64_t) count * 1000000 / us;
+}
+#endif
+
+void usbPDControllerSimTxBench(BaseSequentialStream *chp, uint32_t count)
+{
+#if PDB_USE_SIM_PHY
+    struct pdb_sim_tx_result res;
+    bool ok = pdb_sim_tx_bench(&sim_config, count, &res);
+
+    chprintf(chp, "One at a time: %u messages in %u us, %u messages/s\r\n",
+            res.sent, res.serial_us,
+            sim_msgs_per_s(res.sent, res.serial_us));
+    chprintf(chp, "%u in flight: %u messages in %u us, %u messages/s\r\n",
+            res.depth, res.sent, res.pipelined_us,
+            sim_msgs_per_s(res.sent, res.pipelined_us));
+    chprintf(chp, "%u failed\r\n", res.failed);
+    chprintf(chp, "%s\r\n", ok ? "PASS" : "FAIL");
+#else
+    (void) count;
+    chprintf(chp, "Set PDB_USE_SIM_PHY to TRUE for the simulated PHY\r\n");
+#endif
+}
+
+void usbPDControllerSimGroup(BaseSequentialStream *chp, uint16_t rounds)
+{
+#if PDB_USE_SIM_PHY && !PDB_FUSB_USE_ASYNC
+    struct pdb_sim_group_result res;
+    uint16_t passed = 0;
+    uint32_t hard_resets = 0;
+    uint32_t max_ms = 0;
+
+    for (uint16_t i = 0; i < rounds; i++) {
+        if (pdb_sim_group_negotiate(&sim_group, &res)) {
+            passed++;
+        } else {
+            chprintf(chp, "Round %u: %u of %u ports negotiated\r\n",
+                    i + 1, res.negotiated, res.ports);
+        }
+        hard_resets += res.hard_resets;
+        if (res.ms > max_ms) {
+            max_ms = res.ms;
+        }
+    }
+
+    chprintf(chp, "%u of %u rounds passed, %u hard resets, %u ms at most\r\n",
+            passed, rounds, hard_resets, max_ms);
+    chprintf(chp, "%s\r\n", passed == rounds ? "PASS" : "FAIL");
+#elif PDB_USE_SIM_PHY
+    (void) rounds;
+    chprintf(chp, "The shared INT_N thread needs PDB_FUSB_USE_ASYNC set to FALSE\r\n");
+#else
+    (void) rounds;
+    chprintf(chp, "Set PDB_USE_SIM_PHY to TRUE for the simulated PHY\r\n");
+#endif
+}
+
+void usbPDControllerSimTcpci(BaseSequentialStream *chp)
+{
+#if PDB_USE_SIM_PHY
+    struct pdb_sim_tcpci_result res;
+    bool ok = pdb_sim_tcpci_test(&sim_tcpci_config, &sim_tcpc, &res);
+
+    chprintf(chp, "%u checks, %u failed\r\n", res.checks, res.failed);
+    if (res.first_failed != NULL) {
+        chprintf(chp, "First failed: %s\r\n", res.first_failed);
+    }
+    chprintf(chp, "%s\r\n", ok ? "PASS" : "FAIL");
+#else
+    chprintf(chp, "Set PDB_USE_SIM_PHY to TRUE for the simulated PHY\r\n");
+#endif
+}
+
 /********************                SHELL FUNCTIONS               ********************/
 
 void cmd_pd_get_source_cap(BaseSequentialStream *chp, int argc, char *argv[])
@@ -496,5 +955,122 @@ void cmd_pd_get_contract(BaseSequentialStream *chp, int argc, char *argv[])
     chprintf(chp, "Do we have a contract ? : %s \r\n", usbPDControllerIsContract() ? "yes" : "no");
     uint16_t voltage = usbPDControllerGetNegociatedVoltage();
     chprintf(chp, "Actual voltage : %d.%03d V\r\n", voltage/1000, voltage%1000);
+    voltage = usbPDControllerGetMeasuredVoltage();
+    chprintf(chp, "Measured voltage : %d.%03d V\r\n", voltage/1000, voltage%1000);
 }
 
+void cmd_pd_int_n_stats(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "reset") != 0)) {
+        shellUsage(chp, "pd_int_n_stats [reset]");
+        return;
+    }
+
+    if (argc == 1) {
+        usbPDControllerResetIntNStats();
+    } else {
+        usbPDControllerPrintIntNStats(chp);
+    }
+}
+
+void cmd_pd_fusb_stats(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "reset") != 0)) {
+        shellUsage(chp, "pd_fusb_stats [reset]");
+        return;
+    }
+
+    if (argc == 1) {
+        usbPDControllerResetFusbStats();
+    } else {
+        usbPDControllerPrintFusbStats(chp);
+    }
+}
+
+void cmd_pd_trace(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "reset") != 0)) {
+        shellUsage(chp, "pd_trace [reset]");
+        return;
+    }
+
+    if (argc == 1) {
+        usbPDControllerResetTrace();
+    } else {
+        usbPDControllerPrintTrace(chp);
+    }
+}
+
+void cmd_pd_sim_rx_stress(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint16_t bursts = 100;
+
+    if (argc > 1) {
+        shellUsage(chp, "pd_sim_rx_stress [bursts]");
+        return;
+    }
+
+    if (argc == 1) {
+        char *endptr;
+        bursts = strtol(argv[0], &endptr, 0);
+        if (endptr <= argv[0] || bursts == 0) {
+            chprintf(chp, "Invalid number of bursts\r\n");
+            return;
+        }
+    }
+
+    usbPDControllerSimRxStress(chp, bursts);
+}
+
+void cmd_pd_sim_tx_bench(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint32_t count = 10000;
+
+    if (argc > 1) {
+        shellUsage(chp, "pd_sim_tx_bench [messages]");
+        return;
+    }
+
+    if (argc == 1) {
+        char *endptr;
+        count = strtol(argv[0], &endptr, 0);
+        if (endptr <= argv[0] || count == 0) {
+            chprintf(chp, "Invalid number of messages\r\n");
+            return;
+        }
+    }
+
+    usbPDControllerSimTxBench(chp, count);
+}
+
+void cmd_pd_sim_group(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint16_t rounds = 10;
+
+    if (argc > 1) {
+        shellUsage(chp, "pd_sim_group [rounds]");
+        return;
+    }
+
+    if (argc == 1) {
+        char *endptr;
+        rounds = strtol(argv[0], &endptr, 0);
+        if (endptr <= argv[0] || rounds == 0) {
+            chprintf(chp, "Invalid number of rounds\r\n");
+            return;
+        }
+    }
+
+    usbPDControllerSimGroup(chp, rounds);
+}
+
+void cmd_pd_sim_tcpci(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void) argv;
+    if (argc > 0) {
+        shellUsage(chp, "pd_sim_tcpci");
+        return;
+    }
+
+    usbPDControllerSimTcpci(chp);
+}
@@ -39,6 +39,30 @@ bool usbPDControllerIsContract(void);
  */
 uint16_t usbPDControllerGetNegociatedVoltage(void);
 
+/**
+ * @brief 	Gets the current the load may draw with the present contract.
+ * 			Falls to 0 when the load was shed after an over-temperature,
+ * 			until a new contract is made.
+ * @return 	The current in mA.
+ */
+uint16_t usbPDControllerGetNegociatedCurrent(void);
+
+/**
+ * @brief 	Sets the function called to cut the load when the FUSB302B
+ * 			overheats. It's called from the interrupt thread of the library,
+ * 			before the hard reset, so it must be quick.
+ * 
+ * @param shed_load 	The function to call, or NULL.
+ */
+void usbPDControllerSetShedLoadCallback(void (*shed_load)(void));
+
+/**
+ * @brief 	Gets the VBUS voltage measured by the FUSB302B, with a resolution
+ * 			of 420mV. Measures it again if the last measurement is too old.
+ * @return 	The voltage in mV, or 0 if there is no VBUS.
+ */
+uint16_t usbPDControllerGetMeasuredVoltage(void);
+
 /**
  * @brief 	Sets the fixed voltage we want.
  * 			Note : 	This will launch a new negociation with the source
@@ -101,6 +125,90 @@ void usbPDControllerPrintSrcPDO(BaseSequentialStream *chp);
  */
 void usbPDControllerPrintConfig(BaseSequentialStream *chp);
 
+/**
+ * @brief 	Prints the INT_N thread statistics. The interrupt counts and
+ * 			latencies are only available if PDB_USE_STATS is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ */
+void usbPDControllerPrintIntNStats(BaseSequentialStream *chp);
+
+/**
+ * @brief 	Clears the INT_N thread statistics.
+ */
+void usbPDControllerResetIntNStats(void);
+
+/**
+ * @brief 	Prints the statistics of the I2C traffic with the FUSB302B.
+ * 			Only available if PDB_USE_STATS is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ */
+void usbPDControllerPrintFusbStats(BaseSequentialStream *chp);
+
+/**
+ * @brief 	Clears the statistics of the I2C traffic with the FUSB302B.
+ */
+void usbPDControllerResetFusbStats(void);
+
+/**
+ * @brief 	Prints the I2C transactions with the FUSB302B kept in the trace,
+ * 			and the bus occupancy of each negotiation phase.
+ * 			Only available if PDB_FUSB_USE_TRACE is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ */
+void usbPDControllerPrintTrace(BaseSequentialStream *chp);
+
+/**
+ * @brief 	Clears the trace of the I2C transactions with the FUSB302B.
+ */
+void usbPDControllerResetTrace(void);
+
+/**
+ * @brief 	Stresses the message reception of a simulated port with bursts
+ * 			of messages larger than the message pool, and prints whether
+ * 			every message came through once and in order.
+ * 			Only available if PDB_USE_SIM_PHY is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ * @param 	bursts	Number of bursts of messages to send.
+ */
+void usbPDControllerSimRxStress(BaseSequentialStream *chp, uint16_t bursts);
+
+/**
+ * @brief 	Measures how many messages per second the protocol layer of a
+ * 			simulated port sends, one at a time and with several in
+ * 			flight, and prints it.
+ * 			Only available if PDB_USE_SIM_PHY is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ * @param 	count	Number of messages to send in each run.
+ */
+void usbPDControllerSimTxBench(BaseSequentialStream *chp, uint32_t count);
+
+/**
+ * @brief 	Negotiates a contract on two simulated ports sharing an INT_N
+ * 			thread at once, each port requesting another PDO, and prints
+ * 			whether each got its own.
+ * 			Only available if PDB_USE_SIM_PHY is TRUE and
+ * 			PDB_FUSB_USE_ASYNC is FALSE.
+ * 
+ * @param 	The stream to which we want to write.
+ * @param 	rounds	Number of negotiations to run.
+ */
+void usbPDControllerSimGroup(BaseSequentialStream *chp, uint16_t rounds);
+
+/**
+ * @brief 	Runs the TCPCI PHY against a register model of a TCPC, and
+ * 			prints whether its alerts, received messages and transmission
+ * 			results were handled right.
+ * 			Only available if PDB_USE_SIM_PHY is TRUE.
+ * 
+ * @param 	The stream to which we want to write.
+ */
+void usbPDControllerSimTcpci(BaseSequentialStream *chp);
+
 /********************                SHELL FUNCTIONS               ********************/
 
 /**     
@@ -159,13 +267,77 @@ void cmd_pd_set_i(BaseSequentialStream *chp, int argc, char *argv[]);
 void cmd_pd_hv_prefered(BaseSequentialStream *chp, int argc, char *argv[]);
 /**     
  * @brief 			Shell command to print if a contract is made and the actual voltage
- * 					Calls usbPDControllerIsContract() and usbPDControllerGetNegociatedVoltage()
+ * 					Calls usbPDControllerIsContract(), usbPDControllerGetNegociatedVoltage()
+ * 					and usbPDControllerGetMeasuredVoltage()
  * 	
  * @param chp 		Pointer to the BaseSequentialStream stream to write to
  * @param argc 		Number of arguments given when calling this shell command
  * @param argv 		Array of the arguments given when calling thos shell command
  */	
 void cmd_pd_get_contract(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to print or clear the INT_N thread statistics
+ * 					Calls usbPDControllerPrintIntNStats() or usbPDControllerResetIntNStats()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_int_n_stats(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to print or clear the FUSB302B I2C statistics
+ * 					Calls usbPDControllerPrintFusbStats() or usbPDControllerResetFusbStats()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_fusb_stats(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to print or clear the FUSB302B I2C trace
+ * 					Calls usbPDControllerPrintTrace() or usbPDControllerResetTrace()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_trace(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to stress the message reception of a simulated port
+ * 					Calls usbPDControllerSimRxStress()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_sim_rx_stress(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to measure the message throughput of a simulated port
+ * 					Calls usbPDControllerSimTxBench()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_sim_tx_bench(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to negotiate on two simulated ports sharing an INT_N thread
+ * 					Calls usbPDControllerSimGroup()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_sim_group(BaseSequentialStream *chp, int argc, char *argv[]);
+/**     
+ * @brief 			Shell command to test the TCPCI PHY against a register model
+ * 					Calls usbPDControllerSimTcpci()
+ * 	
+ * @param chp 		Pointer to the BaseSequentialStream stream to write to
+ * @param argc 		Number of arguments given when calling this shell command
+ * @param argv 		Array of the arguments given when calling thos shell command
+ */	
+void cmd_pd_sim_tcpci(BaseSequentialStream *chp, int argc, char *argv[]);
 
 #define USB_PD_CONTROLLER_SHELL_CMD					\
 	{"pd_get_source_cap", cmd_pd_get_source_cap},	\
@@ -176,4 +348,13 @@ void cmd_pd_get_contract(BaseSequentialStream *chp, int argc, char *argv[]);
 	{"pd_hv_prefered", cmd_pd_hv_prefered},			\
 	{"pd_get_contract", cmd_pd_get_contract},		\
 
+#define USB_PD_CONTROLLER_DEBUG_SHELL_CMD			\
+	{"pd_int_n_stats", cmd_pd_int_n_stats},			\
+	{"pd_fusb_stats", cmd_pd_fusb_stats},			\
+	{"pd_trace", cmd_pd_trace},						\
+	{"pd_sim_rx_stress", cmd_pd_sim_rx_stress},		\
+	{"pd_sim_tx_bench", cmd_pd_sim_tx_bench},		\
+	{"pd_sim_group", cmd_pd_sim_group},				\
+	{"pd_sim_tcpci", cmd_pd_sim_tcpci},				\
+
 #endif /* USB_PD_CONTROLLER_H */
\ No newline at end of file